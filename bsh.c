@@ -0,0 +1,291 @@
+// bsh.c                                     Phil Esterman (11/13/15)
+//
+// libbsh. See bsh.h. All the shell's state is touched only in
+// the children: a pipeline's stages are started much as by
+// start_stage(), each expanding its own words in run_stage(),
+// and the caller waits for just their pids with wait4(), which
+// also gives their rusage.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "bsh.h"
+#include "parse.h"
+#include "getLine.h"
+#include "policy.h"
+#include "limit.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+extern char **environ;
+
+struct bsh_line {
+	CMD **cmds; //its command lines
+	int n;
+};
+
+int process (CMD *cmdList);
+void run_stage (CMD *cmd);
+CMD **left_spine (CMD *cmd, int type1, int type2, int *n);
+
+void bsh_child (const struct bsh_io *io, char *const envp[], const char *cwd,
+		int in, int out);
+int bsh_direct (CMD *cmd);
+int bsh_wait (pid_t pid, struct rusage *usage);
+void bsh_usage (struct rusage *total, struct rusage *ru);
+int bsh_pipe (CMD *cmd, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage);
+int bsh_shell (bsh_line *line, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage);
+
+
+//parse TEXT, one or more command lines (with any here documents
+//and the rest of groups and loops on the lines after); return a
+//handle, or NULL (after a message on stderr) on a syntax error
+bsh_line *bsh_parse (const char *text)
+{
+	bsh_line *line = calloc(1, sizeof(*line));
+	FILE *fp, *old_input;
+	char *str;
+	token *list;
+	CMD *tree;
+
+	if (!*text)
+		return line;
+	if ((fp = fmemopen((void *)text, strlen(text), "r")) == NULL)
+	{
+		free(line);
+		return NULL;
+	}
+
+	old_input = parseInput(fp); //here documents, extra lines
+	while (line && (str = getLine(fp)) != NULL)
+	{
+		list = tokenize(str);
+		free(str);
+		if (list == NULL)
+			continue;
+		tree = parse(list);
+		freeList(list);
+		if (tree == NULL)
+		{
+			bsh_free(line);
+			line = NULL;
+			break;
+		}
+		line->cmds = realloc(line->cmds, (line->n + 1) * sizeof(CMD *));
+		line->cmds[line->n++] = tree;
+	}
+	parseInput(old_input);
+	fclose(fp);
+
+	return line;
+}
+
+//free LINE
+void bsh_free (bsh_line *line)
+{
+	if (!line)
+		return;
+	for (int i = 0; i < line->n; i++)
+		freeCMD(line->cmds[i]);
+	free(line->cmds);
+	free(line);
+}
+
+//run LINE with the fds in IO, the environment ENVP, and working
+//directory CWD; return its status, or -1 if it could not start
+int bsh_run (bsh_line *line, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage)
+{
+	if (usage)
+		memset(usage, 0, sizeof(*usage));
+	if (line->n == 0)
+		return SUCCESS;
+	if (line->n == 1 && bsh_direct(line->cmds[0]))
+		return bsh_pipe(line->cmds[0], io, envp, cwd, usage);
+	return bsh_shell(line, io, envp, cwd, usage);
+}
+
+
+////////////// CHILDREN //////////////
+
+
+//in a child: make IN and OUT (unless -1) and the stderr in IO
+//its fds 0, 1, and 2, undo the caller's signal handling, and
+//set its environment to ENVP and working directory to CWD
+void bsh_child (const struct bsh_io *io, char *const envp[], const char *cwd,
+		int in, int out)
+{
+	int fd[3] = {in, out, io ? io->err : -1};
+	sigset_t none;
+
+	__fpurge(stdout); //the caller's, not ours to write
+	for (int i = 0; i < 3; i++) //out of the way first
+		if (fd[i] >= 0 && fd[i] != i)
+			fd[i] = fcntl(fd[i], F_DUPFD_CLOEXEC, 3);
+	for (int i = 0; i < 3; i++)
+		if (fd[i] >= 0 && fd[i] != i)
+			dup2(fd[i], i);
+
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+
+	if (envp)
+		environ = (char **)envp;
+	if (cwd && chdir(cwd) < 0)
+	{
+		perror(cwd);
+		_exit(ERROR);
+	}
+}
+
+//can CMD run as a pipeline of children, without a shell?
+int bsh_direct (CMD *cmd)
+{
+	return cmd->type != SEP_END && cmd->type != SEP_BG
+		&& cmd->type != SEP_AND && cmd->type != SEP_OR
+		&& cmd->type != FUNC;
+}
+
+//wait for child PID, adding its rusage to USAGE; return its
+//wait status
+int bsh_wait (pid_t pid, struct rusage *usage)
+{
+	struct rusage ru;
+	int status;
+
+	while (wait4(pid, &status, 0, &ru) < 0)
+		if (errno != EINTR)
+			return W_EXITCODE(ERROR, 0);
+	if (usage)
+		bsh_usage(usage, &ru);
+	return status;
+}
+
+//add RU to TOTAL (the largest of the maximum resident sizes)
+void bsh_usage (struct rusage *total, struct rusage *ru)
+{
+	timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+	timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+	if (ru->ru_maxrss > total->ru_maxrss)
+		total->ru_maxrss = ru->ru_maxrss;
+	total->ru_minflt += ru->ru_minflt;
+	total->ru_majflt += ru->ru_majflt;
+	total->ru_inblock += ru->ru_inblock;
+	total->ru_oublock += ru->ru_oublock;
+	total->ru_nvcsw += ru->ru_nvcsw;
+	total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+
+////////////// RUNNING //////////////
+
+
+//run pipeline (or single stage) CMD, one child per stage; the
+//status is as from wait_stages()
+int bsh_pipe (CMD *cmd, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage)
+{
+	int n = 0, n_started = 0, fdin = io ? io->in : -1, fd[2] = {-1, -1};
+	int status, overall_status = SUCCESS, saved_errno = 0;
+	CMD **spine = NULL, **stage;
+	pid_t *pid;
+
+	if (cmd->type == PIPE)
+		spine = left_spine(cmd, PIPE, PIPE, &n);
+	stage = malloc((n + 1) * sizeof(CMD *));
+	pid = malloc((n + 1) * sizeof(pid_t));
+	stage[0] = n ? spine[n-1]->left : cmd;
+	for (int i = n-1; i >= 0; i--)
+		stage[n-i] = spine[i]->right;
+
+	limit_share();
+	for (int k = 0; k <= n; k++)
+	{
+		fd[0] = fd[1] = -1;
+		if ((k < n && pipe2(fd, O_CLOEXEC) < 0)
+				|| (pid[k] = fork()) < 0)
+		{
+			saved_errno = errno;
+			if (fd[0] >= 0)
+			{
+				close(fd[0]);
+				close(fd[1]);
+			}
+			break;
+		}
+		if (pid[k] == 0)
+		{
+			if (fd[0] >= 0)
+				close(fd[0]); //the next stage's
+			bsh_child(io, envp, cwd, fdin, k < n ? fd[1] : io ? io->out : -1);
+			policy_stage(k);
+			run_stage(stage[k]);
+		}
+		n_started++;
+		if (k > 0)
+			close(fdin); //only the child reads it
+		fdin = fd[0];
+		if (fd[1] >= 0)
+			close(fd[1]);
+	}
+	if (n_started <= n && n_started > 0)
+		close(fdin);
+
+	for (int k = 0; k < n_started; k++)
+	{
+		status = bsh_wait(pid[k], usage);
+		if (WIFEXITED(status))
+		{
+			if (overall_status != ERROR)
+				overall_status = WEXITSTATUS(status);
+		}
+		else
+			overall_status = 128+WTERMSIG(status);
+		limit_status(pid[k], status);
+	}
+
+	free(spine);
+	free(stage);
+	free(pid);
+	if (saved_errno)
+	{
+		errno = saved_errno;
+		return -1;
+	}
+	return overall_status;
+}
+
+//run LINE in a forked copy of the shell
+int bsh_shell (bsh_line *line, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage)
+{
+	int status = SUCCESS;
+	pid_t pid;
+
+	limit_share();
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0)
+	{
+		bsh_child(io, envp, cwd, io ? io->in : -1, io ? io->out : -1);
+		for (int i = 0; i < line->n; i++)
+			status = process(line->cmds[i]);
+		fflush(stdout);
+		_exit(status);
+	}
+	return limit_status(pid, bsh_wait(pid, usage));
+}
@@ -0,0 +1,60 @@
+// bsh.h                                     Phil Esterman (11/13/15)
+//
+// libbsh: parse and run Bsh command lines from another program,
+// in place of system(), which starts /bin/sh to parse the line
+// and then spawns the commands. Link with libbsh.a.
+//
+//   bsh_line *line = bsh_parse("sort data | uniq -c > counts");
+//   struct bsh_io io = {-1, log_fd, log_fd};
+//   int status = bsh_run(line, &io, envp, "/srv/job", &usage);
+//   bsh_free(line);
+//
+// A line that is a pipeline or a single command (simple, group,
+// subcommand, or loop) is run with one child per stage and no
+// shell in between. Anything else (;, &, &&, ||) runs in one
+// forked copy of the shell. Either way the calling process is
+// left as it was: its fds, environment, working directory, and
+// signal handling are not changed, only the children it starts
+// are waited for, and $? and the like are set in the children.
+// Different lines may be parsed and run from different threads
+// at once.
+
+#ifndef BSH_INCLUDED
+#define BSH_INCLUDED
+
+#include <sys/resource.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bsh_line bsh_line;
+
+//fds for the stdin, stdout, and stderr of a run; -1 for the
+//caller's own
+struct bsh_io {
+	int in, out, err;
+};
+
+//parse TEXT, one or more command lines (with any here documents
+//and the rest of groups and loops on the lines after); return a
+//handle, or NULL (after a message on stderr) on a syntax error
+bsh_line *bsh_parse (const char *text);
+
+//run LINE with the fds in IO (NULL for the caller's own), the
+//environment ENVP (NULL for the caller's), and working directory
+//CWD (NULL for the caller's); return its status as Bsh would set
+//$?, or -1 (with errno set) if it could not be started. If USAGE
+//is not NULL, the resources used by the children (and theirs)
+//are stored there.
+int bsh_run (bsh_line *line, const struct bsh_io *io, char *const envp[],
+		const char *cwd, struct rusage *usage);
+
+//free LINE
+void bsh_free (bsh_line *line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+// bshc.c                                    Phil Esterman (11/13/15)
+//
+// Cache of parsed scripts.  See bshc.h for the format.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bshc.h"
+
+#define MAGIC "BSHC"
+
+struct header {
+    char magic[4];              // MAGIC
+    uint32_t version;           // BSHC_VERSION
+    uint64_t hash;              // Hash of the contents of the script
+    uint64_t check;             // Hash of the rest of the cache
+    int32_t nTree, nNode, nSlot, nRef, nText;
+};
+
+struct node {                   // CMD with indices in place of pointers
+    int32_t type, nLocal, argc, fromType, toType, nSubst;
+    int32_t name, fromFile, toFile;             // Offsets in text[]
+    int32_t locVar, locVal, argv;               // Indices in slot[]
+    int32_t subst;                              // Index in ref[]
+    int32_t left, right;                        // Indices in node[]
+};
+
+struct table {                  // Growing array of N items of SIZE bytes
+    char *item;
+    int n, alloc, size;
+};
+
+
+// Return the name of the cache for script FILE (malloc()-ed)
+static char *cacheName (const char *file)
+{
+    size_t len = strlen (file);
+    char *name = malloc (len + sizeof(".bshc"));
+
+    strcpy (name, file);
+    if (len >= 4 && !strcmp (file+len-4, ".bsh"))
+	strcat (name, "c");
+    else
+	strcat (name, ".bshc");
+    return name;
+}
+
+
+// Return the hash H updated with the N bytes at P (64-bit FNV-1a)
+static uint64_t fnv (uint64_t h, const void *p, size_t n)
+{
+    for (const unsigned char *q = p;  n > 0;  n--)
+	h = (h ^ *q++) * 1099511628211ull;
+    return h;
+}
+
+#define FNV_BASIS 14695981039346656037ull
+
+
+// Set *HASH to the hash of the contents of FILE; return 0 if successful, else
+// -1
+int hashScript (const char *file, uint64_t *hash)
+{
+    struct stat st;
+    void *p = NULL;
+    int fd;
+
+    if ((fd = open (file, O_RDONLY)) < 0)
+	return -1;
+    if (fstat (fd, &st) < 0
+	 || (st.st_size > 0
+	     && (p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+		 == MAP_FAILED)) {
+	close (fd);
+	return -1;
+    }
+    close (fd);
+
+    *hash = fnv (FNV_BASIS, p, st.st_size);
+    if (p)
+	munmap (p, st.st_size);
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Reading
+
+// Return the string at offset OFF in TEXT[N] (NULL if OFF is -1), setting *OK
+// to 0 if OFF is out of range
+static char *string (char *text, int32_t n, int32_t off, int *ok)
+{
+    if (off == -1)
+	return NULL;
+    if (off < 0 || off >= n)
+	*ok = 0;
+    return *ok ? text + off : NULL;
+}
+
+
+// Return the LEN+1 strings at index AT in PTR[N] (NULL if AT is -1), setting
+// *OK to 0 unless the last of them is the only NULL
+static char **array (char **ptr, int32_t n, int32_t at, int32_t len, int *ok)
+{
+    if (at == -1 || !*ok)
+	return NULL;
+    if (at < 0 || len < 0 || at >= n || len >= n - at || ptr[at+len] != NULL)
+	*ok = 0;
+    for (int32_t i = 0; *ok && i < len; i++)
+	if (ptr[at+i] == NULL)
+	    *ok = 0;
+    return *ok ? ptr + at : NULL;
+}
+
+
+// Return the N command lines cached for script FILE, setting *N, if the cache
+// exists and matches HASH and BSHC_VERSION; else return NULL.  As anyone who
+// can read FILE can compute HASH, the cache is only trusted if it is a regular
+// file (not a symbolic link) owned by the user or by the owner of FILE, and
+// writable by no one else.
+//
+// The cache stays mapped for the life of the shell.  Four allocations hold
+// the CMD structs, the argv[]/locVar[]/locVal[] arrays, the subst[] arrays,
+// and the list of roots; the strings are not copied.
+CMD **readCache (const char *file, uint64_t hash, int *n)
+{
+    char *name = cacheName (file), *map, *text;
+    struct header h;
+    struct node *node;
+    int32_t *tree, *slot, *ref;
+    struct stat st, script;
+    size_t size;
+    CMD *cmd, **sub, **roots;
+    char **ptr;
+    int fd, ok = 1;
+
+    fd = open (name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    free (name);
+    if (fd < 0)
+	return NULL;
+    if (fstat (fd, &st) < 0
+	 || !S_ISREG (st.st_mode)
+	 || (st.st_uid != geteuid ()                    // Planted by another?
+	     && (stat (file, &script) < 0 || st.st_uid != script.st_uid))
+	 || (st.st_mode & (S_IWGRP | S_IWOTH))
+	 || st.st_size < (off_t) sizeof(h)
+	 || read (fd, &h, sizeof(h)) != sizeof(h)
+	 || memcmp (h.magic, MAGIC, sizeof(h.magic))
+	 || h.version != BSHC_VERSION
+	 || h.hash != hash
+	 || h.nTree < 0 || h.nNode < 0 || h.nSlot < 0 || h.nRef < 0
+	 || h.nText < 0) {
+	close (fd);
+	return NULL;
+    }
+
+    size = sizeof(h) + h.nTree * sizeof(int32_t) + h.nNode * sizeof(*node)
+	 + (h.nSlot + h.nRef) * sizeof(int32_t) + h.nText;
+    if ((off_t) size != st.st_size
+	 || (map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0))
+	     == MAP_FAILED) {
+	close (fd);
+	return NULL;
+    }
+    close (fd);
+
+    tree = (int32_t *) (map + sizeof(h));
+    node = (struct node *) (tree + h.nTree);
+    slot = (int32_t *) (node + h.nNode);
+    ref  = slot + h.nSlot;
+    text = (char *) (ref + h.nRef);
+    if (fnv (FNV_BASIS, tree, size - sizeof(h)) != h.check
+	 || (h.nText > 0 && text[h.nText-1] != '\0')) {
+	munmap (map, size);
+	return NULL;
+    }
+
+    cmd   = malloc ((h.nNode + 1) * sizeof(*cmd));
+    ptr   = malloc ((h.nSlot + 1) * sizeof(*ptr));
+    sub   = malloc ((h.nRef + 1) * sizeof(*sub));
+    roots = malloc ((h.nTree + 1) * sizeof(*roots));
+
+    for (int32_t i = 0; ok && i < h.nSlot; i++)
+	ptr[i] = string (text, h.nText, slot[i], &ok);
+
+    for (int32_t i = 0; ok && i < h.nRef; i++) {
+	if (ref[i] < 0 || ref[i] >= h.nNode)
+	    ok = 0;
+	else
+	    sub[i] = cmd + ref[i];
+    }
+
+    for (int32_t i = 0; ok && i < h.nNode; i++) {
+	struct node *p = node + i;
+	CMD *c = cmd + i;
+
+	c->type     = p->type;
+	c->nLocal   = p->nLocal;
+	c->argc     = p->argc;
+	c->fromType = p->fromType;
+	c->toType   = p->toType;
+	c->nSubst   = p->nSubst;
+	c->name     = string (text, h.nText, p->name, &ok);
+	c->fromFile = string (text, h.nText, p->fromFile, &ok);
+	c->toFile   = string (text, h.nText, p->toFile, &ok);
+	c->locVar   = array (ptr, h.nSlot, p->locVar, p->nLocal, &ok);
+	c->locVal   = array (ptr, h.nSlot, p->locVal, p->nLocal, &ok);
+	c->argv     = array (ptr, h.nSlot, p->argv, p->argc, &ok);
+	if (!c->argv || (c->nLocal > 0 && (!c->locVar || !c->locVal)))
+	    ok = 0;                             // Arrays NULL only if empty
+
+	c->subst = NULL;
+	if (p->subst != -1) {                   // Substitutions come first
+	    if (p->subst < 0 || p->nSubst <= 0 || p->nSubst > MAX_SUBST
+		 || p->subst >= h.nRef || p->nSubst > h.nRef - p->subst)
+		ok = 0;
+	    for (int32_t j = 0; ok && j < p->nSubst; j++)
+		if (ref[p->subst+j] >= i)
+		    ok = 0;
+	    c->subst = ok ? sub + p->subst : NULL;
+	} else if (p->nSubst != 0) {
+	    ok = 0;
+	}
+
+	if (p->left < -1 || p->left >= i || p->right < -1 || p->right >= i)
+	    ok = 0;                             // Children come first
+	c->left  = (ok && p->left  >= 0) ? cmd + p->left  : NULL;
+	c->right = (ok && p->right >= 0) ? cmd + p->right : NULL;
+    }
+
+    for (int32_t i = 0; ok && i < h.nTree; i++) {
+	if (tree[i] < 0 || tree[i] >= h.nNode)
+	    ok = 0;
+	else
+	    roots[i] = cmd + tree[i];
+    }
+
+    if (!ok) {                                  // Damaged cache
+	free (cmd);
+	free (ptr);
+	free (sub);
+	free (roots);
+	munmap (map, size);
+	return NULL;
+    }
+
+    *n = h.nTree;
+    return roots;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Writing
+
+// Append the N items at ITEM to table *T; return the index of the first
+static int32_t append (struct table *t, const void *item, int n)
+{
+    int32_t at = t->n;
+
+    if (t->n + n > t->alloc) {
+	while (t->n + n > t->alloc)
+	    t->alloc = (t->alloc ? 2 * t->alloc : 64);
+	t->item = realloc (t->item, (size_t) t->alloc * t->size);
+    }
+    memcpy (t->item + (size_t) t->n * t->size, item, (size_t) n * t->size);
+    t->n += n;
+    return at;
+}
+
+
+struct out {
+    struct table node, slot, ref, text;
+};
+
+
+// Append string S to the text of *O; return its offset (-1 if S is NULL)
+static int32_t putString (struct out *o, const char *s)
+{
+    return s ? append (&o->text, s, strlen (s) + 1) : -1;
+}
+
+
+// Append the N strings in ARRAY and a NULL to the slots of *O; return the
+// index of the first (-1 if ARRAY is NULL)
+static int32_t putArray (struct out *o, char **array, int n)
+{
+    int32_t at, none = -1;
+
+    if (!array)
+	return -1;
+    at = o->slot.n;
+    for (int i = 0; i < n; i++) {
+	int32_t off = putString (o, array[i]);
+	append (&o->slot, &off, 1);
+    }
+    append (&o->slot, &none, 1);
+    return at;
+}
+
+
+static int32_t putCMD (struct out *o, CMD *c);
+
+// Append the struct *C whose left child has index LEFT to *O after its other
+// children; return its index
+static int32_t putNode (struct out *o, CMD *c, int32_t left)
+{
+    struct node p;
+    int32_t sub[MAX_SUBST];
+
+    for (int i = 0; i < c->nSubst; i++)
+	sub[i] = putCMD (o, c->subst[i]);
+    p.subst = (c->nSubst > 0) ? append (&o->ref, sub, c->nSubst) : -1;
+    p.right = putCMD (o, c->right);
+    p.left  = left;
+
+    p.type     = c->type;
+    p.nLocal   = c->nLocal;
+    p.argc     = c->argc;
+    p.fromType = c->fromType;
+    p.toType   = c->toType;
+    p.nSubst   = c->nSubst;
+    p.name     = putString (o, c->name);
+    p.fromFile = putString (o, c->fromFile);
+    p.toFile   = putString (o, c->toFile);
+    p.locVar   = putArray (o, c->locVar, c->nLocal);
+    p.locVal   = putArray (o, c->locVal, c->nLocal);
+    p.argv     = putArray (o, c->argv, c->argc);
+
+    return append (&o->node, &p, 1);
+}
+
+
+// Append the tree rooted at *C to *O, children first; return the index of
+// its root (-1 if C is NULL).  The left spine, which may be long, is walked
+// iteratively.
+static int32_t putCMD (struct out *o, CMD *c)
+{
+    struct table spine = {NULL, 0, 0, sizeof(CMD *)};
+    int32_t left = -1;
+
+    for ( ;  c;  c = c->left)
+	append (&spine, &c, 1);
+    for (int i = spine.n - 1; i >= 0; i--)
+	left = putNode (o, ((CMD **) spine.item)[i], left);
+    free (spine.item);
+    return left;
+}
+
+
+// Write the N bytes at BUF to FD; return 0 if successful, else -1
+static int writeAll (int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+
+    while (n > 0) {
+	ssize_t k = write (fd, p, n);
+	if (k < 0)
+	    return -1;
+	p += k;
+	n -= k;
+    }
+    return 0;
+}
+
+
+// Write the N command lines CMDS for script FILE with hash HASH to its cache,
+// silently giving up if it cannot be created.  The cache is written under a
+// temporary name and renamed, so a reader never sees part of one.
+void writeCache (const char *file, uint64_t hash, CMD **cmds, int n)
+{
+    struct out o = {{NULL, 0, 0, sizeof(struct node)},
+		    {NULL, 0, 0, sizeof(int32_t)},
+		    {NULL, 0, 0, sizeof(int32_t)},
+		    {NULL, 0, 0, 1}};
+    struct table tree = {NULL, 0, 0, sizeof(int32_t)};
+    struct header h;
+    char *name = cacheName (file), *temp;
+    int fd;
+
+    for (int i = 0; i < n; i++) {
+	int32_t root = putCMD (&o, cmds[i]);
+	append (&tree, &root, 1);
+    }
+
+    memset (&h, 0, sizeof(h));
+    memcpy (h.magic, MAGIC, sizeof(h.magic));
+    h.version = BSHC_VERSION;
+    h.hash    = hash;
+    h.nTree   = tree.n;
+    h.nNode   = o.node.n;
+    h.nSlot   = o.slot.n;
+    h.nRef    = o.ref.n;
+    h.nText   = o.text.n;
+
+    temp = malloc (strlen (name) + sizeof(".XXXXXX"));
+    sprintf (temp, "%s.XXXXXX", name);
+    h.check = fnv (FNV_BASIS, tree.item, (size_t) tree.n * tree.size);
+    h.check = fnv (h.check, o.node.item, (size_t) o.node.n * o.node.size);
+    h.check = fnv (h.check, o.slot.item, (size_t) o.slot.n * o.slot.size);
+    h.check = fnv (h.check, o.ref.item, (size_t) o.ref.n * o.ref.size);
+    h.check = fnv (h.check, o.text.item, o.text.n);
+
+    if ((fd = mkstemp (temp)) >= 0) {
+	if (writeAll (fd, &h, sizeof(h))
+	     || writeAll (fd, tree.item, (size_t) tree.n * tree.size)
+	     || writeAll (fd, o.node.item, (size_t) o.node.n * o.node.size)
+	     || writeAll (fd, o.slot.item, (size_t) o.slot.n * o.slot.size)
+	     || writeAll (fd, o.ref.item, (size_t) o.ref.n * o.ref.size)
+	     || writeAll (fd, o.text.item, o.text.n)
+	     || fchmod (fd, 0644)) {
+	    close (fd);
+	    unlink (temp);
+	} else if (close (fd) || rename (temp, name)) {
+	    unlink (temp);
+	}
+    }
+
+    free (temp);
+    free (name);
+    free (tree.item);
+    free (o.node.item);
+    free (o.slot.item);
+    free (o.ref.item);
+    free (o.text.item);
+}
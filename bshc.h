@@ -0,0 +1,41 @@
+// bshc.h                                    Phil Esterman (11/13/15)
+//
+// Cache of parsed scripts.  Running a script FILE leaves the CMD trees for
+// its command lines in a position-independent binary file next to it
+// (FILE.bshc, or FILEc when FILE ends in .bsh), keyed by a hash of FILE's
+// contents and BSHC_VERSION.  Later runs map the cache read-only and rebuild
+// the trees from it without reading or parsing FILE line by line.
+//
+// The cache is a header followed by five arrays of 32-bit integers and text:
+//
+//   tree[nTree]    index in node[] of the root of each command line
+//   node[nNode]    a CMD with strings, arrays, and children as indices
+//   slot[nSlot]    offset in text[] of each string in argv[], locVar[], or
+//                    locVal[], or -1 for the terminating NULL
+//   ref[nRef]      index in node[] of each entry in subst[]
+//   text[nText]    the strings, each followed by a null character
+//
+// where an index or offset of -1 stands for NULL.  The header holds a hash
+// of the arrays, which guards against a damaged cache.  Nodes are written
+// children first, so every child has a smaller index than its parent.
+
+#include <stdint.h>
+#include "parse.h"
+
+#define BSHC_VERSION 3          // Bump when CMD, the node types, or the
+				//   marks in words change
+
+// Set *HASH to the hash of the contents of FILE; return 0 if successful,
+// else -1
+int hashScript (const char *file, uint64_t *hash);
+
+// Return the N command lines cached for script FILE, setting *N, if the cache
+// exists, matches HASH and BSHC_VERSION, and is owned by the user (or the
+// owner of FILE) and writable by no one else; else return NULL.  The strings in
+// the trees point into the read-only mapping of the cache, so the trees must
+// not be modified or passed to freeCMD().
+CMD **readCache (const char *file, uint64_t hash, int *n);
+
+// Write the N command lines CMDS for script FILE with hash HASH to its cache,
+// silently giving up if it cannot be created
+void writeCache (const char *file, uint64_t hash, CMD **cmds, int n);
@@ -0,0 +1,388 @@
+// cmd.c                                          Stan Eisenstat (11/02/13)
+//
+// Allocate, copy, free, and dump command structures and token lists (see
+// parse.h).  Apart from mainBsh.c so that libbsh.a has them without main().
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+
+// Allocate, initialize, and return a pointer to an empty command structure
+CMD *mallocCMD (void)
+{
+    CMD *new = malloc(sizeof(*new));
+
+    new->type     = NONE;
+    new->name     = NULL;
+    new->nLocal   = 0;
+    new->locVar   = NULL;
+    new->locVal   = NULL;
+    new->argc     = 0;
+    new->argv     = malloc (sizeof(char *));
+    new->argv[0]  = NULL;
+    new->fromType = NONE;
+    new->fromFile = NULL;
+    new->toType   = NONE;
+    new->toFile   = NULL;
+    new->nSubst   = 0;
+    new->subst    = NULL;
+    new->left     = NULL;
+    new->right    = NULL;
+
+    return new;
+}
+
+
+// Print word W of command data structure *C, showing substitutions
+void dumpWord (CMD *c, char *w)
+{
+    for ( ;  *w;  w++) {
+	if (*w == SUBST_MARK && w[1]) {
+	    int i = (unsigned char) *++w, type = c->subst[i-1]->type;
+	    fprintf (stdout, "%c(#%d)",
+		     (type == PROC_IN) ? '<' : (type == PROC_OUT) ? '>' : '$', i);
+	} else if (*w == QUOTE_MARK && w[1]) {
+	    fprintf (stdout, "\\%c", *++w);           // Show as escaped
+	} else {
+	    putc (*w, stdout);
+	}
+    }
+}
+
+
+// Print arguments in command data structure rooted at *C
+void dumpArgs (CMD *c)
+{
+    for (char **q = c->argv;  *q;  q++) {
+	fprintf (stdout, ",  argv[%ld] = ", q-(c->argv));
+	dumpWord (c, *q);
+    }
+}
+
+
+// Print input/output redirections in command data structure rooted at *C
+void dumpRedirect (CMD *c)
+{
+    if (c->fromType == NONE && c->fromFile == NULL) {
+	;
+    } else if (c->fromType == RED_IN && c->fromFile != NULL) {
+	fprintf (stdout, "  <");
+	dumpWord (c, c->fromFile);
+    } else if (c->fromType == RED_IN_HERE && c->fromFile != NULL) {
+	fprintf (stdout, "  <<HERE");
+    } else if (c->fromType == RED_IN_STR && c->fromFile != NULL) {
+	fprintf (stdout, "  <<<%.*s", (int) strlen (c->fromFile) - 1, c->fromFile);
+    } else if (c->fromType == RED_IN_DUP && c->fromFile != NULL) {
+	fprintf (stdout, "  <&");
+	dumpWord (c, c->fromFile);
+    } else {
+	fprintf (stdout, "  ILLEGAL INPUT REDIRECTION");
+    }
+
+    if (c->toType == NONE && c->toFile == NULL) {
+	;
+    } else if (c->toType == RED_OUT && c->toFile != NULL) {
+	fprintf (stdout, "  >");
+	dumpWord (c, c->toFile);
+    } else if (c->toType == RED_OUT_APP && c->toFile != NULL) {
+	fprintf (stdout, "  >>");
+	dumpWord (c, c->toFile);
+    } else if (c->toType == RED_OUT_DUP && c->toFile != NULL) {
+	fprintf (stdout, "  >&");
+	dumpWord (c, c->toFile);
+    } else {
+	fprintf (stdout, "  ILLEGAL OUTPUT REDIRECTION");
+    }
+
+    if (c->nLocal > 0) {
+	fprintf (stdout, "\n         LOCAL: ");
+	for (int i = 0; i < c->nLocal; i++) {
+	    fprintf (stdout, "%s=", c->locVar[i]);
+	    dumpWord (c, c->locVal[i]);
+	    fprintf (stdout, ", ");
+	}
+    } else if (c->nLocal == 0) {
+	;
+    } else {
+	fprintf (stdout, "  INVALID NLOCAL");
+    }
+}
+
+
+// Print command data structure rooted at *C at level LEVEL
+void dumpSimple (CMD *c, int level)
+{
+    fprintf (stdout, "level = %d,  argc = %d", level, c->argc);
+
+    if (c->type == SIMPLE)
+	dumpArgs (c);
+    else if (c->type == PIPE)
+	fprintf (stdout, ",  PIPE");
+    else if (c->type == SUBCMD)
+	fprintf (stdout, ",  SUBCMD");
+    else if (c->type == GROUP)
+	fprintf (stdout, ",  GROUP");
+
+    dumpRedirect (c);
+}
+
+
+// Print command data structure rooted at *C; return SEP_END or SEP_BG
+int dumpType (CMD *c, int level)
+{
+    int type = SEP_END;
+
+    if (c->argc < 0)
+	fprintf (stdout, "  ARGC < 0");
+    else if (c->argv == NULL)
+	fprintf (stdout, "  ARGV = NULL");
+    else if (c->argv[c->argc] != NULL)
+	fprintf (stdout, "  ARGV[ARGC] != NULL");
+
+    if (c->type == SIMPLE) {
+	dumpSimple (c, level);
+	if (c->left != NULL)
+	    fprintf (stdout, "  <simple> HAS LEFT CHILD");
+	if (c->right != NULL)
+	    fprintf (stdout, "  <simple> HAS RIGHT CHILD");
+
+    } else if (c->argc > 0
+	    || c->argv == NULL
+	    || c->argv[0] != NULL) {
+	fprintf (stdout, "  INVALID ARGUMENT LIST IN NON-SIMPLE");
+
+    } else if (c->type == SUBCMD || c->type == GROUP) {
+	dumpSimple (c, level);
+	fprintf (stdout, "\nCMD:   ");
+	type = dumpType (c->left, level+1);
+	if (c->right)
+	    fprintf (stdout, "  SUBCMD HAS RIGHT CHILD");
+	char sep = (type == SEP_BG) ? '&' : ';';
+	fprintf (stdout, "  %c", sep);
+	type = SEP_END;
+
+    } else if (c->fromType != NONE
+	    || c->fromFile != NULL
+	    || c->toType != NONE
+	    || c->toFile != NULL) {
+	fprintf (stdout, "  INVALID I/O REDIRECTION IN NON-SIMPLE NON-SUBCMD");
+
+    } else if (c->type == PIPE) {
+	dumpSimple (c, level);
+	fprintf (stdout, "\nCMD:   ");
+	type = dumpType (c->left, level+1);
+	fprintf (stdout, "  |\nCMD: | ");
+
+	CMD *p;
+	for (p = c->right; p->type == PIPE; p = p->right) {
+	    type = dumpType (p->left, level+1);
+	    fprintf (stdout, "  |\nCMD: | ");
+	}
+	type = dumpType (p, level+1);
+	char sep = (type == SEP_BG) ? '&' : ';';
+	fprintf (stdout, "  %c", sep);
+	type = SEP_END;
+
+    } else if (c->type == SEP_AND) {
+	type = dumpType (c->left, level);
+	fprintf (stdout, "  &&\nCMD:   ");
+	type = dumpType (c->right, level);
+
+    } else if (c->type == SEP_OR) {
+	type = dumpType (c->left, level);
+	fprintf (stdout, "  ||\nCMD:   ");
+	type = dumpType (c->right, level);
+
+    } else if (c->type == SEP_END) {
+	type = dumpType (c->left, level);
+	if (c->right) {
+	    char sep = (type == SEP_BG) ? '&' : ';';
+	    fprintf (stdout, "  %c\nCMD:   ", sep);
+	    type = dumpType (c->right, level);
+	} else {
+	    fprintf (stdout, "  SEP_END MISSING RIGHT CHILD");
+	}
+
+    } else if (c->type == SEP_BG) {
+	dumpType (c->left, level);
+	type = SEP_BG;
+	if (c->right) {
+	    fprintf (stdout, "  &\nCMD:   ");
+	    type = dumpType (c->right, level);
+	}
+
+    } else {
+	fprintf (stdout, "  ILLEGAL CMD TYPE");
+    }
+
+    return type;
+}
+
+
+// Print command data structure rooted at *C
+void dumpCMD (CMD *c, int level)
+{
+    fprintf (stdout, "CMD:   ");
+    int type = dumpType (c, level);
+    char sep = (type == SEP_BG) ? '&' : ';';
+    fprintf (stdout, "  %c\n", sep);
+}
+
+
+// Return a malloc()-ed copy of the array ARRAY of N strings (NULL if ARRAY
+// is NULL), NULL-terminated
+static char **copyArray (char **array, int n)
+{
+    char **new;
+
+    if (!array)
+	return NULL;
+    new = malloc ((n+1) * sizeof(char *));
+    for (int i = 0; i < n; i++)
+	new[i] = strdup (array[i]);
+    new[n] = NULL;
+    return new;
+}
+
+
+// Return a malloc()-ed copy of the tree of commands rooted at *C
+CMD *copyCMD (CMD *c)
+{
+    CMD *new;
+
+    if (!c)
+	return NULL;
+
+    new = malloc (sizeof(*new));
+    *new = *c;
+    new->name     = (c->name ? strdup (c->name) : NULL);
+    new->locVar   = copyArray (c->locVar, c->nLocal);
+    new->locVal   = copyArray (c->locVal, c->nLocal);
+    new->argv     = copyArray (c->argv, c->argc);
+    new->fromFile = (c->fromFile ? strdup (c->fromFile) : NULL);
+    new->toFile   = (c->toFile ? strdup (c->toFile) : NULL);
+
+    new->subst = (c->nSubst ? malloc (c->nSubst * sizeof(CMD *)) : NULL);
+    for (int i = 0; i < c->nSubst; i++)
+	new->subst[i] = copyCMD (c->subst[i]);
+
+    new->left  = copyCMD (c->left);
+    new->right = copyCMD (c->right);
+    return new;
+}
+
+
+// Free tree of commands rooted at *C (iterating down the left spine, which
+// may be long)
+void freeCMD (CMD *c)
+{
+    CMD *left;
+
+    for ( ;  c;  c = left) {
+	free (c->name);
+	for (int i = 0; i < c->nLocal; i++) {
+	    free (c->locVar[i]);
+	    free (c->locVal[i]);
+	}
+	free (c->locVar);
+	free (c->locVal);
+
+	for (char **p = c->argv;  *p;  p++)
+	    free (*p);
+	free (c->argv);
+
+	free (c->fromFile);
+	free (c->toFile);
+
+	for (int i = 0; i < c->nSubst; i++)
+	    freeCMD (c->subst[i]);
+	free (c->subst);
+
+	freeCMD (c->right);
+
+	left = c->left;
+	free (c);
+    }
+}
+
+
+// Print list of tokens LIST
+void dumpList (struct token *list)
+{
+    struct token *p;
+
+    for (p = list;  p != NULL;  p = p->next)    // Walk down linked list
+	printf ("%s:%d ", p->text, p->type);    //   printing token and type
+    putchar ('\n');                             // Terminate line
+}
+
+
+// Free list of tokens LIST
+void freeList (token *list)
+{
+    token *p, *pnext;
+    for (p = list;  p;  p = pnext)  {
+	pnext = p->next;  p->next = NULL;       // Zap p->next and p->text
+	free(p->text);    p->text = NULL;       //   to stop accidental reuse
+	free(p);
+    }
+}
+
+
+// Print in in-order command data structure rooted at *C at depth LEVEL
+void dumpTree (CMD *c, int level)
+{
+    if (!c)
+	return;
+
+    dumpTree (c->left, level+1);
+
+    fprintf (stdout, "CMD (Depth = %d):  ", level);
+    if (c->type == SIMPLE) {
+	fprintf (stdout, "SIMPLE");
+	dumpArgs (c);
+	dumpRedirect (c);
+    } else if (c->type == PROC_IN) {
+	fprintf (stdout, "PROC_IN");
+    } else if (c->type == PROC_OUT) {
+	fprintf (stdout, "PROC_OUT");
+    } else if (c->type == SUBST_CMD) {
+	fprintf (stdout, "SUBST_CMD");
+    } else if (c->type == SUBCMD) {
+	fprintf (stdout, "SUBCMD");
+	dumpRedirect (c);
+    } else if (c->type == GROUP) {
+	fprintf (stdout, "GROUP");
+	dumpRedirect (c);
+    } else if (c->type == FOR) {
+	fprintf (stdout, "FOR %s", c->name);
+	dumpArgs (c);
+	dumpRedirect (c);
+    } else if (c->type == FUNC) {
+	fprintf (stdout, "FUNC %s", c->name);
+    } else if (c->type == WHILE || c->type == UNTIL) {
+	fprintf (stdout, (c->type == WHILE) ? "WHILE" : "UNTIL");
+	dumpRedirect (c);
+    } else if (c->type == PIPE) {
+	fprintf (stdout, "PIPE");
+    } else if (c->type == SEP_AND) {
+	fprintf (stdout, "SEP_AND");
+    } else if (c->type == SEP_OR) {
+	fprintf (stdout, "SEP_OR");
+    } else if (c->type == SEP_END) {
+	fprintf (stdout, "SEP_END");
+    } else if (c->type == SEP_BG) {
+	fprintf (stdout, "SEP_BG");
+    } else {
+	fprintf (stdout, "NONE");
+    }
+    fprintf (stdout, "\n");
+
+    for (int i = 0; i < c->nSubst; i++)         // Substitutions in <simple>
+	dumpTree (c->subst[i], level+1);
+
+    dumpTree (c->right, level+1);
+}
@@ -0,0 +1,276 @@
+// coproc.c                                  Phil Esterman (11/13/15)
+//
+// The coproc builtin. See coproc.h. A coprocess that is a simple
+// command is the program itself rather than a copy of the shell
+// waiting for it, so that wait and kill reach the filter.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include "coproc.h"
+#include "parse.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+#define STDOUT (1)
+
+struct coproc {
+	char *name;
+	pid_t pid;
+	int fd[2]; //the shell's ends: for its output, for its input
+};
+
+//table of coprocesses not yet reaped
+static struct coproc *coprocs = NULL;
+static int n_coprocs = 0;
+
+int process (CMD *cmdList);
+void run_stage (CMD *cmd);
+pid_t count_fork (void);
+void add_job (pid_t pid, int kind);
+int wait_job (pid_t pid);
+
+struct coproc *coproc_find (char *name);
+CMD *coproc_cmd (int argc, char **argv);
+void coproc_vars (struct coproc *c, int set);
+int coproc_start (char *name, CMD *cmd);
+void coproc_exit (void);
+
+
+//the coprocess NAME, or NULL
+struct coproc *coproc_find (char *name)
+{
+	for (int i = 0; i < n_coprocs; i++)
+		if (strcmp(coprocs[i].name, name) == 0)
+			return &coprocs[i];
+	return NULL;
+}
+
+//set (or unless SET, unset) NAME_PID, NAME_0, and NAME_1 for C
+void coproc_vars (struct coproc *c, int set)
+{
+	static char *suffix[] = {"_PID", "_0", "_1"};
+	int value[] = {c->pid, c->fd[0], c->fd[1]};
+	char num[16], *var;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (asprintf(&var, "%s%s", c->name, suffix[i]) < 0)
+			continue;
+		snprintf(num, sizeof(num), "%d", value[i]);
+		if (set)
+			setenv(var, num, 1);
+		else
+			unsetenv(var);
+		free(var);
+	}
+}
+
+//the command line ARGV[0] if ARGC is 1, else the simple command
+//ARGV[0] ... ARGV[ARGC-1], with the words used as they are; NULL
+//after a syntax error
+CMD *coproc_cmd (int argc, char **argv)
+{
+	token *list;
+	char *line, *w;
+	CMD *cmd;
+
+	if (argc == 1) //parse it once
+	{
+		line = malloc(strlen(argv[0]) + 2);
+		sprintf(line, "%s\n", argv[0]);
+		list = tokenize(line);
+		free(line);
+		cmd = (list ? parse(list) : NULL);
+		freeList(list);
+		return cmd;
+	}
+
+	cmd = mallocCMD();
+	cmd->type = SIMPLE;
+	cmd->argc = argc;
+	cmd->argv = realloc(cmd->argv, (argc + 1) * sizeof(char *));
+	for (int i = 0; i < argc; i++)
+	{
+		cmd->argv[i] = w = malloc(2 * strlen(argv[i]) + 1);
+		for (char *p = argv[i]; *p; p++) //never a pattern
+		{
+			if (strchr(QUOTED, *p))
+				*w++ = QUOTE_MARK;
+			*w++ = *p;
+		}
+		*w = '\0';
+	}
+	cmd->argv[argc] = NULL;
+	return cmd;
+}
+
+//start coprocess NAME running CMD
+int coproc_start (char *name, CMD *cmd)
+{
+	int in[2], out[2] = {-1, -1}; //its stdin and stdout
+	struct coproc *c;
+	int status;
+	pid_t pid;
+
+	if (pipe2(in, O_CLOEXEC) < 0)
+	{
+		perror("coproc");
+		return ERROR;
+	}
+	fflush(stdout);
+	if (pipe2(out, O_CLOEXEC) < 0 || (pid = count_fork()) < 0)
+	{
+		perror("coproc");
+		close(in[0]);
+		close(in[1]);
+		if (out[0] >= 0)
+		{
+			close(out[0]);
+			close(out[1]);
+		}
+		return ERROR;
+	}
+	if (pid == 0)
+	{
+		dup2(in[0], STDIN);
+		dup2(out[1], STDOUT);
+		close(in[0]); //builtins never exec, so close-on-exec
+		close(in[1]); //is not enough to let it see EOF
+		close(out[0]);
+		close(out[1]);
+		for (int i = 0; i < n_coprocs; i++) //nor the others
+		{
+			close(coprocs[i].fd[0]);
+			close(coprocs[i].fd[1]);
+		}
+		if (cmd->type == SIMPLE) //never returns
+			run_stage(cmd);
+		status = process(cmd);
+		fflush(stdout);
+		_exit(status);
+	}
+	close(in[0]);
+	close(out[1]);
+
+	if (n_coprocs == 0 && coprocs == NULL)
+		atexit(coproc_exit);
+	coprocs = realloc(coprocs, (n_coprocs + 1) * sizeof(*coprocs));
+	c = &coprocs[n_coprocs++];
+	c->name = strdup(name);
+	c->pid = pid;
+	c->fd[0] = out[0];
+	c->fd[1] = in[1];
+
+	add_job(pid, JOB_COPROC);
+	coproc_vars(c, 1);
+	return SUCCESS;
+}
+
+//return a new fd for the input (if WRITES) or output of coprocess
+//NAME, or a copy of fd NAME if it is a number; else -1
+int coproc_fd (char *name, int writes)
+{
+	struct coproc *c = coproc_find(name);
+	char *end;
+	long fd = -1;
+
+	if (c)
+		fd = c->fd[writes ? 1 : 0];
+	else if (isdigit((unsigned char)name[0]))
+	{
+		fd = strtol(name, &end, 10);
+		if (*end || fd > INT_MAX)
+			fd = -1;
+	}
+	if (fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	return fcntl(fd, F_DUPFD_CLOEXEC, STDOUT + 2); //not onto stdio
+}
+
+//forget child PID if it is a coprocess, closing its fds
+void coproc_done (pid_t pid)
+{
+	for (int i = 0; i < n_coprocs; i++)
+	{
+		if (coprocs[i].pid != pid)
+			continue;
+		for (int j = 0; j < 2; j++)
+			if (coprocs[i].fd[j] >= 0)
+				close(coprocs[i].fd[j]);
+		coproc_vars(&coprocs[i], 0);
+		free(coprocs[i].name);
+		coprocs[i] = coprocs[--n_coprocs];
+		return;
+	}
+}
+
+//at exit: close the inputs of the coprocesses left, so they see EOF
+void coproc_exit (void)
+{
+	for (int i = 0; i < n_coprocs; i++)
+	{
+		close(coprocs[i].fd[0]);
+		close(coprocs[i].fd[1]);
+	}
+}
+
+//coproc NAME COMMAND ..., coproc -c NAME, or coproc
+int exec_coproc (int argc, char **argv)
+{
+	struct coproc *c;
+	char *name = argv[1];
+	CMD *cmd;
+	int status;
+
+	if (argc == 1) //list them
+	{
+		for (int i = 0; i < n_coprocs; i++)
+			printf("%s\t%d\n", coprocs[i].name, coprocs[i].pid);
+		return SUCCESS;
+	}
+	if (argc == 3 && strcmp(argv[1], "-c") == 0) //EOF, then wait
+	{
+		if ((c = coproc_find(argv[2])) == NULL)
+		{
+			fprintf(stderr, "coproc: %s: no such coprocess\n", argv[2]);
+			return ERROR;
+		}
+		close(c->fd[1]);
+		c->fd[1] = -1;
+		return wait_job(c->pid); //which forgets it
+	}
+	if (argc < 3 || !(isalpha((unsigned char)name[0]) || name[0] == '_')
+			|| name[strspn(name, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				"abcdefghijklmnopqrstuvwxyz0123456789_")])
+	{
+		fprintf(stderr, "usage: coproc NAME COMMAND ... | coproc -c NAME"
+				" | coproc\n");
+		return ERROR;
+	}
+	if (coproc_find(name))
+	{
+		fprintf(stderr, "coproc: %s: already running\n", name);
+		return ERROR;
+	}
+
+	if ((cmd = coproc_cmd(argc - 2, argv + 2)) == NULL)
+	{
+		fprintf(stderr, "coproc: syntax error\n");
+		return ERROR;
+	}
+
+	status = coproc_start(name, cmd);
+	freeCMD(cmd); //the child has its own copy
+	return status;
+}
@@ -0,0 +1,33 @@
+// coproc.h                                  Phil Esterman (11/13/15)
+//
+// The coproc builtin: start a filter once and feed it from later
+// command lines, rather than paying for a new process per request.
+//
+//   coproc NAME COMMAND ...   start COMMAND as coprocess NAME
+//   coproc -c NAME            close its input and wait for it
+//   coproc                    list the coprocesses
+//
+// A single word after NAME is parsed once as a command line (so it
+// may hold |, ;, and the like); more are the words of a simple
+// command, taken as they are. It runs in a child whose stdin and
+// stdout are pipes from and to the shell. The child is a
+// job, so $! is its pid and wait works on it, and NAME_PID, NAME_0
+// (the shell's fd for its output) and NAME_1 (for its input) are
+// set. A later command redirects to it with >&NAME and from it with
+// <&NAME (or >&N and <&N with an fd). The shell's ends are
+// close-on-exec, so only commands redirected to the coprocess hold
+// them. When it is reaped they are closed and the variables unset;
+// when the shell exits, the inputs of those left are closed, so
+// that they see end of file.
+
+#define JOB_COPROC (2) //its kind of job (see add_job() in process.c)
+
+//coproc NAME COMMAND ..., coproc -c NAME, or coproc
+int exec_coproc (int argc, char **argv);
+
+//return a new fd for the input (if WRITES) or output of coprocess
+//NAME, or a copy of fd NAME if it is a number; else -1
+int coproc_fd (char *name, int writes);
+
+//forget child PID if it is a coprocess, closing its fds
+void coproc_done (pid_t pid);
@@ -0,0 +1,268 @@
+// copy.c                                    Phil Esterman (11/13/15)
+//
+// The cat and tee builtins. Between a file and a pipe (or two
+// pipes) bytes are moved with splice(); from one regular file to
+// another with copy_file_range(); from a regular file to anything
+// else with sendfile(). tee with one FILE and pipes on both sides
+// duplicates its input with tee() and splices it into the FILE.
+// Whatever the kernel will not do falls back on read() and
+// write(). Options other than tee -a are left to the programs.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include "copy.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+#define STDOUT (1)
+
+#define COPY_CHUNK (1 << 20) //most bytes moved by one system call
+#define BUF_SIZE (1 << 17)   //buffer for bytes that must pass through
+
+//can the copy go on with read() and write() after ERR?
+#define FALL_BACK(err) ((err) == EINVAL || (err) == EXDEV || \
+						(err) == ENOSYS || (err) == EOPNOTSUPP || \
+						(err) == EBADF)
+
+static char *buf = NULL;
+
+pid_t count_fork (void);
+
+int write_all (int fd, char *s, size_t n);
+int copy_rw (int in, int out);
+int tee_splice (int in, int out, int file);
+int tee_rw (int in, int out, int *file, int n_file);
+int run_program (char **argv);
+
+
+//write the N bytes at S to FD; return 0 if successful, else -1
+int write_all (int fd, char *s, size_t n)
+{
+	ssize_t m;
+
+	for (; n > 0; s += m, n -= m)
+		if ((m = write(fd, s, n)) < 0)
+			return -1;
+	return 0;
+}
+
+//copy the rest of IN to OUT through a buffer
+int copy_rw (int in, int out)
+{
+	ssize_t n;
+
+	if (!buf)
+		buf = malloc(BUF_SIZE);
+	while ((n = read(in, buf, BUF_SIZE)) > 0)
+		if (write_all(out, buf, n) < 0)
+			return -1;
+	return n;
+}
+
+//copy what remains of IN to OUT; return 0 if successful, else
+//-1 (with errno set)
+int copy_fd (int in, int out)
+{
+	struct stat st_in, st_out;
+	ssize_t n;
+
+	if (fstat(in, &st_in) < 0 || fstat(out, &st_out) < 0)
+		return -1;
+
+	if (S_ISFIFO(st_in.st_mode) || S_ISFIFO(st_out.st_mode))
+	{
+		while ((n = splice(in, NULL, out, NULL, COPY_CHUNK,
+						SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+			;
+		if (n == 0 || !FALL_BACK(errno))
+			return n;
+	}
+	else if (S_ISREG(st_in.st_mode))
+	{
+		if (S_ISREG(st_out.st_mode))
+		{
+			while ((n = copy_file_range(in, NULL, out, NULL,
+							COPY_CHUNK, 0)) > 0)
+				;
+			if (n == 0 || !FALL_BACK(errno))
+				return n;
+		}
+		while ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0)
+			;
+		if (n == 0 || !FALL_BACK(errno))
+			return n;
+	}
+
+	return copy_rw(in, out);
+}
+
+//cat [FILE ...]: copy each FILE (- or none for stdin) to stdout.
+//Return SUCCESS, or ERROR if a FILE could not be copied.
+int exec_cat (int argc, char **argv)
+{
+	int status = SUCCESS, fd, n_files = argc - 1;
+	struct stat st_in, st_out;
+	char *name;
+
+	for (int i = 1; i < argc; i++)
+		if (argv[i][0] == '-' && argv[i][1])
+			return run_program(argv);
+
+	fflush(stdout);
+	if (fstat(STDOUT, &st_out) < 0)
+		st_out.st_mode = 0;
+
+	for (int i = 1; i <= n_files || (n_files == 0 && i == 1); i++)
+	{
+		name = (n_files == 0) ? "-" : argv[i];
+		if (strcmp(name, "-") == 0)
+			fd = STDIN;
+		else if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0)
+		{
+			fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+			status = ERROR;
+			continue;
+		}
+
+		if (S_ISREG(st_out.st_mode) && fstat(fd, &st_in) == 0
+				&& st_in.st_dev == st_out.st_dev
+				&& st_in.st_ino == st_out.st_ino)
+		{
+			fprintf(stderr, "cat: %s: input file is output file\n", name);
+			status = ERROR;
+		}
+		else if (copy_fd(fd, STDOUT) < 0)
+		{
+			fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+			status = ERROR;
+		}
+
+		if (fd != STDIN)
+			close(fd);
+	}
+
+	return status;
+}
+
+//tee [-a] [FILE ...]: copy stdin to stdout and each FILE,
+//appending with -a. Return SUCCESS, or ERROR if a FILE could
+//not be opened or written.
+int exec_tee (int argc, char **argv)
+{
+	int status = SUCCESS, flags = O_TRUNC, first = 1, n_file = 0, *file;
+	struct stat st_in, st_out;
+
+	for (; first < argc && argv[first][0] == '-' && argv[first][1]; first++)
+		if (strcmp(argv[first], "-a") == 0)
+			flags = O_APPEND;
+		else
+			return run_program(argv);
+
+	file = malloc((argc - first + 1) * sizeof(int));
+	for (int i = first; i < argc; i++)
+	{
+		file[n_file] = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | flags,
+				0666);
+		if (file[n_file] < 0)
+		{
+			fprintf(stderr, "tee: %s: %s\n", argv[i], strerror(errno));
+			status = ERROR;
+		}
+		else
+			n_file++;
+	}
+
+	fflush(stdout);
+	if (n_file == 0 ? copy_fd(STDIN, STDOUT) < 0
+			: n_file == 1 && fstat(STDIN, &st_in) == 0
+				&& fstat(STDOUT, &st_out) == 0
+				&& S_ISFIFO(st_in.st_mode) && S_ISFIFO(st_out.st_mode)
+			? tee_splice(STDIN, STDOUT, file[0]) < 0
+			: tee_rw(STDIN, STDOUT, file, n_file) < 0)
+	{
+		perror("tee");
+		status = ERROR;
+	}
+
+	for (int i = 0; i < n_file; i++)
+		close(file[i]);
+	free(file);
+
+	return status;
+}
+
+//copy pipe IN to pipe OUT and to FILE: tee() duplicates the
+//bytes into OUT, and splice() then moves them into FILE
+int tee_splice (int in, int out, int file)
+{
+	ssize_t n, m;
+
+	if (!buf)
+		buf = malloc(BUF_SIZE);
+	while ((n = tee(in, out, COPY_CHUNK, 0)) > 0)
+	{
+		for (; n > 0; n -= m)
+		{
+			m = splice(in, NULL, file, NULL, n, SPLICE_F_MOVE);
+			if (m < 0 && FALL_BACK(errno)) //e.g., FILE is appended to
+			{
+				m = read(in, buf, n < BUF_SIZE ? n : BUF_SIZE);
+				if (m > 0 && write_all(file, buf, m) < 0)
+					return -1;
+			}
+			if (m <= 0)
+				return -1;
+		}
+	}
+	return n;
+}
+
+//copy IN to OUT and to the N_FILE files FILE through a buffer
+int tee_rw (int in, int out, int *file, int n_file)
+{
+	ssize_t n;
+
+	if (!buf)
+		buf = malloc(BUF_SIZE);
+	while ((n = read(in, buf, BUF_SIZE)) > 0)
+	{
+		if (write_all(out, buf, n) < 0)
+			return -1;
+		for (int i = 0; i < n_file; i++)
+			if (write_all(file[i], buf, n) < 0)
+				return -1;
+	}
+	return n;
+}
+
+//run the program ARGV[0] for options the builtin lacks and
+//return its status
+int run_program (char **argv)
+{
+	pid_t pid;
+	int status;
+
+	if ((pid = count_fork()) < 0)
+	{
+		perror(argv[0]);
+		return ERROR;
+	}
+	if (pid == 0)
+	{
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
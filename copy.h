@@ -0,0 +1,15 @@
+// copy.h                                    Phil Esterman (11/13/15)
+//
+// The cat and tee builtins, which move bytes with splice(),
+// tee(), copy_file_range(), or sendfile() rather than through
+// a buffer when the kinds of file allow it.
+
+//copy what remains of IN to OUT; return 0 if successful, else
+//-1 (with errno set)
+int copy_fd (int in, int out);
+
+//cat [FILE ...]: copy each FILE (- or none for stdin) to stdout
+int exec_cat (int argc, char **argv);
+
+//tee [-a] [FILE ...]: copy stdin to stdout and each FILE
+int exec_tee (int argc, char **argv);
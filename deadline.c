@@ -0,0 +1,195 @@
+// deadline.c                                Phil Esterman (11/13/15)
+//
+// Waits with a deadline. See deadline.h. Each child gets a
+// pidfd, which becomes readable when it exits; epoll_wait()
+// sleeps until one does or the deadline (then the grace
+// period) runs out. Where pidfd_open() is missing, children
+// are polled with waitpid(WNOHANG) instead.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "deadline.h"
+
+#define POLL_MS (10) //between polls without a pidfd
+#define N_EVENTS (16)
+
+static struct deadline current = {0, TIMEOUT_GRACE};
+
+double clock_now (void);
+int ms_until (double when);
+void kill_all (pid_t *pid, int *done, int n, int sig);
+
+
+//the monotonic time in seconds
+double clock_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//milliseconds from now until WHEN (0 if past, -1 if WHEN is 0)
+int ms_until (double when)
+{
+	double left;
+
+	if (when == 0)
+		return -1;
+	left = when - clock_now();
+	return (left <= 0) ? 0 : (left > 1e6) ? 1000000000 : (int)(left * 1000) + 1;
+}
+
+//seconds in S (N[.N] with an optional s, m, h, or d), or -1 if
+//invalid
+double parse_duration (char *s)
+{
+	char *end;
+	double n = strtod(s, &end);
+
+	if (end == s || n < 0 || s[0] == '-')
+		return -1;
+	switch (*end)
+	{
+		case 'd': n *= 24; //fall through
+		case 'h': n *= 60; //fall through
+		case 'm': n *= 60; //fall through
+		case 's': end++;
+	}
+	return *end ? -1 : n;
+}
+
+//set a deadline SECONDS from now (0 for none) with GRACE,
+//unless an earlier one is set; save the old one in SAVED
+void deadline_push (double seconds, double grace, struct deadline *saved)
+{
+	double when = clock_now() + seconds;
+
+	*saved = current;
+	if (seconds > 0 && (current.when == 0 || when < current.when))
+	{
+		current.when = when;
+		current.grace = grace;
+	}
+}
+
+//restore the deadline SAVED by deadline_push()
+void deadline_pop (struct deadline *saved)
+{
+	current = *saved;
+}
+
+//is a deadline set?
+int deadline_pending (void)
+{
+	return current.when != 0;
+}
+
+//send SIG to each child PID not DONE and to its process group
+//if it leads one
+void kill_all (pid_t *pid, int *done, int n, int sig)
+{
+	for (int i = 0; i < n; i++)
+	{
+		if (!done[i])
+		{
+			kill(-pid[i], sig); //fails unless a group
+			kill(pid[i], sig);
+		}
+	}
+}
+
+//reap the N children PID, storing their wait statuses in STATUS.
+//Return 1 if the deadline passed and they were killed, else 0.
+int wait_fg (pid_t *pid, int *status, int n)
+{
+	struct epoll_event ev, events[N_EVENTS];
+	int efd, *fd, *done, left = n, polled = 0, expired = 0, k, ms;
+	double until = current.when;
+
+	if (current.when == 0) //nothing to watch but the children
+	{
+		for (int i = 0; i < n; i++)
+			if (waitpid(pid[i], &status[i], 0) < 0)
+				status[i] = W_EXITCODE(1, 0);
+		return 0;
+	}
+
+	fd = malloc(n * sizeof(int));
+	done = calloc(n, sizeof(int));
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	for (int i = 0; i < n; i++)
+	{
+		fd[i] = (efd < 0) ? -1 : syscall(SYS_pidfd_open, pid[i], 0);
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (fd[i] >= 0 && epoll_ctl(efd, EPOLL_CTL_ADD, fd[i], &ev) < 0)
+		{
+			close(fd[i]);
+			fd[i] = -1;
+		}
+		if (fd[i] < 0)
+			polled++;
+	}
+
+	while (left > 0)
+	{
+		ms = ms_until(until);
+		if (polled && (ms < 0 || ms > POLL_MS))
+			ms = POLL_MS;
+		if (efd >= 0)
+			k = epoll_wait(efd, events, N_EVENTS, ms);
+		else
+			k = usleep(ms * 1000);
+		if (k < 0 && errno != EINTR)
+			break;
+
+		for (int j = 0; j < k; j++) //pidfds readable: exited
+		{
+			int i = events[j].data.u32;
+			if (waitpid(pid[i], &status[i], 0) < 0)
+				status[i] = W_EXITCODE(1, 0);
+			epoll_ctl(efd, EPOLL_CTL_DEL, fd[i], NULL);
+			close(fd[i]);
+			done[i] = 1;
+			left--;
+		}
+		for (int i = 0; polled && i < n; i++) //and the rest
+		{
+			if (!done[i] && fd[i] < 0
+					&& (k = waitpid(pid[i], &status[i], WNOHANG)) != 0)
+			{
+				if (k < 0)
+					status[i] = W_EXITCODE(1, 0);
+				done[i] = 1;
+				left--;
+				polled--;
+			}
+		}
+
+		if (left > 0 && until != 0 && ms_until(until) == 0)
+		{
+			kill_all(pid, done, n, expired ? SIGKILL : SIGTERM);
+			until = expired ? 0 : clock_now() + current.grace;
+			expired = 1;
+		}
+	}
+
+	for (int i = 0; i < n; i++)
+		if (fd[i] >= 0 && !done[i])
+			close(fd[i]);
+	if (efd >= 0)
+		close(efd);
+	free(fd);
+	free(done);
+
+	return expired;
+}
@@ -0,0 +1,35 @@
+// deadline.h                                Phil Esterman (11/13/15)
+//
+// Foreground waits with a deadline. While one is set (by the
+// timeout builtin), the shell waits for its children with a
+// pidfd per child and epoll rather than a blocking waitpid(),
+// and when the deadline passes sends them SIGTERM and, after a
+// grace period, SIGKILL. No watchdog process is needed.
+
+#include <sys/types.h>
+
+#define TIMED_OUT (124)   //status of a command past its deadline
+#define TIMEOUT_GRACE (2) //default seconds from SIGTERM to SIGKILL
+
+struct deadline {
+	double when;  //CLOCK_MONOTONIC seconds, or 0 for none
+	double grace; //seconds from SIGTERM to SIGKILL
+};
+
+//seconds in S (N[.N] with an optional s, m, h, or d), or -1 if
+//invalid
+double parse_duration (char *s);
+
+//set a deadline SECONDS from now (0 for none) with GRACE,
+//unless an earlier one is set; save the old one in SAVED
+void deadline_push (double seconds, double grace, struct deadline *saved);
+
+//restore the deadline SAVED by deadline_push()
+void deadline_pop (struct deadline *saved);
+
+//is a deadline set?
+int deadline_pending (void);
+
+//reap the N children PID, storing their wait statuses in STATUS.
+//Return 1 if the deadline passed and they were killed, else 0.
+int wait_fg (pid_t *pid, int *status, int n);
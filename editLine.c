@@ -0,0 +1,816 @@
+// editLine.c                                Phil Esterman (11/13/15)
+//
+// Line editing at the prompt, with history and completion.  See editLine.h.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "getLine.h"
+#include "editLine.h"
+
+#define CONTROL(c) ((c) & 0x1f)
+#define BACKSPACE 0x7f
+#define ESC       0x1b
+
+#define BLOCK     2048          // Bytes of history per block of the index
+#define SIG_BITS  4096          // Bits in the signature of a block
+#define CHUNK     65536         // Bytes indexed at a time while idle
+#define MAX_LIST  100           // Most completions listed at once
+#define MAX_QUERY 256           // Longest search query
+
+struct edit {                   // Line being edited
+    char *buf;                  //   its text (not null-terminated)
+    size_t len, pos, size;      //   its length, the cursor, and allocation
+    const char *prompt;         //   prompt shown before it
+};
+
+struct names {                  // Choices for completion
+    char **name;
+    int n, size;
+};
+
+struct block {                  // Block of entries in the search index
+    uint32_t start;             //   offset of the first
+    uint64_t sig[SIG_BITS/64];  //   a bit set for each trigram in them
+};
+
+struct node {                   // Trie node: a char and the names below it
+    char c, end;                //   char and whether a name ends here
+    int child, next;            //   first child and next sibling (-1 if none)
+};
+
+static int histFd = -1;         // History file, or -1
+static int histOpened;          //   and whether it was looked for
+static char *hist;              // Mapping of the history file
+static size_t histLen;          //   and its length
+static size_t histUsed;         //   and that of its complete lines
+
+static struct block *blocks;    // Search index: blocks of entries in order,
+static size_t nBlock, sizeBlock;    // with the first INDEXED bytes in them
+static size_t indexed;
+
+static struct node *trie;       // Trie of commands in PATH (root at 0)
+static int nNode, sizeNode;
+static char *triePath;          //   the PATH it was built from
+static char **trieDir;          //   its directories
+static struct timespec *trieTime;   // and their modification times
+static int nDir;
+
+static struct termios cooked;   // Terminal modes to restore
+static int raw;                 //   and whether they need restoring
+
+
+////////////////////////////////////////////////////////////////////////////
+// History
+
+// Map what has been appended to the history since it was last mapped, by this
+// shell or by others sharing the file
+static void histSync (void)
+{
+    struct stat st;
+    char *map, *nl;
+
+    if (histFd < 0 || fstat (histFd, &st) < 0 || st.st_size == histLen)
+	return;
+    if (st.st_size < histLen) {                 // Truncated: start over
+	munmap (hist, histLen);
+	hist = NULL;
+	histLen = histUsed = indexed = nBlock = 0;
+	if (st.st_size == 0)
+	    return;
+    }
+
+    if (hist)
+	map = mremap (hist, histLen, st.st_size, MREMAP_MAYMOVE);
+    else
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, histFd, 0);
+    if (map == MAP_FAILED)
+	return;
+    hist = map;
+    histLen = st.st_size;
+    nl = memrchr (hist, '\n', histLen);
+    histUsed = nl ? nl - hist + 1 : 0;
+}
+
+
+// Open the history file named by BSH_HISTORY (default ~/.bsh_history) and map
+// it; a failure just means no history
+static void histOpen (void)
+{
+    char *name = getenv ("BSH_HISTORY"), *home = getenv ("HOME"), *path = NULL;
+
+    histOpened = 1;
+    if (name == NULL && home && asprintf (&path, "%s/.bsh_history", home) >= 0)
+	name = path;
+    if (name && *name)
+	histFd = open (name, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free (path);
+    histSync();
+}
+
+
+// Return the offset of the start of the entry that contains offset END-1
+static size_t entryStart (size_t end)
+{
+    char *nl = (end > 1) ? memrchr (hist, '\n', end-1) : NULL;
+
+    return nl ? nl - hist + 1 : 0;
+}
+
+
+// Return the offset just past the newline of the entry that starts at START
+static size_t entryEnd (size_t start)
+{
+    char *nl = memchr (hist + start, '\n', histUsed - start);
+
+    return nl ? nl - hist + 1 : histUsed;
+}
+
+
+// Append LINE (which ends with a newline) to the history unless it is blank or
+// the same as the last entry
+static void histAdd (const char *line)
+{
+    size_t len = strlen (line), last = entryStart (histUsed);
+
+    if (histFd < 0 || strspn (line, " \t\n") == len)
+	return;
+    if (histUsed > 0 && histUsed - last == len
+	  && memcmp (hist + last, line, len) == 0)
+	return;
+    if (write (histFd, line, len) < 0)          // One write(), so lines from
+	return;                                 //   different shells do not mix
+    histSync();
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Search index
+
+// Return the bit for the trigram at S in a signature
+static unsigned trigram (const char *s)
+{
+    const unsigned char *u = (const unsigned char *) s;
+
+    return ((uint32_t) (u[0] << 16 | u[1] << 8 | u[2]) * 2654435761u) >> 20;
+}
+
+
+// Add to the index at least BYTES more of the entries (if there are so many)
+static void indexExtend (size_t bytes)
+{
+    size_t stop = indexed + bytes, end;
+    struct block *b;
+    unsigned bit;
+
+    for ( ; indexed < histUsed && indexed < stop; indexed = end) {
+	if (nBlock == 0 || indexed - blocks[nBlock-1].start >= BLOCK) {
+	    if (nBlock == sizeBlock)
+		blocks = realloc (blocks,
+			(sizeBlock = 2*sizeBlock + 64) * sizeof(*blocks));
+	    memset (&blocks[nBlock], 0, sizeof(*blocks));
+	    blocks[nBlock++].start = indexed;
+	}
+	b = &blocks[nBlock-1];
+	end = entryEnd (indexed);
+	for (size_t i = indexed; i + 3 < end; i++) {    // Not the newline
+	    bit = trigram (hist + i);
+	    b->sig[bit / 64] |= (uint64_t) 1 << (bit % 64);
+	}
+    }
+}
+
+
+// Return the offset of the newest entry that starts at or after offset AFTER
+// (the start of an entry) and before offset END and contains QUERY[0..LEN), or
+// -1 if there is none
+static long histScan (const char *query, size_t len, size_t end, size_t after)
+{
+    size_t start;
+
+    for ( ; end > after; end = start) {
+	start = entryStart (end);
+	if (memmem (hist + start, entryEnd (start) - start, query, len))
+	    return start;
+    }
+    return -1;
+}
+
+
+// Return the offset of the newest entry that starts before offset BEFORE and
+// contains QUERY[0..LEN), or -1 if there is none.  Entries not yet indexed are
+// scanned, and then only the blocks whose signatures have every trigram of
+// QUERY (all of them if it has none).
+static long histSearch (const char *query, size_t len, size_t before)
+{
+    unsigned bit[MAX_QUERY];
+    size_t nBit = 0, end, i;
+    struct block *b;
+    long m;
+
+    if (before > indexed && (m = histScan (query, len, before, indexed)) >= 0)
+	return m;
+    for (i = 0; i + 3 <= len; i++)
+	bit[nBit++] = trigram (query + i);
+
+    for (size_t k = nBlock; k-- > 0; ) {
+	b = &blocks[k];
+	if (b->start >= before)
+	    continue;
+	for (i = 0; i < nBit
+		&& (b->sig[bit[i] / 64] & (uint64_t) 1 << (bit[i] % 64)); i++)
+	    ;
+	if (i < nBit)
+	    continue;
+	end = (k+1 < nBlock) ? blocks[k+1].start : indexed;
+	if (end > before)
+	    end = before;
+	if ((m = histScan (query, len, end, b->start)) >= 0)
+	    return m;
+    }
+    return -1;
+}
+
+
+// Is there input waiting to be read?
+static int keyWaiting (void)
+{
+    struct pollfd p = {STDIN_FILENO, POLLIN, 0};
+
+    return poll (&p, 1, 0) > 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Completion
+
+// Add a copy of NAME[0..LEN) (followed by SUFFIX if not 0) to NAMES
+static void addName (struct names *names, const char *name, size_t len,
+		     char suffix)
+{
+    char *s = malloc (len + 2);
+
+    memcpy (s, name, len);
+    s[len] = suffix;
+    s[len + (suffix != 0)] = '\0';
+    if (names->n == names->size)
+	names->name = realloc (names->name,
+			(names->size = 2*names->size + 16) * sizeof(char *));
+    names->name[names->n++] = s;
+}
+
+
+// Free the names in NAMES
+static void freeNames (struct names *names)
+{
+    for (int i = 0; i < names->n; i++)
+	free (names->name[i]);
+    free (names->name);
+}
+
+
+// Return the child of trie node N for C, adding it if ADD (else -1)
+static int trieChild (int n, char c, int add)
+{
+    int k;
+
+    for (k = trie[n].child; k >= 0; k = trie[k].next)
+	if (trie[k].c == c)
+	    return k;
+    if (!add)
+	return -1;
+    if (nNode == sizeNode)
+	trie = realloc (trie, (sizeNode = 2*sizeNode + 1024) * sizeof(*trie));
+    k = nNode++;
+    trie[k].c = c;
+    trie[k].end = 0;
+    trie[k].child = -1;
+    trie[k].next = trie[n].child;
+    trie[n].child = k;
+    return k;
+}
+
+
+// Is the trie built from the current PATH and the directories in it as they
+// are now?
+static int trieFresh (void)
+{
+    char *path = getenv ("PATH");
+    struct stat st;
+
+    if (trie == NULL || strcmp (path ? path : "", triePath) != 0)
+	return 0;
+    for (int i = 0; i < nDir; i++) {
+	if (stat (trieDir[i], &st) < 0)
+	    st.st_mtim.tv_sec = st.st_mtim.tv_nsec = 0;
+	if (st.st_mtim.tv_sec != trieTime[i].tv_sec
+	      || st.st_mtim.tv_nsec != trieTime[i].tv_nsec)
+	    return 0;
+    }
+    return 1;
+}
+
+
+// Build the trie of the executables in the directories in PATH
+static void trieBuild (void)
+{
+    char *path = getenv ("PATH"), *dir, *save;
+    struct dirent *e;
+    struct stat st;
+    DIR *dp;
+    int n;
+
+    for (int i = 0; i < nDir; i++)
+	free (trieDir[i]);
+    free (triePath);
+    triePath = strdup (path ? path : "");
+    trieDir = realloc (trieDir, (strlen (triePath) + 1) * sizeof(char *));
+    trieTime = realloc (trieTime, (strlen (triePath) + 1) * sizeof(*trieTime));
+    nDir = 0;
+    if (sizeNode == 0)
+	trie = malloc ((sizeNode = 1024) * sizeof(*trie));
+    trie[0].c = trie[0].end = 0;                // Just the root
+    trie[0].child = trie[0].next = -1;
+    nNode = 1;
+
+    path = strdup (triePath);
+    for (dir = strtok_r (path, ":", &save); dir;
+	 dir = strtok_r (NULL, ":", &save)) {
+	trieDir[nDir] = strdup (dir);
+	if (stat (dir, &st) < 0)
+	    st.st_mtim.tv_sec = st.st_mtim.tv_nsec = 0;
+	trieTime[nDir++] = st.st_mtim;
+	if ((dp = opendir (dir)) == NULL)
+	    continue;
+	while ((e = readdir (dp)) != NULL) {
+	    if (e->d_name[0] == '.' || e->d_type == DT_DIR)
+		continue;
+	    if (e->d_type != DT_REG             // Symlink or unknown
+		  && (fstatat (dirfd (dp), e->d_name, &st, 0) < 0
+		      || !S_ISREG (st.st_mode)))
+		continue;
+	    if (faccessat (dirfd (dp), e->d_name, X_OK, 0) < 0)
+		continue;
+	    n = 0;
+	    for (char *s = e->d_name; *s; s++)
+		n = trieChild (n, *s, 1);
+	    trie[n].end = 1;
+	}
+	closedir (dp);
+    }
+    free (path);
+}
+
+
+// Add to NAMES the names below trie node N, where NAME[0..LEN) spells N
+static void trieCollect (int n, char *name, size_t len, struct names *names)
+{
+    if (trie[n].end)
+	addName (names, name, len, ' ');
+    for (int k = trie[n].child; k >= 0 && len < NAME_MAX; k = trie[k].next) {
+	name[len] = trie[k].c;
+	trieCollect (k, name, len+1, names);
+    }
+}
+
+
+// Add to NAMES the commands in PATH that start with WORD[0..LEN)
+static void findCommands (const char *word, size_t len, struct names *names)
+{
+    char name[NAME_MAX+1];
+    int n = 0;
+
+    if (!trieFresh())
+	trieBuild();
+    for (size_t i = 0; i < len && n >= 0; i++)
+	n = trieChild (n, word[i], 0);
+    if (n >= 0 && len <= NAME_MAX) {
+	memcpy (name, word, len);
+	trieCollect (n, name, len, names);
+    }
+}
+
+
+// Add to NAMES the files whose names start with WORD[0..LEN) (with a / after
+// those of directories)
+static void findFiles (const char *word, size_t len, struct names *names)
+{
+    const char *slash = memrchr (word, '/', len);
+    size_t nDirPart = slash ? slash - word + 1 : 0, nBase = len - nDirPart;
+    char *dir = strndup (word, nDirPart), *path;
+    struct dirent *e;
+    struct stat st;
+    DIR *dp;
+    int isDir;
+
+    if ((dp = opendir (nDirPart ? dir : ".")) != NULL) {
+	while ((e = readdir (dp)) != NULL) {
+	    if ((e->d_name[0] == '.' && (nBase == 0 || word[nDirPart] != '.'))
+		  || strncmp (e->d_name, word + nDirPart, nBase) != 0
+		  || !strcmp (e->d_name, ".") || !strcmp (e->d_name, ".."))
+		continue;
+	    isDir = (e->d_type == DT_DIR);
+	    if (e->d_type == DT_LNK || e->d_type == DT_UNKNOWN)
+		isDir = (fstatat (dirfd (dp), e->d_name, &st, 0) == 0
+			 && S_ISDIR (st.st_mode));
+	    if (asprintf (&path, "%s%s", dir, e->d_name) < 0)
+		break;
+	    addName (names, path, strlen (path), isDir ? '/' : ' ');
+	    free (path);
+	}
+	closedir (dp);
+    }
+    free (dir);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Editing
+
+// Turn off echo, line buffering, and signal chars on the terminal
+static void rawOn (void)
+{
+    struct termios t;
+
+    if (tcgetattr (STDIN_FILENO, &cooked) < 0)
+	return;
+    t = cooked;
+    t.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    t.c_iflag &= ~(IXON | ICRNL | INLCR);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr (STDIN_FILENO, TCSANOW, &t) == 0)
+	raw = 1;
+}
+
+
+// Restore the terminal as it was before rawOn()
+static void rawOff (void)
+{
+    if (raw && tcsetattr (STDIN_FILENO, TCSANOW, &cooked) == 0)
+	raw = 0;
+}
+
+
+// Write the N chars at S to the terminal
+static void put (const char *s, size_t n)
+{
+    while (n > 0) {
+	ssize_t k = write (STDOUT_FILENO, s, n);
+	if (k <= 0)
+	    return;
+	s += k;
+	n -= k;
+    }
+}
+
+
+// Redraw the line being edited and put the cursor in place
+static void refresh (struct edit *e)
+{
+    size_t n = strlen (e->prompt), col = n + e->pos;
+    char *s = malloc (n + e->len + 32);
+
+    s[0] = '\r';
+    memcpy (s+1, e->prompt, n);
+    memcpy (s+1+n, e->buf, e->len);
+    n = 1 + n + e->len;
+    n += sprintf (s+n, "\x1b[K\r");
+    if (col > 0)
+	n += sprintf (s+n, "\x1b[%zuC", col);
+    put (s, n);
+    free (s);
+}
+
+
+// Replace E->buf[FROM..TO) with S[0..N) and move the cursor to just after it
+static void replace (struct edit *e, size_t from, size_t to, const char *s,
+		     size_t n)
+{
+    if (e->len - (to - from) + n + 2 > e->size)
+	e->buf = realloc (e->buf, e->size = 2 * (e->len - (to - from) + n + 2));
+    memmove (e->buf + from + n, e->buf + to, e->len - to);
+    memcpy (e->buf + from, s, n);
+    e->len += n - (to - from);
+    e->pos = from + n;
+}
+
+
+// Compare the names *A and *B
+static int byName (const void *a, const void *b)
+{
+    return strcmp (*(char **) a, *(char **) b);
+}
+
+
+// Complete the word before the cursor; list the choices if SECOND (the second
+// TAB in a row) and none is longer
+static void complete (struct edit *e, int second)
+{
+    size_t start = e->pos, lcp, n;
+    struct names names = {NULL, 0, 0};
+    char *word, *first;
+
+    while (start > 0 && !strchr (" \t|&;<>()", e->buf[start-1]))
+	start--;
+    word = e->buf + start;
+    n = e->pos - start;
+    for (first = e->buf; first < word && isblank (*first); first++)
+	;
+    if (memchr (word, '/', n) == NULL && first == word)
+	findCommands (word, n, &names);         // First word: a command
+    else
+	findFiles (word, n, &names);
+
+    if (names.n == 0) {
+	put ("\a", 1);
+	freeNames (&names);
+	return;
+    }
+    first = names.name[0];                      // Longest common prefix
+    lcp = strlen (first);
+    for (int i = 1; i < names.n; i++)
+	for (size_t j = 0; j < lcp; j++)
+	    if (names.name[i][j] != first[j])
+		lcp = j;
+
+    if (lcp > n || names.n == 1) {
+	replace (e, start, e->pos, first, lcp);
+    } else if (second) {                        // List them
+	qsort (names.name, names.n, sizeof(char *), byName);
+	put ("\r\n", 2);
+	for (int i = 0; i < names.n && i < MAX_LIST; i++) {
+	    put (names.name[i], strlen (names.name[i]));
+	    put (" ", 1);
+	}
+	if (names.n > MAX_LIST) {
+	    char more[32];
+	    put (more, sprintf (more, "... (%d more)", names.n - MAX_LIST));
+	}
+	put ("\r\n", 2);
+    } else {
+	put ("\a", 1);
+    }
+    refresh (e);
+    freeNames (&names);
+}
+
+
+// Make E the history entry at offset AT (without its newline)
+static void showEntry (struct edit *e, size_t at)
+{
+    size_t end = entryEnd (at);
+
+    replace (e, 0, e->len, hist + at, end - at - 1);
+}
+
+
+// Read a key; return ^B, ^F, ^A, ^E, ^P, ^N, or ^D for arrows, Home, End,
+// and Delete, 0 for other escape sequences, or -1 at end of file
+static int readKey (void)
+{
+    unsigned char c, seq[3];
+
+    if (read (STDIN_FILENO, &c, 1) != 1)
+	return -1;
+    if (c != ESC)
+	return c;
+    if (read (STDIN_FILENO, seq, 1) != 1 || (seq[0] != '[' && seq[0] != 'O')
+	  || read (STDIN_FILENO, seq+1, 1) != 1)
+	return 0;
+    if (isdigit (seq[1]))                       // ESC [ n ~
+	return (read (STDIN_FILENO, seq+2, 1) == 1 && seq[2] == '~'
+		&& seq[1] == '3') ? CONTROL('D') : 0;
+    switch (seq[1]) {
+	case 'A': return CONTROL('P');
+	case 'B': return CONTROL('N');
+	case 'C': return CONTROL('F');
+	case 'D': return CONTROL('B');
+	case 'H': return CONTROL('A');
+	case 'F': return CONTROL('E');
+    }
+    return 0;
+}
+
+
+// Edit a line at the terminal after PROMPT; return it (with a newline), or
+// NULL at end of file
+static char *edit (const char *prompt)
+{
+    struct edit e = {malloc (64), 0, 0, 64, prompt};
+    char query[MAX_QUERY], searchPrompt[MAX_QUERY + 32], *saved = NULL;
+    size_t nQuery = 0, savedLen = 0, at = histUsed;
+    long match = -1;
+    int c, searching = 0, tabs = 0;
+
+    refresh (&e);
+    for ( ; ; ) {
+	while (indexed < histUsed && !keyWaiting())
+	    indexExtend (CHUNK);                // Index while idle
+	if ((c = readKey()) < 0)
+	    break;
+	tabs = (c == '\t') ? tabs+1 : 0;
+
+	if (searching) {                        // Reverse search
+	    long m = -2;
+
+	    if (c == CONTROL('R') && nQuery > 0) {
+		m = histSearch (query, nQuery, match >= 0 ? match : histUsed);
+	    } else if ((c == BACKSPACE || c == CONTROL('H')) && nQuery > 0) {
+		nQuery--;
+		m = histSearch (query, nQuery, histUsed);
+	    } else if ((isprint (c) || c >= 0x80) && nQuery < MAX_QUERY) {
+		query[nQuery++] = c;
+		m = histSearch (query, nQuery, match >= 0 ? match+1 : histUsed);
+	    } else if (c == CONTROL('G') || c == CONTROL('C')) {
+		replace (&e, 0, e.len, saved, savedLen);
+		searching = 0;
+	    } else if (c != CONTROL('R') && c != BACKSPACE
+		       && c != CONTROL('H')) {
+		searching = 0;                  // Edit the match
+	    }
+
+	    if (searching) {
+		if (m >= 0) {
+		    showEntry (&e, m);
+		    e.pos = (char *) memmem (e.buf, e.len, query, nQuery)
+			    - e.buf;
+		    match = m;
+		} else if (m == -1) {
+		    put ("\a", 1);
+		}
+		snprintf (searchPrompt, sizeof(searchPrompt),
+			  "(%sreverse-i-search)`%.*s': ",
+			  (m == -1) ? "failed " : "", (int) nQuery, query);
+		refresh (&e);
+		continue;
+	    }
+	    e.prompt = prompt;
+	    refresh (&e);
+	    if (c == CONTROL('G') || c == CONTROL('C') || c == 0)
+		continue;
+	}
+
+	switch (c) {
+	    case '\r':
+	    case '\n':
+		free (saved);
+		e.buf[e.len++] = '\n';
+		e.buf[e.len] = '\0';
+		put ("\r\n", 2);
+		return e.buf;
+
+	    case CONTROL('C'):                     // Abandon the line
+		put ("^C\r\n", 4);
+		replace (&e, 0, e.len, "", 0);
+		free (saved);
+		e.buf[e.len++] = '\n';
+		e.buf[e.len] = '\0';
+		return e.buf;
+
+	    case CONTROL('D'):
+		if (e.len == 0) {               // End of file
+		    put ("\r\n", 2);
+		    free (saved);
+		    free (e.buf);
+		    return NULL;
+		}
+		if (e.pos < e.len)
+		    replace (&e, e.pos, e.pos+1, "", 0);
+		break;
+
+	    case BACKSPACE:
+	    case CONTROL('H'):
+		if (e.pos > 0)
+		    replace (&e, e.pos-1, e.pos, "", 0);
+		break;
+
+	    case CONTROL('W'): {                   // Delete the word before
+		size_t from = e.pos;
+		while (from > 0 && isspace (e.buf[from-1]))
+		    from--;
+		while (from > 0 && !isspace (e.buf[from-1]))
+		    from--;
+		replace (&e, from, e.pos, "", 0);
+		break;
+	    }
+
+	    case CONTROL('U'):
+		replace (&e, 0, e.pos, "", 0);
+		break;
+
+	    case CONTROL('K'):
+		e.len = e.pos;
+		break;
+
+	    case CONTROL('A'):
+		e.pos = 0;
+		break;
+
+	    case CONTROL('E'):
+		e.pos = e.len;
+		break;
+
+	    case CONTROL('B'):
+		if (e.pos > 0)
+		    e.pos--;
+		break;
+
+	    case CONTROL('F'):
+		if (e.pos < e.len)
+		    e.pos++;
+		break;
+
+	    case CONTROL('P'):                     // Older entry
+		if (at == 0) {
+		    put ("\a", 1);
+		    break;
+		}
+		if (at == histUsed) {           // Keep the line being typed
+		    free (saved);
+		    saved = strndup (e.buf, savedLen = e.len);
+		}
+		showEntry (&e, at = entryStart (at));
+		break;
+
+	    case CONTROL('N'):                     // Newer entry
+		if (at == histUsed) {
+		    put ("\a", 1);
+		    break;
+		}
+		if ((at = entryEnd (at)) < histUsed)
+		    showEntry (&e, at);
+		else
+		    replace (&e, 0, e.len, saved, savedLen);
+		break;
+
+	    case CONTROL('R'):                     // Start a search
+		free (saved);
+		saved = strndup (e.buf, savedLen = e.len);
+		searching = 1;
+		nQuery = 0;
+		match = -1;
+		sprintf (searchPrompt, "(reverse-i-search)`': ");
+		e.prompt = searchPrompt;
+		break;
+
+	    case CONTROL('L'):
+		put ("\x1b[H\x1b[2J", 7);
+		break;
+
+	    case '\t':
+		complete (&e, tabs > 1);
+		continue;
+
+	    default:
+		if (isprint (c) || c >= 0x80) {  // Including UTF-8 bytes
+		    char ch = c;
+		    replace (&e, e.pos, e.pos, &ch, 1);
+		}
+		break;
+	}
+	refresh (&e);
+    }
+
+    free (saved);                               // Read error or end of file
+    free (e.buf);
+    return NULL;
+}
+
+
+// Print PROMPT and read a line as getLine(stdin) would (with its newline); the
+// line is added to the history unless it is blank or the same as the last one
+char *editLine (const char *prompt)
+{
+    char *line;
+
+    if (!isatty (STDIN_FILENO) || !isatty (STDOUT_FILENO)) {
+	fputs (prompt, stdout);
+	fflush (stdout);
+	return getLine (stdin);
+    }
+
+    if (!histOpened) {
+	histOpen();
+	atexit (rawOff);
+    }
+    histSync();                                 // Lines from other shells
+    fflush (stdout);
+    rawOn();
+    line = edit (prompt);
+    rawOff();
+    if (line)
+	histAdd (line);
+    return line;
+}
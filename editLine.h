@@ -0,0 +1,35 @@
+// editLine.h                                Phil Esterman (11/13/15)
+//
+// Line editing at the prompt, with history and completion.
+//
+// When stdin and stdout are both terminals, editLine() reads the line in raw
+// mode and supports
+//
+//   ^A ^E ^B ^F, arrows   move to the start, end, back, forward
+//   ^D ^H DEL ^K ^U ^W    delete forward, back, to the end, to the start, the
+//                           word before the cursor (^D on an empty line is EOF)
+//   Up Down, ^P ^N        step through the history
+//   ^R                    search the history backwards as the query is typed;
+//                           ^R again for an older match, ^G to cancel, and any
+//                           other key to edit (or Enter to run) the match
+//   TAB                   complete the command name (from the executables in
+//                           PATH) or file name before the cursor; TAB again
+//                           lists the choices
+//   ^C                    abandon the line
+//
+// Otherwise it just prints the prompt and reads a line with getLine().
+//
+// The history is kept in BSH_HISTORY (default ~/.bsh_history; none if empty),
+// one line per entry.  The file is only ever appended to, each line with a
+// single write(), so that shells may share it; it is mmap()-ed rather than read
+// at startup, and lines appended by other shells show up at the next prompt.
+// The index for ^R is a signature of the trigrams in each 2K block of entries
+// (a quarter the size of the history); it is extended a bit at a time while
+// waiting for a key, so ^R only has to scan the blocks that might match (and
+// whatever has not been indexed yet).  The table of commands in PATH is a
+// trie built at the first TAB and again when PATH or the modification time of
+// one of its directories changes.
+
+// Print PROMPT and read a line as getLine(stdin) would (with its newline); the
+// line is added to the history unless it is blank or the same as the last one
+char *editLine (const char *prompt);
@@ -0,0 +1,436 @@
+// jobgraph.c                                Phil Esterman (11/13/15)
+//
+// The jobgraph builtin. See jobgraph.h. The whole graph is read
+// and checked for unknown jobs and cycles before anything runs.
+// The jobs are then scanned in dependency order each time one
+// finishes: a job whose dependencies all succeeded is started if
+// a slot is free, and one after a job that failed is skipped.
+// Each job is a child running seq_cmd() on its command lines, so
+// they run just as typed at the prompt.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "jobgraph.h"
+#include "parse.h"
+#include "getLine.h"
+#include "copy.h"
+#include "limit.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+#define STDOUT (1)
+#define STDERR (2)
+
+enum {
+	N_WAITING,
+	N_RUNNING,
+	N_DONE,
+	N_FAILED,
+	N_SKIPPED
+};
+
+struct node {
+	char *name;
+	CMD **cmds;   //its command lines
+	int n_cmds;
+	char **after; //names of the jobs it comes after
+	int *dep;     //and their indices
+	int n_after;
+	int state;
+	int mark;     //for graph_order(): 1 while visited, 2 after
+	pid_t pid;
+	int out;      //memfd with its output under -s, else -1
+};
+
+struct graph {
+	struct node *node;
+	int n, size;
+	int *order;   //indices of the jobs, each after its dependencies
+	int n_order;
+};
+
+int seq_cmd (CMD *cmd);
+pid_t count_fork (void);
+void job_done (pid_t pid, int status);
+
+int graph_find (struct graph *g, char *name, int add);
+int graph_line (struct graph *g, char *line, char *file, int n_line);
+int graph_load (struct graph *g, FILE *fp, char *file);
+int graph_visit (struct graph *g, int i);
+int graph_order (struct graph *g);
+int graph_start (struct node *j, int sync);
+void graph_reap (struct graph *g, int *running);
+int graph_run (struct graph *g, int slots, int sync);
+void graph_free (struct graph *g);
+
+
+////////////// READING //////////////
+
+
+//the index of job NAME in G, or -1 if none; if ADD, a new
+//job is added for a NAME not there yet
+int graph_find (struct graph *g, char *name, int add)
+{
+	struct node *j;
+
+	for (int i = 0; i < g->n; i++)
+		if (strcmp(g->node[i].name, name) == 0)
+			return i;
+	if (!add)
+		return -1;
+
+	if (g->n == g->size)
+	{
+		g->size = g->size ? 2 * g->size : 16;
+		g->node = realloc(g->node, g->size * sizeof(*g->node));
+	}
+	j = &g->node[g->n];
+	memset(j, 0, sizeof(*j));
+	j->name = strdup(name);
+	j->out = -1;
+	return g->n++;
+}
+
+//add LINE (number N_LINE of FILE) to G
+int graph_line (struct graph *g, char *line, char *file, int n_line)
+{
+	char *p = line + strspn(line, " \t"), *name, *word;
+	struct node *j;
+	token *list;
+	CMD *tree;
+	int n, i;
+
+	if (*p == '#' || *p == '\n' || *p == '\0')
+		return SUCCESS;
+	n = strcspn(p, " \t\n:");
+	name = strndup(p, n);
+	p += n;
+	p += strspn(p, " \t");
+
+	if (n > 0 && *p == ':') //NAME: COMMAND LINE
+	{
+		i = graph_find(g, name, 1); //may move the nodes
+		j = &g->node[i];
+		free(name);
+		if ((list = tokenize(p + 1)) == NULL)
+			return SUCCESS;
+		tree = parse(list);
+		freeList(list);
+		if (tree == NULL)
+		{
+			fprintf(stderr, "jobgraph: %s: line %d: syntax error\n",
+					file, n_line);
+			return ERROR;
+		}
+		j->cmds = realloc(j->cmds, (j->n_cmds + 1) * sizeof(CMD *));
+		j->cmds[j->n_cmds++] = tree;
+		return SUCCESS;
+	}
+
+	if (n > 0 && strncmp(p, "after:", 6) == 0) //NAME after: DEP ...
+	{
+		i = graph_find(g, name, 1); //may move the nodes
+		j = &g->node[i];
+		free(name);
+		for (word = strtok(p + 6, " \t\n"); word;
+				word = strtok(NULL, " \t\n"))
+		{
+			j->after = realloc(j->after, (j->n_after + 1) * sizeof(char *));
+			j->after[j->n_after++] = strdup(word);
+		}
+		return SUCCESS;
+	}
+
+	free(name);
+	fprintf(stderr, "jobgraph: %s: line %d: expected NAME: or NAME after:\n",
+			file, n_line);
+	return ERROR;
+}
+
+//read the jobs in FP (named FILE) into G and resolve their
+//dependencies
+int graph_load (struct graph *g, FILE *fp, char *file)
+{
+	FILE *old_input = parseInput(fp); //here documents, extra lines
+	int status = SUCCESS, n_line = 0;
+	char *line;
+
+	while (status == SUCCESS && (line = getLine(fp)) != NULL)
+	{
+		status = graph_line(g, line, file, ++n_line);
+		free(line);
+	}
+	parseInput(old_input);
+
+	for (int i = 0; status == SUCCESS && i < g->n; i++)
+	{
+		struct node *j = &g->node[i];
+
+		j->dep = malloc((j->n_after + 1) * sizeof(int));
+		for (int k = 0; k < j->n_after; k++)
+		{
+			if ((j->dep[k] = graph_find(g, j->after[k], 0)) < 0)
+			{
+				fprintf(stderr, "jobgraph: %s: %s: no such job\n",
+						j->name, j->after[k]);
+				status = ERROR;
+			}
+		}
+	}
+	return status;
+}
+
+//append job I of G to its order after its dependencies
+int graph_visit (struct graph *g, int i)
+{
+	struct node *j = &g->node[i];
+
+	if (j->mark == 2)
+		return SUCCESS;
+	if (j->mark == 1)
+	{
+		fprintf(stderr, "jobgraph: %s: dependency cycle\n", j->name);
+		return ERROR;
+	}
+	j->mark = 1;
+	for (int k = 0; k < j->n_after; k++)
+		if (graph_visit(g, j->dep[k]) != SUCCESS)
+			return ERROR;
+	j->mark = 2;
+	g->order[g->n_order++] = i;
+	return SUCCESS;
+}
+
+//order the jobs of G, each after those it depends on (else in
+//the order they were named), or fail on a cycle
+int graph_order (struct graph *g)
+{
+	g->order = malloc((g->n + 1) * sizeof(int));
+	for (int i = 0; i < g->n; i++)
+		if (graph_visit(g, i) != SUCCESS)
+			return ERROR;
+	return SUCCESS;
+}
+
+
+////////////// RUNNING //////////////
+
+
+//fork job J (its output on a memfd if SYNC); return 1 if
+//started, 0 if it finished already
+int graph_start (struct node *j, int sync)
+{
+	int status = SUCCESS, null;
+
+	if (j->n_cmds == 0) //nothing to run
+	{
+		j->state = N_DONE;
+		return 0;
+	}
+	if ((sync && (j->out = memfd_create("Bsh-jobgraph", MFD_CLOEXEC)) < 0)
+			|| (j->pid = count_fork()) < 0)
+	{
+		perror("jobgraph");
+		j->state = N_FAILED;
+		return 0;
+	}
+
+	if (j->pid == 0)
+	{
+		if ((null = open("/dev/null", O_RDONLY)) >= 0)
+		{
+			dup2(null, STDIN);
+			close(null);
+		}
+		if (sync)
+		{
+			dup2(j->out, STDOUT);
+			dup2(j->out, STDERR);
+		}
+		for (int i = 0; i < j->n_cmds && status == SUCCESS; i++)
+			status = seq_cmd(j->cmds[i]);
+		fflush(stdout);
+		_exit(status);
+	}
+
+	j->state = N_RUNNING;
+	return 1;
+}
+
+//wait for a child; if it is a job of G, show its output if
+//kept and note whether it succeeded
+void graph_reap (struct graph *g, int *running)
+{
+	int status, i;
+	pid_t pid;
+
+	while ((pid = wait(&status)) < 0 && errno == EINTR)
+		;
+	if (pid < 0) //none left: should not happen
+	{
+		perror("jobgraph");
+		for (i = 0; i < g->n; i++)
+			if (g->node[i].state == N_RUNNING)
+				g->node[i].state = N_FAILED;
+		*running = 0;
+		return;
+	}
+
+	for (i = 0; i < g->n && !(g->node[i].state == N_RUNNING
+				&& g->node[i].pid == pid); i++)
+		;
+	if (i == g->n) //someone else's child
+	{
+		job_done(pid, status);
+		return;
+	}
+
+	struct node *j = &g->node[i];
+	status = limit_status(pid, status);
+	(*running)--;
+	if (j->out >= 0)
+	{
+		fflush(stdout);
+		if (lseek(j->out, 0, SEEK_SET) == 0)
+			copy_fd(j->out, STDOUT);
+		close(j->out);
+		j->out = -1;
+	}
+	j->state = status ? N_FAILED : N_DONE;
+	if (status)
+		fprintf(stderr, "jobgraph: %s: failed (%d)\n", j->name, status);
+}
+
+//run the jobs of G, at most SLOTS at once
+int graph_run (struct graph *g, int slots, int sync)
+{
+	int running = 0, status = SUCCESS, ready;
+	struct node *j, *d;
+
+	for (;;)
+	{
+		for (int k = 0; k < g->n; k++) //start or skip what we can
+		{
+			j = &g->node[g->order[k]];
+			if (j->state != N_WAITING)
+				continue;
+			ready = 1;
+			for (int i = 0; i < j->n_after && j->state == N_WAITING; i++)
+			{
+				d = &g->node[j->dep[i]];
+				if (d->state == N_FAILED || d->state == N_SKIPPED)
+				{
+					fprintf(stderr, "jobgraph: %s: skipped after %s\n",
+							j->name, d->name);
+					j->state = N_SKIPPED;
+				}
+				else if (d->state != N_DONE)
+					ready = 0;
+			}
+			if (j->state == N_WAITING && ready && running < slots)
+				running += graph_start(j, sync);
+		}
+
+		if (running == 0) //all done or skipped
+			break;
+		graph_reap(g, &running);
+	}
+
+	for (int i = 0; i < g->n; i++)
+		if (g->node[i].state != N_DONE)
+			status = ERROR;
+	return status;
+}
+
+//free G
+void graph_free (struct graph *g)
+{
+	for (int i = 0; i < g->n; i++)
+	{
+		struct node *j = &g->node[i];
+
+		for (int k = 0; k < j->n_cmds; k++)
+			freeCMD(j->cmds[k]);
+		for (int k = 0; k < j->n_after; k++)
+			free(j->after[k]);
+		free(j->cmds);
+		free(j->after);
+		free(j->dep);
+		free(j->name);
+	}
+	free(g->node);
+	free(g->order);
+}
+
+//jobgraph [-s] [-j SLOTS] [FILE]
+int exec_jobgraph (int argc, char **argv)
+{
+	struct graph g = {NULL, 0, 0, NULL, 0};
+	char *file = "-", *slot_str = getenv("JOBSLOTS"), *end;
+	int sync = 0, slots, status, i, in;
+	FILE *fp;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0)
+			sync = 1;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			slot_str = argv[++i];
+		else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2])
+			slot_str = argv[i] + 2;
+		else
+		{
+			fprintf(stderr, "usage: jobgraph [-s] [-j SLOTS] [FILE]\n");
+			return ERROR;
+		}
+	}
+	if (i < argc)
+		file = argv[i++];
+	if (i < argc)
+	{
+		fprintf(stderr, "usage: jobgraph [-s] [-j SLOTS] [FILE]\n");
+		return ERROR;
+	}
+
+	if (slot_str && *slot_str)
+	{
+		slots = strtol(slot_str, &end, 10);
+		if (*end || slots < 1)
+		{
+			fprintf(stderr, "jobgraph: %s: invalid number of slots\n",
+					slot_str);
+			return ERROR;
+		}
+	}
+	else if ((slots = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		slots = 1;
+
+	if (strcmp(file, "-") == 0) //a copy, so stdin stays open
+		fp = ((in = dup(STDIN)) < 0) ? NULL : fdopen(in, "r");
+	else
+		fp = fopen(file, "r");
+	if (fp == NULL)
+	{
+		perror(file);
+		return ERROR;
+	}
+	fcntl(fileno(fp), F_SETFD, FD_CLOEXEC); //not for the jobs
+
+	status = graph_load(&g, fp, file);
+	fclose(fp);
+	if (status == SUCCESS)
+		status = graph_order(&g);
+	if (status == SUCCESS)
+		status = graph_run(&g, slots, sync);
+	graph_free(&g);
+
+	return status;
+}
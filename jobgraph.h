@@ -0,0 +1,23 @@
+// jobgraph.h                                Phil Esterman (11/13/15)
+//
+// The jobgraph builtin: run named jobs, each one or more Bsh
+// command lines, as soon as the jobs they come after succeed.
+//
+//   jobgraph [-s] [-j SLOTS] [FILE]
+//
+// FILE (default stdin) holds lines of the form
+//
+//   NAME: COMMAND LINE     add a command line to job NAME
+//   NAME after: DEP ...    start NAME only once each DEP succeeds
+//
+// Blank lines and lines starting with # are ignored. A job's
+// command lines run in order in one child, with /dev/null as
+// stdin, until one fails; a job with none just succeeds. At most
+// SLOTS jobs (default JOBSLOTS, else the number of CPUs) run at
+// once. When a job fails, the jobs after it are skipped, but the
+// rest still run. With -s each job's stdout and stderr are shown
+// together when it finishes rather than as it runs. The status
+// is 0 if every job succeeded, else 1.
+
+//jobgraph [-s] [-j SLOTS] [FILE]
+int exec_jobgraph (int argc, char **argv);
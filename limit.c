@@ -0,0 +1,405 @@
+// limit.c                                   Phil Esterman (11/13/15)
+//
+// Resource limits with setrlimit() and, for memory and CPU caps,
+// a cgroup v2 directory per command. See limit.h. The child
+// makes BSH_CGROUP/bsh-PID, notes PID in a table it shares with
+// the shell, and moves itself in. When the shell reaps a PID in
+// that table, it reads whether the OOM killer fired there, kills
+// whatever the command left running in the cgroup, and removes it.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "limit.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CPU_PERIOD (100000) //cpu.max period (usec)
+#define MAX_CAPPED (256)    //commands in cgroups at once
+
+#define SOFT (1)
+#define HARD (2)
+
+static int in_cgroup = 0; //already moved into a cgroup of Bsh's?
+static pid_t *capped;     //pids with a cgroup (0 = free slot),
+                          //shared by the shell and its children
+
+static struct limit {
+	char opt;     //option letter
+	int resource; //for setrlimit()
+	rlim_t unit;  //bytes per unit shown
+	char *name;
+} limits[] = {
+	{'c', RLIMIT_CORE,   1024, "core file size (KiB)"},
+	{'d', RLIMIT_DATA,   1024, "data segment size (KiB)"},
+	{'f', RLIMIT_FSIZE,  1024, "file size (KiB)"},
+	{'n', RLIMIT_NOFILE, 1,    "open files"},
+	{'s', RLIMIT_STACK,  1024, "stack size (KiB)"},
+	{'t', RLIMIT_CPU,    1,    "cpu time (seconds)"},
+	{'u', RLIMIT_NPROC,  1,    "processes"},
+	{'v', RLIMIT_AS,     1024, "virtual memory (KiB)"},
+	{0, 0, 0, NULL}
+};
+
+int set_limits (int argc, char **argv, char *who);
+struct limit *find_limit (char opt);
+void show_limit (struct limit *l, int which, int label);
+int set_limit (struct limit *l, int which, char *value, char *who);
+char *cgroup_dir (pid_t pid);
+int write_file (char *dir, char *name, char *value);
+long long parse_size (char *s);
+pid_t *capped_slot (pid_t pid, pid_t want);
+void remove_cgroup (char *dir);
+
+
+////////////// RLIMITS //////////////
+
+
+//the limit with option letter OPT, or NULL if none
+struct limit *find_limit (char opt)
+{
+	struct limit *l;
+
+	for (l = limits; l->opt && l->opt != opt; l++)
+		;
+	return l->opt ? l : NULL;
+}
+
+//print the soft (or with WHICH == HARD, hard) limit L,
+//after its name and option if LABEL
+void show_limit (struct limit *l, int which, int label)
+{
+	struct rlimit rl;
+	rlim_t v;
+
+	if (getrlimit(l->resource, &rl) < 0)
+		return;
+	v = (which & SOFT) ? rl.rlim_cur : rl.rlim_max;
+	if (label)
+		printf("%-26s(-%c) ", l->name, l->opt);
+	if (v == RLIM_INFINITY)
+		printf("unlimited\n");
+	else
+		printf("%llu\n", (unsigned long long)(v / l->unit));
+}
+
+//set the soft and/or hard limit L to VALUE (N or unlimited);
+//return SUCCESS or ERROR, reporting as WHO
+int set_limit (struct limit *l, int which, char *value, char *who)
+{
+	struct rlimit rl;
+	rlim_t v;
+	char *end;
+
+	if (strcmp(value, "unlimited") == 0)
+		v = RLIM_INFINITY;
+	else
+	{
+		errno = 0;
+		v = strtoull(value, &end, 10);
+		if (end == value || *end || errno || value[0] == '-')
+		{
+			fprintf(stderr, "%s: -%c: bad limit %s\n", who, l->opt, value);
+			return ERROR;
+		}
+		v *= l->unit;
+	}
+
+	if (getrlimit(l->resource, &rl) < 0)
+		return ERROR;
+	if (which & SOFT)
+		rl.rlim_cur = v;
+	if (which == (SOFT | HARD) && l->resource == RLIMIT_CPU
+			&& v != RLIM_INFINITY && v + 1 <= rl.rlim_max)
+		rl.rlim_max = v + 1; //so SIGXCPU, which is reported, comes first
+	else if (which & HARD)
+		rl.rlim_max = v;
+	if (setrlimit(l->resource, &rl) < 0)
+	{
+		fprintf(stderr, "%s: -%c: %s\n", who, l->opt, strerror(errno));
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+//apply or show the limits in the options ARGV[0..ARGC-1];
+//return SUCCESS or ERROR, reporting as WHO
+int set_limits (int argc, char **argv, char *who)
+{
+	int status = SUCCESS, which = 0, shown = 0;
+	struct limit *l;
+	char *opts;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || !argv[i][1])
+		{
+			fprintf(stderr, "%s: %s: expected an option\n", who, argv[i]);
+			return ERROR;
+		}
+
+		opts = argv[i] + 1;
+		for (char *p = opts; *p; p++)
+		{
+			if (*p == 'S')
+				which |= SOFT;
+			else if (*p == 'H')
+				which |= HARD;
+			else if (*p != 'a' && !find_limit(*p))
+			{
+				fprintf(stderr, "%s: -%c: no such limit\n", who, *p);
+				return ERROR;
+			}
+		}
+
+		for (char *p = opts; *p; p++)
+		{
+			if (*p == 'a')
+			{
+				for (l = limits; l->opt; l++)
+					show_limit(l, which ? which : SOFT, 1);
+				shown = 1;
+			}
+			else if (!(l = find_limit(*p)))
+				;
+			else if (i + 1 < argc && argv[i+1][0] != '-')
+			{
+				if (set_limit(l, which ? which : SOFT | HARD, argv[i+1],
+							who) != SUCCESS)
+					status = ERROR;
+				shown = 1;
+			}
+			else
+			{
+				show_limit(l, which ? which : SOFT, 0);
+				shown = 1;
+			}
+		}
+		if (i + 1 < argc && argv[i+1][0] != '-')
+			i++; //the value
+	}
+
+	if (!shown) //ulimit alone shows -f
+		show_limit(find_limit('f'), which ? which : SOFT, 0);
+	return status;
+}
+
+//ulimit [-SH] [-a] [-cdfnstuv [N|unlimited]] ...
+int exec_ulimit (int argc, char **argv)
+{
+	return set_limits(argc - 1, argv + 1, "ulimit");
+}
+
+
+////////////// CGROUPS //////////////
+
+
+//the cgroup directory of child PID (in a static buffer)
+char *cgroup_dir (pid_t pid)
+{
+	static char dir[PATH_MAX];
+	char *root = getenv("BSH_CGROUP");
+
+	snprintf(dir, sizeof(dir), "%s/bsh-%d",
+			(root && *root) ? root : CGROUP_ROOT, (int)pid);
+	return dir;
+}
+
+//write VALUE to the file NAME in DIR; return 0 if successful,
+//else -1
+int write_file (char *dir, char *name, char *value)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int ok;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (!(fp = fopen(path, "w")))
+		return -1;
+	ok = fputs(value, fp) >= 0;
+	return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+//find a slot of the capped table holding WANT (0 for a free one),
+//store PID in it, and return it; NULL if there is none
+pid_t *capped_slot (pid_t pid, pid_t want)
+{
+	pid_t expect;
+
+	for (int i = 0; capped && i < MAX_CAPPED; i++)
+	{
+		expect = want;
+		if (__atomic_compare_exchange_n(&capped[i], &expect, pid, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return &capped[i];
+	}
+	return NULL;
+}
+
+//kill what is left in the cgroup DIR (grandchildren of the shell)
+//and remove it once they are gone
+void remove_cgroup (char *dir)
+{
+	struct timespec ms = {0, 1000000};
+
+	write_file(dir, "cgroup.kill", "1\n");
+	for (int i = 0; rmdir(dir) < 0 && errno == EBUSY && i < 1000; i++)
+		nanosleep(&ms, NULL); //until the killed ones have exited
+}
+
+//bytes in S (N with an optional K, M, or G), or -1 if invalid
+long long parse_size (char *s)
+{
+	char *end;
+	long long n = strtoll(s, &end, 10);
+
+	if (end == s || n < 0)
+		return -1;
+	switch (*end)
+	{
+		case 'G': case 'g': n <<= 10; //fall through
+		case 'M': case 'm': n <<= 10; //fall through
+		case 'K': case 'k': n <<= 10; end++;
+	}
+	return *end ? -1 : n;
+}
+
+
+////////////// APPLYING //////////////
+
+
+//make the capped table, before the first child that could need it
+//is forked
+void limit_share (void)
+{
+	if (capped)
+		return;
+	capped = mmap(NULL, MAX_CAPPED * sizeof(pid_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (capped == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(ERROR);
+	}
+}
+
+//apply BSH_ULIMIT, BSH_MEMMAX, and BSH_CPUMAX to this process
+void limit_apply (void)
+{
+	char *ulimit = getenv("BSH_ULIMIT"), *memmax = getenv("BSH_MEMMAX"),
+		 *cpumax = getenv("BSH_CPUMAX"), *dir, **argv, *copy, value[64];
+	pid_t *slot;
+	int argc = 0;
+	long long bytes;
+	long pct;
+
+	if (ulimit && *ulimit)
+	{
+		copy = strdup(ulimit);
+		argv = malloc((strlen(copy) / 2 + 1) * sizeof(char *));
+		for (char *w = strtok(copy, " \t"); w; w = strtok(NULL, " \t"))
+			argv[argc++] = w;
+		set_limits(argc, argv, "BSH_ULIMIT");
+		free(argv);
+		free(copy);
+	}
+
+	if (in_cgroup || ((!memmax || !*memmax) && (!cpumax || !*cpumax)))
+		return; //a command within a capped one stays in its cgroup
+
+	if (!(slot = capped_slot(getpid(), 0)))
+	{
+		fprintf(stderr, "BSH_CGROUP: too many capped commands\n");
+		return;
+	}
+	dir = cgroup_dir(getpid());
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "BSH_CGROUP: %s: %s\n", dir, strerror(errno));
+		__atomic_store_n(slot, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (memmax && *memmax)
+	{
+		if ((bytes = parse_size(memmax)) < 0)
+			fprintf(stderr, "BSH_MEMMAX: bad size %s\n", memmax);
+		else
+		{
+			snprintf(value, sizeof(value), "%lld\n", bytes);
+			if (write_file(dir, "memory.max", value) < 0)
+				fprintf(stderr, "BSH_MEMMAX: %s\n", strerror(errno));
+			write_file(dir, "memory.swap.max", "0\n"); //if there is swap
+		}
+	}
+
+	if (cpumax && *cpumax)
+	{
+		pct = strtol(cpumax, &copy, 10);
+		if (copy == cpumax || *copy || pct <= 0)
+			fprintf(stderr, "BSH_CPUMAX: bad percentage %s\n", cpumax);
+		else
+		{
+			snprintf(value, sizeof(value), "%ld %d\n",
+					pct * CPU_PERIOD / 100, CPU_PERIOD);
+			if (write_file(dir, "cpu.max", value) < 0)
+				fprintf(stderr, "BSH_CPUMAX: %s\n", strerror(errno));
+		}
+	}
+
+	if (write_file(dir, "cgroup.procs", "0\n") < 0)
+		fprintf(stderr, "BSH_CGROUP: %s: %s\n", dir, strerror(errno));
+	else
+		in_cgroup = 1;
+}
+
+//the status of reaped child PID given its wait STATUS: report
+//any limit it exceeded and remove its cgroup (if it made one)
+int limit_status (pid_t pid, int status)
+{
+	char *dir = cgroup_dir(pid), path[PATH_MAX], line[64];
+	long long oom_kills = 0;
+	pid_t *slot = capped_slot(pid, pid);
+	FILE *fp;
+	int sig;
+
+	if (slot && WIFSIGNALED(status)) //by the OOM killer?
+	{
+		snprintf(path, sizeof(path), "%s/memory.events", dir);
+		if ((fp = fopen(path, "r")))
+		{
+			while (fgets(line, sizeof(line), fp))
+				if (sscanf(line, "oom_kill %lld", &oom_kills) == 1)
+					break;
+			fclose(fp);
+		}
+	}
+	if (slot)
+	{
+		remove_cgroup(dir);
+		__atomic_store_n(slot, 0, __ATOMIC_RELEASE);
+	}
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+
+	sig = WTERMSIG(status);
+	if (oom_kills > 0)
+		fprintf(stderr, "%d: memory limit exceeded\n", (int)pid);
+	else if (sig == SIGXCPU)
+		fprintf(stderr, "%d: CPU time limit exceeded\n", (int)pid);
+	else if (sig == SIGXFSZ)
+		fprintf(stderr, "%d: file size limit exceeded\n", (int)pid);
+	return 128 + sig;
+}
@@ -0,0 +1,41 @@
+// limit.h                                   Phil Esterman (11/13/15)
+//
+// Resource limits on the processes Bsh creates:
+//
+//   ulimit [-SH] [-a] [-cdfnstuv [N|unlimited]] ...
+//                       show or set a limit of the shell, and so
+//                       of every later command (sizes in KiB, time
+//                       in seconds; -S soft, -H hard, both by
+//                       default, but the hard -t a second past the
+//                       soft one)
+//   BSH_ULIMIT=OPTIONS  the same options, applied in the child to
+//                       one command, e.g.,
+//                       BSH_ULIMIT="-t 2 -v 100000" cmd
+//   BSH_MEMMAX=SIZE     cap the command's memory (e.g., 512M) with
+//   BSH_CPUMAX=PCT      a cgroup v2 under BSH_CGROUP (default
+//                       /sys/fs/cgroup) when that directory is
+//                       writable; the shell reads BSH_CGROUP too,
+//                       so set it in its environment, not as a
+//                       local
+//
+// When the command exits, anything it left running in its cgroup
+// is killed and the cgroup removed.
+//
+// A command killed for exceeding a limit is reported on stderr;
+// its status is 128 plus the signal, as for any other.
+
+#include <sys/types.h>
+
+//ulimit [-SH] [-a] [-cdfnstuv [N|unlimited]] ...
+int exec_ulimit (int argc, char **argv);
+
+//make the table in which children note the cgroups they make;
+//call before forking a child that runs a command
+void limit_share (void);
+
+//apply BSH_ULIMIT, BSH_MEMMAX, and BSH_CPUMAX to this process
+void limit_apply (void);
+
+//the status of reaped child PID given its wait STATUS: report
+//any limit it exceeded and remove its cgroup (if it made one)
+int limit_status (pid_t pid, int status);
@@ -4,7 +4,22 @@
 // command structures, and then executes the commands as per specification.
 //
 // Bash version based on bottom-up parse tree.
-// Dumps token list or CMD tree if DUMP_LIST or DUMP_CMD is set.
+// Dumps token list or CMD tree if DUMP_LIST or DUMP_CMD is set, and the
+// number of processes each command created if DUMP_FORKS is set.  If
+// FORKS_FILE is set, the number of processes created in all (by this shell
+// and its subshells) is appended to that file at exit (see runtests.c).
+//
+// Bsh FILE [ARG ...] instead runs the script FILE without prompting, with the
+// ARGs as positional parameters, and exits with the status of its last
+// command.  The whole script is parsed before any of it runs, and its trees
+// are cached in FILE.bshc for the next run (see bshc.h).
+//
+// Bsh --record LOG [...] also appends each line read at the prompt to LOG, and
+// Bsh --replay [--paced] [--stub] LOG runs those lines again and reports what
+// each one cost (see session.h).
+//
+// At a terminal, lines are read with editing, history, and completion (see
+// editLine.h).
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -12,27 +27,52 @@
 #include <string.h>
 #include <ctype.h>
 #include "getLine.h"
+#include "editLine.h"
 #include "parse.h"
+#include "bshc.h"
+#include "session.h"
+
+static int runScript (int argc, char *argv[]);
+static void dumpForks (void);
 
 int main (int argc, char *argv[])
 {
     int nCmd = 1;                   // Command number
+    char prompt[32];                // Prompt for it
     char *line;                     // Initial command line
     token *list;                    // Linked list of tokens
     CMD *cmd;                       // Parsed command
     int process (CMD *);
+    int fork_count (void);
+    int nFork;                      // Processes created before command
+    int status;                     // Status of command
 
     setenv ("?", "0", 1);           // Initialize $?
+    if (getenv ("FORKS_FILE"))      // Count processes for runtests?
+	atexit (dumpForks);
+    if (argc > 2 && !strcmp (argv[1], "--record")) {    // Record session?
+	if (recordOpen (argv[2]) < 0) {
+	    perror (argv[2]);
+	    return EXIT_FAILURE;
+	}
+	argc -= 2;
+	argv += 2;
+    } else if (argc > 1 && !strcmp (argv[1], "--replay")) {
+	return replaySession (argc-2, argv+2);
+    }
+    if (argc > 1)                   // Run script?
+	return runScript (argc-1, argv+1);
 
     for ( ; ; ) {
-	printf ("(%d)$ ", nCmd);                // Prompt for command
-	fflush (stdout);
-	if ((line = getLine (stdin)) == NULL)   // Read line
+	sprintf (prompt, "(%d)$ ", nCmd);       // Prompt for command
+	if ((line = editLine (prompt)) == NULL) // Read line
 	    break;                              //   Break on end of file
+	recordRead (line);                      // Log it if recording
 
 	list = tokenize (line);                 // Lex line into tokens
 	free (line);
 	if (list == NULL) {
+	    recordDone (-1);
 	    continue;
 	} else if (getenv ("DUMP_LIST")) {      // Dump token list only if
 	    dumpList (list);                    //   environment variable set
@@ -42,14 +82,19 @@ int main (int argc, char *argv[])
 	cmd = parse (list);                     // Parsed command?
 	freeList (list);
 	if (cmd == NULL) {
+	    recordDone (-1);
 	    continue;
 	} else if (getenv ("DUMP_CMD")) {       // Dump command tree only if
 	    dumpTree (cmd, 0);                  //   environment variable set
 	    printf ("\n");
 	}
 
-	process (cmd);                          // Execute command
+	nFork = fork_count();
+	status = process (cmd);                 // Execute command
 	freeCMD (cmd);                          // Free associated storage
+	recordDone (status);
+	if (getenv ("DUMP_FORKS"))              // Dump # processes created
+	    printf ("Forks: %d\n", fork_count() - nFork);
 	nCmd++;                                 // Adjust prompt
 
     }
@@ -58,266 +103,96 @@ int main (int argc, char *argv[])
 }
 
 
-// Allocate, initialize, and return a pointer to an empty command structure
-CMD *mallocCMD (void)
-{
-    CMD *new = malloc(sizeof(*new));
-
-    new->type     = NONE;
-    new->nLocal   = 0;
-    new->locVar   = NULL;
-    new->locVal   = NULL;
-    new->argc     = 0;
-    new->argv     = malloc (sizeof(char *));
-    new->argv[0]  = NULL;
-    new->fromType = NONE;
-    new->fromFile = NULL;
-    new->toType   = NONE;
-    new->toFile   = NULL;
-    new->left     = NULL;
-    new->right    = NULL;
-
-    return new;
-}
-
-
-// Print arguments in command data structure rooted at *C
-void dumpArgs (CMD *c)
-{
-    for (char **q = c->argv;  *q;  q++)
-	fprintf (stdout, ",  argv[%ld] = %s", q-(c->argv), *q);
-}
-
-
-// Print input/output redirections in command data structure rooted at *C
-void dumpRedirect (CMD *c)
+// Append the number of processes created to the file FORKS_FILE
+static void dumpForks (void)
 {
-    if (c->fromType == NONE && c->fromFile == NULL)
-	;
-    else if (c->fromType == RED_IN && c->fromFile != NULL)
-	fprintf (stdout, "  <%s", c->fromFile);
-    else
-	fprintf (stdout, "  ILLEGAL INPUT REDIRECTION");
+    int fork_count (void);
+    FILE *fp = fopen (getenv ("FORKS_FILE"), "a");
 
-    if (c->toType == NONE && c->toFile == NULL)
-	;
-    else if (c->toType == RED_OUT && c->toFile != NULL)
-	fprintf (stdout, "  >%s", c->toFile);
-    else if (c->toType == RED_OUT_APP && c->toFile != NULL)
-	fprintf (stdout, "  >>%s", c->toFile);
-    else
-	fprintf (stdout, "  ILLEGAL OUTPUT REDIRECTION");
-
-    if (c->nLocal > 0) {
-	fprintf (stdout, "\n         LOCAL: ");
-	for (int i = 0; i < c->nLocal; i++)
-	    fprintf (stdout, "%s=%s, ", c->locVar[i], c->locVal[i]);
-    } else if (c->nLocal == 0) {
-	;
-    } else {
-	fprintf (stdout, "  INVALID NLOCAL");
+    if (fp) {
+	fprintf (fp, "%d\n", fork_count());
+	fclose (fp);
     }
 }
 
 
-// Print command data structure rooted at *C at level LEVEL
-void dumpSimple (CMD *c, int level)
-{
-    fprintf (stdout, "level = %d,  argc = %d", level, c->argc);
-
-    if (c->type == SIMPLE)
-	dumpArgs (c);
-    else if (c->type == PIPE)
-	fprintf (stdout, ",  PIPE");
-    else if (c->type == SUBCMD)
-	fprintf (stdout, ",  SUBCMD");
-
-    dumpRedirect (c);
-}
-
-
-// Print command data structure rooted at *C; return SEP_END or SEP_BG
-int dumpType (CMD *c, int level)
+// Parse the lines of script FILE into command lines; return their number and
+// set *CMDS to a malloc()-ed array of them, or return -1 if FILE cannot be read
+// or a line does not parse
+static int parseScript (char *file, CMD ***cmds)
 {
-    int type = SEP_END;
-
-    if (c->argc < 0)
-	fprintf (stdout, "  ARGC < 0");
-    else if (c->argv == NULL)
-	fprintf (stdout, "  ARGV = NULL");
-    else if (c->argv[c->argc] != NULL)
-	fprintf (stdout, "  ARGV[ARGC] != NULL");
-
-    if (c->type == SIMPLE) {
-	dumpSimple (c, level);
-	if (c->left != NULL)
-	    fprintf (stdout, "  <simple> HAS LEFT CHILD");
-	if (c->right != NULL)
-	    fprintf (stdout, "  <simple> HAS RIGHT CHILD");
-
-    } else if (c->argc > 0
-	    || c->argv == NULL
-	    || c->argv[0] != NULL) {
-	fprintf (stdout, "  INVALID ARGUMENT LIST IN NON-SIMPLE");
-
-    } else if (c->type == SUBCMD) {
-	dumpSimple (c, level);
-	fprintf (stdout, "\nCMD:   ");
-	type = dumpType (c->left, level+1);
-	if (c->right)
-	    fprintf (stdout, "  SUBCMD HAS RIGHT CHILD");
-	char sep = (type == SEP_BG) ? '&' : ';';
-	fprintf (stdout, "  %c", sep);
-	type = SEP_END;
-
-    } else if (c->fromType != NONE
-	    || c->fromFile != NULL
-	    || c->toType != NONE
-	    || c->toFile != NULL) {
-	fprintf (stdout, "  INVALID I/O REDIRECTION IN NON-SIMPLE NON-SUBCMD");
-
-    } else if (c->type == PIPE) {
-	dumpSimple (c, level);
-	fprintf (stdout, "\nCMD:   ");
-	type = dumpType (c->left, level+1);
-	fprintf (stdout, "  |\nCMD: | ");
-
-	CMD *p;
-	for (p = c->right; p->type == PIPE; p = p->right) {
-	    type = dumpType (p->left, level+1);
-	    fprintf (stdout, "  |\nCMD: | ");
-	}
-	type = dumpType (p, level+1);
-	char sep = (type == SEP_BG) ? '&' : ';';
-	fprintf (stdout, "  %c", sep);
-	type = SEP_END;
-
-    } else if (c->type == SEP_AND) {
-	type = dumpType (c->left, level);
-	fprintf (stdout, "  &&\nCMD:   ");
-	type = dumpType (c->right, level);
-
-    } else if (c->type == SEP_OR) {
-	type = dumpType (c->left, level);
-	fprintf (stdout, "  ||\nCMD:   ");
-	type = dumpType (c->right, level);
+    FILE *fp, *oldInput;
+    char *line;
+    token *list;
+    CMD *cmd;
+    int n = 0, size = 16, nLine = 0;
+
+    if ((fp = fopen (file, "r")) == NULL) {
+	perror (file);
+	return -1;
+    }
+    oldInput = parseInput (fp);                 // Here documents and groups
+    *cmds = malloc (size * sizeof(CMD *));      //   continue in the script
 
-    } else if (c->type == SEP_END) {
-	type = dumpType (c->left, level);
-	if (c->right) {
-	    char sep = (type == SEP_BG) ? '&' : ';';
-	    fprintf (stdout, "  %c\nCMD:   ", sep);
-	    type = dumpType (c->right, level);
-	} else {
-	    fprintf (stdout, "  SEP_END MISSING RIGHT CHILD");
-	}
+    while ((line = getLine (fp)) != NULL) {
+	nLine++;
+	list = tokenize (line);
+	free (line);
+	if (list == NULL)
+	    continue;
 
-    } else if (c->type == SEP_BG) {
-	dumpType (c->left, level);
-	type = SEP_BG;
-	if (c->right) {
-	    fprintf (stdout, "  &\nCMD:   ");
-	    type = dumpType (c->right, level);
+	cmd = parse (list);
+	freeList (list);
+	if (cmd == NULL) {
+	    fprintf (stderr, "%s: line %d: syntax error\n", file, nLine);
+	    while (n > 0)
+		freeCMD ((*cmds)[--n]);
+	    free (*cmds);
+	    n = -1;
+	    break;
 	}
 
-    } else {
-	fprintf (stdout, "  ILLEGAL CMD TYPE");
+	if (n == size)
+	    *cmds = realloc (*cmds, (size *= 2) * sizeof(CMD *));
+	(*cmds)[n++] = cmd;
     }
 
-    return type;
+    parseInput (oldInput);
+    fclose (fp);
+    return n;
 }
 
 
-// Print command data structure rooted at *C
-void dumpCMD (CMD *c, int level)
+// Run script ARGV[0] with positional parameters ARGV[1], ..., ARGV[ARGC-1];
+// return the status of its last command.  The trees come from the cache if it
+// matches the script, else from parsing the script, which refreshes the cache.
+static int runScript (int argc, char *argv[])
 {
-    fprintf (stdout, "CMD:   ");
-    int type = dumpType (c, level);
-    char sep = (type == SEP_BG) ? '&' : ';';
-    fprintf (stdout, "  %c\n", sep);
-}
-
-
-// Free tree of commands rooted at *C
-void freeCMD (CMD *c)
-{
-    if (!c)
-	return;
+    CMD **cmds;
+    uint64_t hash;
+    int n, status = 0, cached;
+    int process (CMD *);
+    void set_params (char **, int);
 
-    for (int i = 0; i < c->nLocal; i++) {
-	free (c->locVar[i]);
-	free (c->locVal[i]);
+    if (hashScript (argv[0], &hash) < 0) {
+	perror (argv[0]);
+	return EXIT_FAILURE;
     }
-    free (c->locVar);
-    free (c->locVal);
-
-    for (char **p = c->argv;  *p;  p++)
-	free (*p);
-    free (c->argv);
-
-    free (c->fromFile);
-    free (c->toFile);
-
-    freeCMD (c->left);
-    freeCMD (c->right);
-
-    free (c);
-}
-
-
-// Print list of tokens LIST
-void dumpList (struct token *list)
-{
-    struct token *p;
-
-    for (p = list;  p != NULL;  p = p->next)    // Walk down linked list
-	printf ("%s:%d ", p->text, p->type);    //   printing token and type
-    putchar ('\n');                             // Terminate line
-}
-
-
-// Free list of tokens LIST
-void freeList (token *list)
-{
-    token *p, *pnext;
-    for (p = list;  p;  p = pnext)  {
-	pnext = p->next;  p->next = NULL;       // Zap p->next and p->text
-	free(p->text);    p->text = NULL;       //   to stop accidental reuse
-	free(p);
+    cached = ((cmds = readCache (argv[0], hash, &n)) != NULL);
+    if (!cached) {
+	if ((n = parseScript (argv[0], &cmds)) < 0)
+	    return EXIT_FAILURE;
+	writeCache (argv[0], hash, cmds, n);
     }
-}
 
+    set_params (argv+1, argc-1);
+    for (int i = 0; i < n; i++)
+	status = process (cmds[i]);
 
-// Print in in-order command data structure rooted at *C at depth LEVEL
-void dumpTree (CMD *c, int level)
-{
-    if (!c)
-	return;
-
-    dumpTree (c->left, level+1);
-
-    fprintf (stdout, "CMD (Depth = %d):  ", level);
-    if (c->type == SIMPLE) {
-	fprintf (stdout, "SIMPLE");
-	dumpArgs (c);
-	dumpRedirect (c);
-    } else if (c->type == SUBCMD) {
-	fprintf (stdout, "SUBCMD");
-	dumpRedirect (c);
-    } else if (c->type == PIPE) {
-	fprintf (stdout, "PIPE");
-    } else if (c->type == SEP_AND) {
-	fprintf (stdout, "SEP_AND");
-    } else if (c->type == SEP_OR) {
-	fprintf (stdout, "SEP_OR");
-    } else if (c->type == SEP_END) {
-	fprintf (stdout, "SEP_END");
-    } else if (c->type == SEP_BG) {
-	fprintf (stdout, "SEP_BG");
-    } else {
-	fprintf (stdout, "NONE");
+    if (!cached) {                              // Cached trees live in the
+	for (int i = 0; i < n; i++)             //   mapping of the cache
+	    freeCMD (cmds[i]);
+	free (cmds);
     }
-    fprintf (stdout, "\n");
-
-    dumpTree (c->right, level+1);
+    return status;
 }
@@ -0,0 +1,590 @@
+// memo.c                                    Phil Esterman (11/13/15)
+//
+// The memo builtin. See memo.h. An entry is one file named by the
+// hex key: "BSHM", the exit status, then the bytes of stdout. A
+// hit touches the file, so eviction by mtime is LRU. A miss runs
+// the command with stdout on a temporary file in the cache, which
+// is renamed into place only if the command exited, and is then
+// copied to the real stdout (or the toFile already opened on it).
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "memo.h"
+#include "copy.h"
+#include "limit.h"
+#include "deadline.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+#define STDOUT (1)
+
+#define MEMO_MAGIC "BSHM"
+#define HEADER (8)              //magic and status before the output
+#define KEY_HEX (64)            //hex digits in a key
+#define DEFAULT_MAX (64 << 20)  //bytes kept unless MEMO_MAX
+
+struct sha256 {
+	uint32_t h[8];
+	uint64_t len;             //bytes added
+	unsigned char block[64];  //partial block
+	size_t n;                 //bytes in it
+};
+
+struct entry {
+	char name[KEY_HEX + 1];
+	struct timespec mtime;
+	long long size;
+};
+
+pid_t count_fork (void);
+void exec_stage (CMD *cmd);
+long long parse_size (char *s);
+
+void sha_init (struct sha256 *s);
+void sha_block (struct sha256 *s, const unsigned char *p);
+void sha_add (struct sha256 *s, const void *data, size_t n);
+void sha_done (struct sha256 *s, unsigned char *out);
+void key_str (struct sha256 *s, char *str);
+int key_file (struct sha256 *s, int fd, int content);
+int memo_key (CMD *cmd, char *hex);
+char *find_program (char *name, char *path);
+char *memo_dir (void);
+void memo_count (char *dir, int hit);
+int run_memo (CMD *cmd, int out, int *exited);
+void evict (char *dir, char *keep);
+int by_mtime (const void *a, const void *b);
+int memo_stats (char *dir);
+int memo_clear (char *dir);
+
+
+////////////// SHA-256 //////////////
+
+
+static const uint32_t sha_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void sha_init (struct sha256 *s)
+{
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(s->h, h0, sizeof(h0));
+	s->len = 0;
+	s->n = 0;
+}
+
+//mix the 64 bytes at P into S
+void sha_block (struct sha256 *s, const unsigned char *p)
+{
+	uint32_t w[64], v[8], t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16
+			| (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+	for (; i < 64; i++)
+		w[i] = w[i-16] + w[i-7]
+			+ (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3))
+			+ (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+	memcpy(v, s->h, sizeof(v));
+	for (i = 0; i < 64; i++)
+	{
+		t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25))
+			+ ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha_k[i] + w[i];
+		t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22))
+			+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(v + 1, v, 7 * sizeof(uint32_t));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (i = 0; i < 8; i++)
+		s->h[i] += v[i];
+}
+
+//add the N bytes at DATA to S
+void sha_add (struct sha256 *s, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	size_t m;
+
+	s->len += n;
+	if (s->n > 0)
+	{
+		m = (n < 64 - s->n) ? n : 64 - s->n;
+		memcpy(s->block + s->n, p, m);
+		s->n += m, p += m, n -= m;
+		if (s->n < 64)
+			return;
+		sha_block(s, s->block);
+		s->n = 0;
+	}
+	for (; n >= 64; p += 64, n -= 64)
+		sha_block(s, p);
+	memcpy(s->block, p, n);
+	s->n = n;
+}
+
+//finish S and store the 32-byte digest in OUT
+void sha_done (struct sha256 *s, unsigned char *out)
+{
+	uint64_t bits = s->len * 8;
+	unsigned char pad[72] = {0x80};
+	size_t n_pad = (s->n < 56) ? 56 - s->n : 120 - s->n;
+
+	for (int i = 0; i < 8; i++)
+		pad[n_pad + i] = bits >> (56 - 8 * i);
+	sha_add(s, pad, n_pad + 8);
+	for (int i = 0; i < 8; i++)
+	{
+		out[4*i] = s->h[i] >> 24;
+		out[4*i+1] = s->h[i] >> 16;
+		out[4*i+2] = s->h[i] >> 8;
+		out[4*i+3] = s->h[i];
+	}
+}
+
+
+////////////// KEYS //////////////
+
+
+//add STR to S, with its length so that strings cannot run together
+void key_str (struct sha256 *s, char *str)
+{
+	uint64_t n = strlen(str);
+
+	sha_add(s, &n, sizeof(n));
+	sha_add(s, str, n);
+}
+
+//add the file open on FD to S: its identity, and with CONTENT
+//its bytes; return 0, or -1 if it cannot be read
+int key_file (struct sha256 *s, int fd, int content)
+{
+	struct stat st;
+	int64_t id[7];
+	void *p;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+	id[0] = st.st_dev;
+	id[1] = st.st_ino;
+	id[2] = st.st_size;
+	id[3] = st.st_mtim.tv_sec;
+	id[4] = st.st_mtim.tv_nsec;
+	id[5] = st.st_ctim.tv_sec;
+	id[6] = st.st_ctim.tv_nsec;
+	if (!content)
+	{
+		sha_add(s, id, sizeof(id));
+		return 0;
+	}
+
+	sha_add(s, id + 2, sizeof(id[2])); //just the size and bytes
+	if (st.st_size == 0)
+		return 0;
+	if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+			== MAP_FAILED)
+		return -1;
+	sha_add(s, p, st.st_size);
+	munmap(p, st.st_size);
+	return 0;
+}
+
+//the executable file NAME is found as on PATH, stored in PATH;
+//NULL if none
+char *find_program (char *name, char *path)
+{
+	char *dirs = getenv("PATH"), *end;
+	struct stat st;
+	size_t n;
+
+	if (strchr(name, '/'))
+	{
+		snprintf(path, PATH_MAX, "%s", name);
+		return (stat(path, &st) == 0 && S_ISREG(st.st_mode)
+				&& access(path, X_OK) == 0) ? path : NULL;
+	}
+
+	for (; dirs; dirs = *end ? end + 1 : NULL)
+	{
+		end = strchrnul(dirs, ':');
+		n = end - dirs;
+		snprintf(path, PATH_MAX, "%.*s%s%s", (int)n, dirs, n ? "/" : "",
+				name);
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode)
+				&& access(path, X_OK) == 0)
+			return path;
+	}
+	return NULL;
+}
+
+//store in HEX the key of simple command CMD; return 1, or 0 if
+//its result cannot be cached
+int memo_key (CMD *cmd, char *hex)
+{
+	struct sha256 s;
+	struct stat st, null;
+	unsigned char digest[32];
+	char path[PATH_MAX], *names, *name, *value;
+	int content = getenv("MEMO_CONTENT") && strcmp(getenv("MEMO_CONTENT"),
+			"1") == 0, fd, ok = 1;
+
+	if (!find_program(cmd->argv[0], path)) //builtin, function, or none
+		return 0;
+	if (fstat(STDIN, &st) < 0) //a pipe, terminal, or the like is live
+		return 0;
+	if (!S_ISREG(st.st_mode) && !(S_ISCHR(st.st_mode)
+				&& stat("/dev/null", &null) == 0
+				&& st.st_rdev == null.st_rdev))
+		return 0;
+
+	sha_init(&s);
+	key_str(&s, MEMO_MAGIC);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0
+			|| key_file(&s, fd, 0) < 0)
+		ok = 0;
+	if (fd >= 0)
+		close(fd);
+
+	if (!getcwd(path, sizeof(path)))
+		return 0;
+	key_str(&s, path);
+
+	for (int i = 0; i < cmd->argc; i++)
+	{
+		key_str(&s, cmd->argv[i]);
+		if (stat(cmd->argv[i], &st) == 0 && S_ISREG(st.st_mode))
+		{
+			if ((fd = open(cmd->argv[i], O_RDONLY | O_CLOEXEC)) < 0
+					|| key_file(&s, fd, content) < 0)
+				ok = 0;
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+
+	if (fstat(STDIN, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		int64_t offset = lseek(STDIN, 0, SEEK_CUR);
+		key_str(&s, "<");
+		sha_add(&s, &offset, sizeof(offset));
+		if (key_file(&s, STDIN, content) < 0)
+			ok = 0;
+	}
+
+	if ((names = getenv("MEMO_ENV")))
+	{
+		names = strdup(names);
+		for (name = strtok(names, ": \t"); name; name = strtok(NULL, ": \t"))
+		{
+			key_str(&s, name);
+			value = getenv(name);
+			key_str(&s, value ? value : "");
+			sha_add(&s, value ? "=" : "-", 1); //set to "" or unset?
+		}
+		free(names);
+	}
+
+	sha_done(&s, digest);
+	for (int i = 0; i < 32; i++)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	return ok;
+}
+
+
+////////////// CACHE //////////////
+
+
+//the cache directory, made if need be (NULL if it cannot be)
+char *memo_dir (void)
+{
+	static char dir[PATH_MAX];
+	char *env = getenv("MEMO_DIR"), *home = getenv("HOME");
+
+	if (env && *env)
+		snprintf(dir, sizeof(dir), "%s", env);
+	else
+	{
+		snprintf(dir, sizeof(dir), "%s/.cache", home ? home : ".");
+		mkdir(dir, 0755);
+		strncat(dir, "/bsh-memo", sizeof(dir) - strlen(dir) - 1);
+	}
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "memo: %s: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+	return dir;
+}
+
+//count a hit (or if not HIT, a miss) in DIR/stats
+void memo_count (char *dir, int hit)
+{
+	char path[PATH_MAX], text[64];
+	long long n[2] = {0, 0};
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+		return;
+	flock(fd, LOCK_EX);
+	if ((len = pread(fd, text, sizeof(text) - 1, 0)) > 0)
+	{
+		text[len] = '\0';
+		sscanf(text, "hits %lld misses %lld", &n[0], &n[1]);
+	}
+	n[hit ? 0 : 1]++;
+	len = snprintf(text, sizeof(text), "hits %lld misses %lld\n", n[0], n[1]);
+	if (pwrite(fd, text, len, 0) == len)
+		ftruncate(fd, len);
+	close(fd); //and unlock
+}
+
+//run CMD in a child with stdout on OUT (unless -1) and return
+//its status; set *EXITED if it exited rather than being killed
+int run_memo (CMD *cmd, int out, int *exited)
+{
+	int status, expired;
+	pid_t pid;
+
+	fflush(stdout);
+	if ((pid = count_fork()) < 0)
+	{
+		perror("memo: ");
+		*exited = 0;
+		return ERROR;
+	}
+	if (pid == 0)
+	{
+		if (out >= 0)
+		{
+			dup2(out, STDOUT);
+			close(out);
+		}
+		exec_stage(cmd);
+	}
+
+	expired = wait_fg(&pid, &status, 1);
+	*exited = !expired && WIFEXITED(status);
+	status = limit_status(pid, status);
+	return expired ? TIMED_OUT : status;
+}
+
+//entries are ordered by mtime, oldest first
+int by_mtime (const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	if (x->mtime.tv_sec != y->mtime.tv_sec)
+		return (x->mtime.tv_sec > y->mtime.tv_sec) ? 1 : -1;
+	return (x->mtime.tv_nsec > y->mtime.tv_nsec)
+		- (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+//remove the least recently used entries of DIR other than KEEP
+//(just stored) while they take more than MEMO_MAX bytes, down
+//to 90% of it
+void evict (char *dir, char *keep)
+{
+	char *env = getenv("MEMO_MAX"), path[PATH_MAX];
+	long long max = DEFAULT_MAX, total = 0;
+	struct entry *e = NULL;
+	int n = 0, size = 0, i;
+	struct dirent *d;
+	struct stat st;
+	DIR *dp;
+
+	if (env && *env && (max = parse_size(env)) < 0)
+		max = DEFAULT_MAX;
+	if (!(dp = opendir(dir)))
+		return;
+	while ((d = readdir(dp)))
+	{
+		if (strlen(d->d_name) != KEY_HEX
+				|| fstatat(dirfd(dp), d->d_name, &st, 0) < 0)
+			continue;
+		if (n == size)
+		{
+			size = 2 * size + 64;
+			e = realloc(e, size * sizeof(*e));
+		}
+		strcpy(e[n].name, d->d_name);
+		e[n].mtime = st.st_mtim;
+		e[n].size = st.st_blocks * 512LL;
+		total += e[n++].size;
+	}
+	closedir(dp);
+
+	if (total > max)
+	{
+		qsort(e, n, sizeof(*e), by_mtime);
+		for (i = 0; i < n && total > max / 10 * 9; i++)
+		{
+			snprintf(path, sizeof(path), "%s/%s", dir, e[i].name);
+			if (strcmp(e[i].name, keep) != 0 && unlink(path) == 0)
+				total -= e[i].size;
+		}
+	}
+	free(e);
+}
+
+//memo -s: show hits, misses, entries, and bytes of DIR
+int memo_stats (char *dir)
+{
+	char path[PATH_MAX];
+	long long hits = 0, misses = 0, bytes = 0, n = 0;
+	struct dirent *d;
+	struct stat st;
+	FILE *fp;
+	DIR *dp;
+
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	if ((fp = fopen(path, "r")))
+	{
+		if (fscanf(fp, "hits %lld misses %lld", &hits, &misses) != 2)
+			hits = misses = 0;
+		fclose(fp);
+	}
+	if ((dp = opendir(dir)))
+	{
+		while ((d = readdir(dp)))
+		{
+			if (strlen(d->d_name) == KEY_HEX
+					&& fstatat(dirfd(dp), d->d_name, &st, 0) == 0)
+			{
+				n++;
+				bytes += st.st_size - HEADER;
+			}
+		}
+		closedir(dp);
+	}
+
+	printf("hits %lld\nmisses %lld\nentries %lld\nbytes %lld\n",
+			hits, misses, n, bytes);
+	return SUCCESS;
+}
+
+//memo -c: remove every entry of DIR and its stats
+int memo_clear (char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dp;
+
+	if (!(dp = opendir(dir)))
+		return ERROR;
+	while ((d = readdir(dp)))
+	{
+		if (strlen(d->d_name) == KEY_HEX || strcmp(d->d_name, "stats") == 0
+				|| strncmp(d->d_name, ".tmp", 4) == 0)
+		{
+			snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dp);
+	return SUCCESS;
+}
+
+//memo CMD [ARG ...], memo -s, or memo -c
+int exec_memo (CMD *cmd)
+{
+	char key[KEY_HEX + 1], path[PATH_MAX], tmp[PATH_MAX], header[HEADER],
+		 *dir;
+	int status, fd, exited;
+	int32_t code;
+	CMD sub;
+
+	if (cmd->argc == 2 && strcmp(cmd->argv[1], "-s") == 0)
+		return (dir = memo_dir()) ? memo_stats(dir) : ERROR;
+	if (cmd->argc == 2 && strcmp(cmd->argv[1], "-c") == 0)
+		return (dir = memo_dir()) ? memo_clear(dir) : ERROR;
+	if (cmd->argc < 2 || cmd->argv[1][0] == '-')
+	{
+		fprintf(stderr, "usage: memo CMD [ARG ...] | memo -s | memo -c\n");
+		return ERROR;
+	}
+
+	sub = *cmd; //locals and redirections are already in effect
+	sub.nLocal = 0;
+	sub.fromType = sub.toType = NONE;
+	sub.argv = cmd->argv + 1;
+	sub.argc = cmd->argc - 1;
+
+	if (!(dir = memo_dir()) || !memo_key(&sub, key))
+		return run_memo(&sub, -1, &exited);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0)
+	{
+		if (read(fd, header, HEADER) == HEADER
+				&& memcmp(header, MEMO_MAGIC, 4) == 0)
+		{
+			memcpy(&code, header + 4, sizeof(code));
+			futimens(fd, NULL); //most recently used
+			memo_count(dir, 1);
+			fflush(stdout);
+			if (copy_fd(fd, STDOUT) < 0)
+				perror("memo: ");
+			close(fd);
+			return code;
+		}
+		close(fd);
+	}
+
+	memo_count(dir, 0);
+	snprintf(tmp, sizeof(tmp), "%s/.tmpXXXXXX", dir);
+	if ((fd = mkostemp(tmp, O_CLOEXEC)) < 0
+			|| lseek(fd, HEADER, SEEK_SET) != HEADER)
+	{
+		fprintf(stderr, "memo: %s: %s\n", tmp, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return run_memo(&sub, -1, &exited);
+	}
+
+	status = run_memo(&sub, fd, &exited);
+	code = status;
+	memcpy(header, MEMO_MAGIC, 4);
+	memcpy(header + 4, &code, sizeof(code));
+	if (exited && pwrite(fd, header, HEADER, 0) == HEADER
+			&& rename(tmp, path) == 0)
+		evict(dir, key);
+	else
+		unlink(tmp);
+
+	if (lseek(fd, HEADER, SEEK_SET) != HEADER || copy_fd(fd, STDOUT) < 0)
+		perror("memo: ");
+	close(fd);
+	return status;
+}
@@ -0,0 +1,24 @@
+// memo.h                                    Phil Esterman (11/13/15)
+//
+// The memo builtin: run a deterministic command once and replay
+// its stdout and status while its inputs stay the same.
+//
+//   memo CMD [ARG ...]  run CMD, or replay its cached result
+//   memo -s             show hits, misses, entries, and bytes
+//   memo -c             empty the cache
+//
+// The key is a SHA-256 of the working directory, the argv, the
+// variables named in MEMO_ENV (separated by : or spaces), the
+// identity (device, inode, size, and times) of the program and of
+// stdin and each argument that is a regular file, or with
+// MEMO_CONTENT=1 their contents. A command whose stdin is not a
+// regular file or /dev/null (a pipe or terminal, say) is just
+// run. Only stdout is cached; stderr and other files the command
+// writes are not. Entries live in MEMO_DIR (default
+// $HOME/.cache/bsh-memo), the least recently used removed once
+// they pass MEMO_MAX bytes (default 64M).
+
+#include "parse.h"
+
+//memo CMD [ARG ...], memo -s, or memo -c
+int exec_memo (CMD *cmd);
@@ -0,0 +1,751 @@
+// parse.c                                   Phil Esterman (11/13/15)
+//
+// Lexer and bottom-up parser for Bsh command lines.  See parse.h for the
+// token types, the grammar, and the shape of the trees built by parse().
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "getLine.h"
+#include "parse.h"
+
+// Print error message X
+#define WARN(x)  fprintf (stderr, "Parse: %s\n", x)
+
+
+// Metacharacter tokens, longest first so that the first match is maximal
+static struct {
+    char *text;
+    int type;
+} STok[] = {
+    {"<<<", RED_IN_STR},
+    {"<<",  RED_IN_HERE},
+    {"<(",  PROC_IN},
+    {"<&",  RED_IN_DUP},
+    {">>",  RED_OUT_APP},
+    {">&",  RED_OUT_DUP},
+    {">(",  PROC_OUT},
+    {"&&",  SEP_AND},
+    {"||",  SEP_OR},
+    {"<",   RED_IN},
+    {">",   RED_OUT},
+    {"|",   RED_PIPE},
+    {";",   SEP_END},
+    {"&",   SEP_BG},
+    {"(",   PAR_LEFT},
+    {")",   PAR_RIGHT},
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Append a token with type TYPE and text TEXT that follows whitespace unless
+// JOIN is nonzero (and contained quotes or escapes if QUOTED is nonzero) to
+// the list whose last next pointer is *TAIL; return the new value of TAIL
+static token **addToken (token **tail, int type, char *text, int join,
+			 int quoted)
+{
+    token *new = malloc (sizeof(*new));
+
+    new->text = text;
+    new->type = type;
+    new->join = join;
+    new->quoted = quoted;
+    new->next = NULL;
+    *tail = new;
+    return &new->next;
+}
+
+
+// Break the string LINE into a headless linked list of typed tokens and
+// return a pointer to the first token (or NULL if none were found or an
+// error was detected).
+token *tokenize (char *line)
+{
+    token *list = NULL, **tail = &list;
+    char *p = line;
+    int join = 0;
+
+    while (*p) {
+	if (isspace ((unsigned char) *p)) {             // Skip whitespace
+	    p++;
+	    join = 0;
+	    continue;
+	}
+
+	if (strchr (METACHAR, *p)) {                    // Metacharacter token
+	    int i;
+	    for (i = 0;  strncmp (p, STok[i].text, strlen (STok[i].text));  i++)
+		;
+	    tail = addToken (tail, STok[i].type, strdup (STok[i].text), join, 0);
+	    p += strlen (STok[i].text);
+	    join = 1;
+	    continue;
+	}
+
+	if (p[0] == '$' && p[1] == '(') {               // Command substitution
+	    tail = addToken (tail, SUBST_CMD, strdup ("$("), join, 0);
+	    p += 2;
+	    join = 1;
+	    continue;
+	}
+
+	// SIMPLE token:  copy characters until whitespace or a metacharacter
+	// outside of a "quoted string", stripping the quotes and escapes
+	int size = 16, n = 0, quoted = 0;
+	char *text = malloc (size);
+
+	while (*p && !isspace ((unsigned char) *p) && !strchr (METACHAR, *p)
+		  && !(p[0] == '$' && p[1] == '(')) {
+	    if (n + 3 > size)                           // Room for a character,
+		text = realloc (text, size *= 2);       //   its mark, and the null
+	    if (*p == '\\' && p[1] && p[1] != '\n') {   // Escaped character
+		if (strchr (QUOTED, p[1]))
+		    text[n++] = QUOTE_MARK;
+		text[n++] = p[1];
+		p += 2;
+		quoted = 1;
+	    } else if (*p == '"') {                     // Quoted string
+		quoted = 1;
+		for (p++;  *p && *p != '"';  p++) {
+		    if (*p == '\\' && (p[1] == '"' || p[1] == '\\'))
+			p++;
+		    if (n + 3 > size)
+			text = realloc (text, size *= 2);
+		    if (strchr (QUOTED, *p))
+			text[n++] = QUOTE_MARK;
+		    text[n++] = *p;
+		}
+		if (*p != '"') {
+		    fprintf (stderr, "Unterminated string\n");
+		    free (text);
+		    freeList (list);
+		    return NULL;
+		}
+		p++;
+	    } else {
+		text[n++] = *p++;
+	    }
+	}
+	text[n] = '\0';
+	tail = addToken (tail, SIMPLE, realloc (text, n+1), join, quoted);
+	join = 1;
+    }
+
+    return list;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// The parser walks the token list through *LIST, advancing it as tokens are
+// consumed.  Each routine returns the tree it built or NULL after printing
+// an error message.
+
+static CMD *command (token **list);
+static CMD *stage (token **list);
+
+// Per thread, so that threads of a program linked with libbsh.a can parse at
+// once (see bsh.h)
+static __thread token *head;                    // First token being parsed
+static __thread FILE *input;                    // Stream for extra lines
+                                                //   (NULL means stdin)
+
+// Make FP the stream from which parse() reads here documents and the rest
+// of unfinished groups and loops; return the previous one
+FILE *parseInput (FILE *fp)
+{
+    FILE *old = (input ? input : stdin);
+
+    input = fp;
+    return old;
+}
+
+
+// Return the type of the next token without consuming it (NONE at end)
+static int peekToken (token **list)
+{
+    return (*list ? (*list)->type : NONE);
+}
+
+
+// Is the next token the reserved word WORD (i.e., an unquoted SIMPLE token)?
+static int reserved (token **list, char *word)
+{
+    return (peekToken (list) == SIMPLE && !(*list)->quoted
+	    && !strcmp ((*list)->text, word));
+}
+
+
+// Does the next token close a group or part of a loop?
+static int closer (token **list)
+{
+    return (reserved (list, "}") || reserved (list, "do")
+	    || reserved (list, "done"));
+}
+
+
+// If the next token is a reserved word that begins a group or loop, return
+// the type of the CMD it begins (else NONE)
+static int compound (token **list)
+{
+    return (reserved (list, "{")     ? GROUP
+	  : reserved (list, "for")   ? FOR
+	  : reserved (list, "while") ? WHILE
+	  : reserved (list, "until") ? UNTIL
+	  :                            NONE);
+}
+
+
+// Print the error message for a missing reserved word END
+static void missing (char *end)
+{
+    char msg[16];
+
+    if (!strcmp (end, "}")) {
+	WARN ("unbalanced braces");
+    } else {
+	sprintf (msg, "missing %s", end);
+	WARN (msg);
+    }
+}
+
+
+// Tokenize the next nonblank line of input, append its tokens to the list
+// being parsed, and point *LIST at them; return 0 at end of file
+static int moreInput (token **list)
+{
+    token *new = NULL, *tail;
+    char *line;
+
+    while (new == NULL) {
+	if ((line = getLine (input ? input : stdin)) == NULL)
+	    return 0;
+	new = tokenize (line);
+	free (line);
+    }
+    for (tail = head;  tail->next;  tail = tail->next)
+	;
+    tail->next = new;
+    *list = new;
+    return 1;
+}
+
+
+// Return a new CMD of type TYPE with children LEFT and RIGHT
+static CMD *makeNode (int type, CMD *left, CMD *right)
+{
+    CMD *new = mallocCMD();
+
+    new->type  = type;
+    new->left  = left;
+    new->right = right;
+    return new;
+}
+
+
+// Append STR to the NULL-terminated array *ARRAY of *N strings
+static void append (char ***array, int *n, char *str)
+{
+    *array = realloc (*array, (*n + 2) * sizeof(char *));
+    (*array)[(*n)++] = str;
+    (*array)[*n] = NULL;
+}
+
+
+// Parse the <command> of a substitution (*LIST is a PROC_IN, PROC_OUT, or
+// SUBST_CMD token), add its tree to CMD->subst[], and return the malloc()-ed
+// word that stands for it (NULL after printing an error message)
+static char *substitute (token **list, CMD *cmd)
+{
+    int type = (*list)->type;
+    char *word;
+    CMD *sub;
+
+    if (cmd->nSubst == MAX_SUBST) {
+	WARN ("too many substitutions");
+	return NULL;
+    }
+    *list = (*list)->next;
+    if ((sub = command (list)) == NULL)
+	return NULL;
+    if (peekToken (list) != PAR_RIGHT) {
+	WARN ("unbalanced parentheses");
+	freeCMD (sub);
+	return NULL;
+    }
+    *list = (*list)->next;
+
+    cmd->subst = realloc (cmd->subst, (cmd->nSubst+1) * sizeof(CMD *));
+    cmd->subst[cmd->nSubst++] = makeNode (type, sub, NULL);
+
+    word = malloc (3);
+    word[0] = SUBST_MARK;
+    word[1] = cmd->nSubst;
+    word[2] = '\0';
+    return word;
+}
+
+
+// Remove the QUOTE_MARKs from the string WORD
+void unquote (char *word)
+{
+    char *p = word;
+
+    for ( ;  *word;  word++)
+	if (*word != QUOTE_MARK)
+	    *p++ = *word;
+    *p = '\0';
+}
+
+
+// Append the string TEXT to the malloc()-ed string *WORD
+static void glue (char **word, char *text)
+{
+    *word = realloc (*word, strlen (*word) + strlen (text) + 1);
+    strcat (*word, text);
+}
+
+
+// Read the body of a here document terminated by a line containing only
+// DELIM from input and return it in a malloc()-ed string
+static char *hereDoc (char *delim)
+{
+    int size = 1, n = 0;
+    char *body = malloc (size), *line;
+
+    while ((line = getLine (input ? input : stdin)) != NULL) {
+	int len = strlen (line);
+	if (len > 0 && line[len-1] == '\n'
+		&& len-1 == strlen (delim) && !strncmp (line, delim, len-1)) {
+	    free (line);
+	    break;
+	}
+	body = realloc (body, size += len);
+	memcpy (body + n, line, len);
+	n += len;
+	free (line);
+    }
+    body[n] = '\0';
+    return body;
+}
+
+
+// Read and discard the bodies of the here documents in the tokens LIST, which
+// were left unparsed by an error, so that their lines are not run as commands
+static void skipHereDocs (token *list)
+{
+    for ( ;  list;  list = list->next) {
+	if (list->type == RED_IN_HERE && list->next
+		&& list->next->type == SIMPLE) {
+	    unquote (list->next->text);
+	    free (hereDoc (list->next->text));
+	}
+    }
+}
+
+
+// Parse a redirection (*LIST is a RED_* token) into CMD; return an error
+// message or NULL (or "" if the message has already been printed)
+static char *redirect (token **list, CMD *cmd)
+{
+    int type = (*list)->type, next;
+    char *file;
+
+    *list = (*list)->next;
+    if ((next = peekToken (list)) == PROC_IN || next == PROC_OUT) {
+	if (type == RED_IN_HERE || type == RED_IN_STR
+	      || type == RED_IN_DUP || type == RED_OUT_DUP)
+	    return "missing filename";
+	if ((file = substitute (list, cmd)) == NULL)
+	    return "";
+	if (type == RED_IN ? cmd->fromType != NONE : cmd->toType != NONE) {
+	    free (file);
+	    return (type == RED_IN) ? "two input redirects"
+				    : "two output redirects";
+	}
+	if (type == RED_IN) {
+	    cmd->fromType = type;
+	    cmd->fromFile = file;
+	} else {
+	    cmd->toType = type;
+	    cmd->toFile = file;
+	}
+	return NULL;
+    } else if (next != SIMPLE) {
+	return "missing filename";
+    }
+    file = (*list)->text;
+    unquote (file);                             // Never a pattern
+
+    if (type == RED_IN || type == RED_IN_HERE || type == RED_IN_STR
+	  || type == RED_IN_DUP) {
+	if (cmd->fromType != NONE) {
+	    if (type == RED_IN_HERE)                // Not to be run as commands
+		free (hereDoc (file));
+	    return "two input redirects";
+	}
+	cmd->fromType = type;
+	if (type == RED_IN_HERE) {
+	    cmd->fromFile = hereDoc (file);
+	} else if (type == RED_IN_STR) {                // Word plus newline
+	    cmd->fromFile = malloc (strlen (file) + 2);
+	    sprintf (cmd->fromFile, "%s\n", file);
+	} else {
+	    cmd->fromFile = strdup (file);
+	}
+    } else {
+	if (cmd->toType != NONE)
+	    return "two output redirects";
+	cmd->toType = type;
+	cmd->toFile = strdup (file);
+    }
+
+    *list = (*list)->next;
+    return NULL;
+}
+
+
+// <list> = <command> / <list> NEWLINE <command>, ended by the reserved word
+// END, which is consumed; lines are read from stdin until END is found
+static CMD *body (token **list, char *end)
+{
+    CMD *cmd = NULL, *next;
+
+    for (;;) {
+	if (peekToken (list) == NONE && !moreInput (list)) {
+	    missing (end);
+	    freeCMD (cmd);
+	    return NULL;
+	} else if (reserved (list, end)) {
+	    *list = (*list)->next;
+	    if (cmd == NULL)
+		WARN ("null command");
+	    return cmd;
+	} else if ((next = command (list)) == NULL) {
+	    freeCMD (cmd);
+	    return NULL;
+	}
+	cmd = (cmd ? makeNode (SEP_END, cmd, next) : next);
+
+	if (peekToken (list) != NONE && !reserved (list, end)) {
+	    if (closer (list))
+		missing (end);
+	    else
+		WARN ("unbalanced parentheses");
+	    freeCMD (cmd);
+	    return NULL;
+	}
+    }
+}
+
+
+// Parse do <list> done, which may begin on the next line
+static CMD *doBody (token **list)
+{
+    if ((peekToken (list) == NONE && !moreInput (list))
+	    || !reserved (list, "do")) {
+	missing ("do");
+	return NULL;
+    }
+    *list = (*list)->next;
+    return body (list, "done");
+}
+
+
+// Parse the rest of for NAME in WORD ... ; do <list> done (*LIST follows the
+// for) into CMD and return the tree for the <list> (NULL after an error)
+static CMD *forLoop (token **list, CMD *cmd)
+{
+    char **last = NULL;                         // Word that the next token
+    int type;                                   //   may be joined to
+
+    if (peekToken (list) != SIMPLE || closer (list) || (*list)->quoted) {
+	WARN ("missing loop variable");
+	return NULL;
+    }
+    cmd->name = strdup ((*list)->text);
+    *list = (*list)->next;
+
+    if (!reserved (list, "in")) {
+	missing ("in");
+	return NULL;
+    }
+    *list = (*list)->next;
+
+    while ((type = peekToken (list)) == SIMPLE || type == PROC_IN
+				   || type == PROC_OUT || type == SUBST_CMD) {
+	int join = (*list)->join;
+	char *word;
+
+	if (type != SIMPLE) {
+	    if ((word = substitute (list, cmd)) == NULL)
+		return NULL;                            // Error already printed
+	} else {
+	    word = strdup ((*list)->text);
+	    *list = (*list)->next;
+	}
+
+	if (last && join) {                             // Rest of last word
+	    glue (last, word);
+	    free (word);
+	} else {
+	    append (&cmd->argv, &cmd->argc, word);
+	    last = &cmd->argv[cmd->argc-1];
+	}
+    }
+
+    if (type == SEP_END)                        // ; or newline before do
+	*list = (*list)->next;
+    else if (type != NONE) {
+	missing ("do");
+	return NULL;
+    }
+    return doBody (list);
+}
+
+
+// Parse the rest of while <list> do <list> done or of until <list> do <list>
+// done (*LIST follows the while or until) into CMD; return the tree for the
+// first <list> and make that for the second the right child of CMD
+static CMD *whileLoop (token **list, CMD *cmd)
+{
+    CMD *cond;
+
+    if ((cond = body (list, "do")) == NULL)
+	return NULL;
+    if ((cmd->right = body (list, "done")) == NULL) {
+	freeCMD (cond);
+	return NULL;
+    }
+    return cond;
+}
+
+
+// Parse the rest of NAME ( ) <stage> (*LIST is the left parenthesis) into
+// CMD, whose only argument is NAME; return CMD (NULL after an error)
+static CMD *function (token **list, CMD *cmd)
+{
+    CMD *body;
+
+    *list = (*list)->next->next;                // Skip ( and )
+    if ((peekToken (list) == NONE && !moreInput (list))
+	    || (compound (list) == NONE && peekToken (list) != PAR_LEFT)) {
+	WARN ("missing function body");
+	freeCMD (cmd);
+	return NULL;
+    }
+    if ((body = stage (list)) == NULL) {
+	freeCMD (cmd);
+	return NULL;                                    // Error already printed
+    }
+
+    cmd->type = FUNC;
+    cmd->name = cmd->argv[0];
+    unquote (cmd->name);
+    cmd->argv[0] = NULL;
+    cmd->argc = 0;
+    cmd->left = body;
+    return cmd;
+}
+
+
+// <stage> = <simple> / (<command>) / { <list> } / <loop> / <function>
+static CMD *stage (token **list)
+{
+    CMD *cmd = mallocCMD(), *sub = NULL;
+    char *err = NULL, **last = NULL;            // Word that the next token
+    int type, kind = SUBCMD;                    //   may be joined to
+
+    cmd->type = SIMPLE;
+    for (;;) {
+	type = peekToken (list);
+	if (last && (type == NONE || !(*list)->join))
+	    last = NULL;
+
+	if (type == RED_IN || type == RED_IN_HERE || type == RED_IN_STR
+	     || type == RED_IN_DUP || type == RED_OUT || type == RED_OUT_APP
+	     || type == RED_OUT_DUP) {
+	    if ((err = redirect (list, cmd)) != NULL)
+		break;
+	    last = NULL;
+
+	} else if (type == SIMPLE && !last && !sub && cmd->argc == 0
+		     && cmd->nLocal == 0 && compound (list) != NONE) {
+	    kind = compound (list);
+	    *list = (*list)->next;
+	    if (kind == GROUP)
+		sub = body (list, "}");
+	    else if (kind == FOR)
+		sub = forLoop (list, cmd);
+	    else
+		sub = whileLoop (list, cmd);
+	    if (sub == NULL)
+		break;                                  // Error already printed
+
+	} else if (type == SIMPLE && !last && !sub && cmd->argc == 0
+		     && cmd->nLocal == 0 && closer (list)) {
+	    err = "null command";
+	    break;
+
+	} else if (type == SIMPLE && !(sub && closer (list))) {
+	    char *text = (*list)->text, *eq = strchr (text, '=');
+	    if (sub) {
+		err = "command and subcommand";
+		break;
+	    } else if (last) {                          // Rest of last word
+		glue (last, text);
+	    } else if (cmd->argc == 0 && eq) {          // Local variable
+		int n = cmd->nLocal;
+		append (&cmd->locVar, &n, strndup (text, eq - text));
+		append (&cmd->locVal, &cmd->nLocal, strdup (eq+1));
+		last = &cmd->locVal[cmd->nLocal-1];
+	    } else {
+		append (&cmd->argv, &cmd->argc, strdup (text));
+		last = &cmd->argv[cmd->argc-1];
+	    }
+	    *list = (*list)->next;
+
+	} else if (type == PROC_IN || type == PROC_OUT || type == SUBST_CMD) {
+	    char *word;
+	    if (sub) {
+		err = "command and subcommand";
+		break;
+	    } else if ((word = substitute (list, cmd)) == NULL) {
+		break;                                  // Error already printed
+	    } else if (last) {                          // Rest of last word
+		glue (last, word);
+		free (word);
+	    } else {
+		append (&cmd->argv, &cmd->argc, word);
+		last = &cmd->argv[cmd->argc-1];
+	    }
+
+	} else if (type == PAR_LEFT && !sub && cmd->argc == 1
+		     && cmd->nLocal == 0 && cmd->nSubst == 0
+		     && cmd->fromType == NONE && cmd->toType == NONE
+		     && (*list)->next && (*list)->next->type == PAR_RIGHT) {
+	    return function (list, cmd);
+
+	} else if (type == PAR_LEFT) {
+	    if (sub) {
+		err = "two subcommands";
+		break;
+	    } else if (cmd->argc > 0 || cmd->nLocal > 0) {
+		err = "command and subcommand";
+		break;
+	    }
+	    *list = (*list)->next;
+	    last = NULL;
+	    if ((sub = command (list)) == NULL)
+		break;                                  // Error already printed
+	    if (peekToken (list) != PAR_RIGHT) {
+		err = "unbalanced parentheses";
+		break;
+	    }
+	    *list = (*list)->next;
+
+	} else if (sub || cmd->argc > 0) {              // End of stage
+	    for (int i = 0; i < cmd->nLocal; i++) {     // Never patterns
+		unquote (cmd->locVar[i]);
+		unquote (cmd->locVal[i]);
+	    }
+	    if (sub) {
+		cmd->type = kind;
+		cmd->left = sub;
+	    }
+	    return cmd;
+
+	} else {
+	    err = "null command";
+	    break;
+	}
+    }
+
+    if (err && *err)
+	WARN (err);
+    freeCMD (sub);
+    freeCMD (cmd);
+    return NULL;
+}
+
+
+// <pipeline> = <stage> / <pipeline> | <stage>
+static CMD *pipeline (token **list)
+{
+    CMD *cmd = stage (list), *right;
+
+    while (cmd && peekToken (list) == RED_PIPE) {
+	*list = (*list)->next;
+	if ((right = stage (list)) == NULL) {
+	    freeCMD (cmd);
+	    return NULL;
+	}
+	cmd = makeNode (PIPE, cmd, right);
+    }
+    return cmd;
+}
+
+
+// <and-or> = <pipeline> / <and-or> && <pipeline> / <and-or> || <pipeline>
+static CMD *andOr (token **list)
+{
+    CMD *cmd = pipeline (list), *right;
+    int type;
+
+    while (cmd && ((type = peekToken (list)) == SEP_AND || type == SEP_OR)) {
+	*list = (*list)->next;
+	if ((right = pipeline (list)) == NULL) {
+	    freeCMD (cmd);
+	    return NULL;
+	}
+	cmd = makeNode (type, cmd, right);
+    }
+    return cmd;
+}
+
+
+// <sequence> = <and-or> / <sequence> ; <and-or> / <sequence> & <and-or>
+// <command>  = <sequence> / <sequence> ; / <sequence> &
+static CMD *command (token **list)
+{
+    CMD *cmd = andOr (list), *right;
+    int type;
+
+    while (cmd && ((type = peekToken (list)) == SEP_END || type == SEP_BG)) {
+	*list = (*list)->next;
+	if (peekToken (list) == NONE || peekToken (list) == PAR_RIGHT
+		|| closer (list))
+	    return makeNode (type, cmd, NULL);          // Trailing ; or &
+	if ((right = andOr (list)) == NULL) {
+	    freeCMD (cmd);
+	    return NULL;
+	}
+	cmd = makeNode (type, cmd, right);
+    }
+    return cmd;
+}
+
+
+// Parse a token list into a command structure and return a pointer to
+// that structure (NULL if errors found).
+CMD *parse (token *tok)
+{
+    CMD *cmd;
+
+    head = tok;
+    cmd = command (&tok);
+
+    if (cmd && tok != NULL) {                           // Tokens left over
+	WARN (reserved (&tok, "}") ? "unbalanced braces"
+	      : closer (&tok)      ? "do or done outside loop"
+	      :                      "unbalanced parentheses");
+	freeCMD (cmd);
+	cmd = NULL;
+    }
+    if (cmd == NULL)                    // The rest of the line was not parsed
+	skipHereDocs (tok);
+    return cmd;
+}
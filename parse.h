@@ -7,17 +7,30 @@
 #ifndef PARSE_INCLUDED
 #define PARSE_INCLUDED          // parse.h has been #include-d
 
+#include <stdio.h>
+
 
 // A token is
 //
 // (1) a maximal, contiguous, nonempty sequence of nonwhitespace characters
 //     other than the metacharacters <, >, ;, &, |, (, and ) [a SIMPLE token];
 //
-// (2) a redirection symbol (<, >, >>, or |);
+// (2) a redirection symbol (<, <<, <<<, >, >>, or |);
 //
 // (3) a command terminator (;, &, &&, or ||);
 //
-// (4) a left or right parenthesis (used to group commands).
+// (4) a left or right parenthesis (used to group commands); or
+//
+// (5) the start of a process substitution (<( or >() or of a command
+//     substitution ($(), which is closed by a right parenthesis.
+//
+// Inside a SIMPLE token, a "quoted string" may contain whitespace and
+// metacharacters, and a backslash escapes the next character; the quotes
+// and escapes are removed.  $( is recognized only outside quotes.
+//
+// The SIMPLE tokens {, }, for, in, while, until, do, and done are reserved
+// words when unquoted and in the positions given by the grammar below, and
+// are otherwise ordinary words.
 
 
 // String containing all metacharacters that terminate SIMPLE tokens
@@ -31,6 +44,8 @@
 typedef struct token {          // Struct for each token in linked list
   char *text;                   //   String containing token (if SIMPLE)
   int type;                     //   Corresponding type
+  int join;                     //   No whitespace before token?
+  int quoted;                   //   Contained quotes or escapes?
   struct token *next;           //   Pointer to next token in linked list
 } token;
 
@@ -61,9 +76,15 @@ enum {
       SIMPLE,           // Maximal contiguous sequence ... (as above)
 
       RED_IN,           // <
+      RED_IN_HERE,      // <<  (here document)
+      RED_IN_STR,       // <<< (here string)
+      RED_IN_DUP,       // <&  (from a coprocess or fd)
+      PROC_IN,          // <(  (process substitution read by the command)
 
       RED_OUT,          // >
       RED_OUT_APP,      // >>
+      RED_OUT_DUP,      // >&  (to a coprocess or fd)
+      PROC_OUT,         // >(  (process substitution written by the command)
 
       RED_PIPE,         // |
 
@@ -75,12 +96,19 @@ enum {
       PAR_LEFT,         // (
       PAR_RIGHT,        // )
 
+      SUBST_CMD,        // $(  (command substitution)
+
    // Token types used by parse() et al.
 
       NONE,             // Nontoken: Did not find a token
       ERROR,            // Nontoken: Encountered an error
       PIPE,             // Nontoken: CMD struct for pipeline
-      SUBCMD            // Nontoken: CMD struct for subcommand
+      SUBCMD,           // Nontoken: CMD struct for subcommand
+      GROUP,            // Nontoken: CMD struct for { } group
+      FOR,              // Nontoken: CMD struct for for loop
+      WHILE,            // Nontoken: CMD struct for while loop
+      UNTIL,            // Nontoken: CMD struct for until loop
+      FUNC              // Nontoken: CMD struct for function definition
 };
 
 
@@ -88,15 +116,57 @@ enum {
 
 // The syntax for a command is
 //
-//   <stage>    = <simple> / (<command>)
+//   <stage>    = <simple> / (<command>) / { <list> } / <loop> / <function>
 //   <pipeline> = <stage> / <pipeline> | <stage>
 //   <and-or>   = <pipeline> / <and-or> && <pipeline> / <and-or> || <pipeline>
 //   <sequence> = <and-or> / <sequence> ; <and-or> / <sequence> & <and-or>
 //   <command>  = <sequence> / <sequence> ; / <sequence> &
+//   <list>     = <command> / <list> NEWLINE <command>
+//   <loop>     = for NAME in WORD ... ; do <list> done
+//              / while <list> do <list> done / until <list> do <list> done
+//   <function> = NAME ( ) <stage>
 //
 // where a <simple> is a single command with local variables, arguments, and
 // I/O redirection but no |, &, ;, &&, ||, (, or ).
 //
+// A { <list> } group runs in the shell itself rather than in a subshell, as
+// do loops.  The {, for, while, or until must begin a stage, and the }, do,
+// or done must follow ;, &, a newline, or a subcommand, group, or loop.  The
+// ; after the WORDs of a for may be a newline.  While a group or loop is
+// open, parse() reads further lines from stdin; the newlines separate
+// <command>s as ; would.
+//
+// A <function> defines NAME as a function whose body is the <stage>, which
+// must be a subcommand, group, or loop and may begin on the next line.
+// Calling NAME runs the body in the shell with the positional parameters
+// 1, 2, ... and # set to the arguments of the call.
+//
+// The redirection <<WORD reads the lines that follow the command line, up to
+// one consisting of WORD alone, as a here document; <<<WORD makes WORD plus
+// a newline the standard input.  In both cases fromFile holds the text.
+//
+// A process substitution <(<command>) or >(<command>) may appear wherever a
+// SIMPLE argument or a redirection filename may, and a command substitution
+// $(<command>) wherever a SIMPLE argument or local variable value may.  Its
+// tree, a struct of type PROC_IN, PROC_OUT, or SUBST_CMD whose left child is
+// the tree for the <command>, is appended to the subst[] array of the
+// <simple>, and the word holds the two characters SUBST_MARK and (index in
+// subst[] + 1) in its place.  SIMPLE tokens and substitutions that are not
+// separated by whitespace form a single word.
+//
+// When the command executes, a process substitution is started connected to
+// a pipe and its mark is replaced by the name /dev/fd/N of the other end.
+// The mark of a command substitution is replaced by the output of the
+// <command> less any trailing newlines; in an argument, that output is
+// split into words at whitespace.
+//
+// An unquoted *, ?, or [...] in an argument of a <simple> or a WORD of a for
+// makes the word a pattern that is replaced by the sorted pathnames that
+// match it (the word is left alone if none do).  A quoted or escaped *, ?, [,
+// or ] in a word is preceded by QUOTE_MARK so that it matches only itself;
+// redirection filenames and local variable values have no QUOTE_MARKs, as
+// they are never patterns.
+//
 // A command is represented by a tree of CMD structs corresponding to its
 // simple commands and the "operators" PIPE, && (SEP_AND), || (SEP_OR),
 // ; (SEP_END), & (SEP_BG), and SUBCMD.  The tree corresponds to how the
@@ -110,7 +180,18 @@ enum {
 //
 // The tree for a <stage> is either the tree for a <simple> or a struct
 // of type SUBCMD (which may have redirection) whose left child is the tree
-// representing the <command> and whose right child is NULL.
+// representing the <command> and whose right child is NULL.  A group is a
+// struct of type GROUP whose left child is the tree for the <list>, where
+// each NEWLINE is a struct of type ; (= SEP_END).
+//
+// A for loop is a struct of type FOR whose name is NAME, whose argv[] holds
+// the WORDs (which may contain substitutions), and whose left child is the
+// tree for the <list>.  A while (until) loop is a struct of type WHILE
+// (UNTIL) whose left and right children are the trees for the <list>s
+// before and after the do.  Loops may have redirection.
+//
+// A <function> is a struct of type FUNC whose name is NAME and whose left
+// child is the tree for the <stage>.
 //
 // The tree for a <pipeline> is either the tree for a <stage> or a struct
 // of type PIPE whose left child is the tree representing the <pipeline> and
@@ -179,9 +260,18 @@ enum {
 //                              A   B                                        //
 //                                                                           //
 
+#define SUBST_MARK '\001'      // Followed by index+1 of a substitution
+#define MAX_SUBST  255          // Maximum substitutions per <simple>
+#define QUOTE_MARK '\002'      // Precedes a quoted *, ?, [, or ]
+#define QUOTED     "*?[]"       // Characters that get a QUOTE_MARK
+
 typedef struct cmd {
   int type;             // Node type (SIMPLE, PIPE, SEP_AND, SEP_OR,
-			//   SEP_END, SEP_BG, SUBCMD, or NONE)
+			//   SEP_END, SEP_BG, SUBCMD, GROUP, FOR, WHILE,
+			//   UNTIL, FUNC, or NONE)
+
+  char *name;           // Loop variable (FOR), function name (FUNC), or
+			//   NULL
 
   int nLocal;           // Number of local variable assignments
   char **locVar;        // Array of local variable names and the values to
@@ -191,14 +281,19 @@ typedef struct cmd {
   char **argv;          // Null-terminated argument vector
 
   int fromType;         // Redirect stdin?
-			//  (NONE (default), RED_IN)
+			//  (NONE (default), RED_IN, RED_IN_HERE,
+			//   RED_IN_STR, RED_IN_DUP)
   char *fromFile;       // File to redirect stdin, contents of here
-			//   document, or NULL (default)
+			//   document or here string, or NULL (default)
 
   int toType;           // Redirect stdout?
-			//  (NONE (default), RED_OUT, RED_OUT_APP)
+			//  (NONE (default), RED_OUT, RED_OUT_APP,
+			//   RED_OUT_DUP)
   char *toFile;         // File to redirect stdout or NULL (default)
 
+  int nSubst;           // Number of substitutions marked in argv[],
+  struct cmd **subst;   //   fromFile, and toFile, and their trees
+
   struct cmd *left;     // Left subtree or NULL (default)
   struct cmd *right;    // Right subtree or NULL (default)
 } CMD;
@@ -216,12 +311,27 @@ void dumpCMD (CMD *exec, int level);
 void freeCMD (CMD *cmd);
 
 
+// Return a copy of the tree of command structures rooted at CMD
+CMD *copyCMD (CMD *cmd);
+
+
 // Print tree of CMD structs in in-order starting at LEVEL
 void dumpTree (CMD *exec, int level);
 
 
 // Parse a token list into a command structure and return a pointer to
-// that structure (NULL if errors found).
+// that structure (NULL if errors found).  The bodies of here documents and
+// the rest of unfinished groups and loops are read from stdin (or the stream
+// given to parseInput()); the tokens of the extra lines are appended to TOK.
 CMD *parse (token *tok);
 
+
+// Remove the QUOTE_MARKs from the string WORD
+void unquote (char *word);
+
+
+// Make FP the stream from which parse() reads the lines that follow the
+// command line; return the previous stream
+FILE *parseInput (FILE *fp);
+
 #endif
@@ -0,0 +1,330 @@
+// policy.c                                  Phil Esterman (11/13/15)
+//
+// CPU affinity, scheduling policy, and I/O priority of the
+// processes Bsh creates. See policy.h for the variables. They
+// are read in the child, after its locals are set, so each
+// command can have its own; BSH_NICE and BSH_BGNICE are absolute,
+// so applying them again in a grandchild changes nothing.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "policy.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+//ioprio_set() has no wrapper in the C library
+#define IOPRIO_WHO_PROCESS (1)
+#define IOPRIO_CLASS_SHIFT (13)
+enum {
+	IOPRIO_CLASS_RT = 1,
+	IOPRIO_CLASS_BE,
+	IOPRIO_CLASS_IDLE
+};
+
+static char *names[] = {"BSH_CPUSET", "BSH_PIPEPACK", "BSH_NICE",
+						"BSH_SCHED", "BSH_IOPRIO", "BSH_BGNICE", NULL};
+
+static int stage = -1;      //stage of a pipeline this process runs
+static int background = 0; //is this process a background job?
+
+int parse_cpus (char *list, cpu_set_t *set);
+int parse_nice (char *s, int *nice);
+int parse_sched (char *s, int *policy);
+int parse_ioprio (char *s, int *prio);
+int pack_cpu (cpu_set_t *allowed, int n);
+int cpu_package (int cpu);
+int by_package (const void *a, const void *b);
+
+
+////////////// VALUES //////////////
+
+
+//set *SET to the CPUs in LIST (e.g., 0-3,8); return 0 if LIST
+//is valid, else -1
+int parse_cpus (char *list, cpu_set_t *set)
+{
+	char *p = list, *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+	do
+	{
+		lo = hi = strtol(p, &end, 10);
+		if (end == p || lo < 0)
+			return -1;
+		if (*end == '-')
+		{
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if (end == p || hi < lo)
+				return -1;
+		}
+		if (hi >= CPU_SETSIZE)
+			return -1;
+		for (long c = lo; c <= hi; c++)
+			CPU_SET(c, set);
+		p = end + 1;
+	} while (*end == ',');
+
+	return *end ? -1 : 0;
+}
+
+//set *NICE to the nice value S; return 0 if valid, else -1
+int parse_nice (char *s, int *nice)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	if (end == s || *end || n < -20 || n > 19)
+		return -1;
+	*nice = n;
+	return 0;
+}
+
+//set *POLICY to the scheduling policy S; return 0 if valid,
+//else -1
+int parse_sched (char *s, int *policy)
+{
+	if (strcmp(s, "other") == 0)
+		*policy = SCHED_OTHER;
+	else if (strcmp(s, "batch") == 0)
+		*policy = SCHED_BATCH;
+	else if (strcmp(s, "idle") == 0)
+		*policy = SCHED_IDLE;
+	else
+		return -1;
+	return 0;
+}
+
+//set *PRIO to the I/O priority S (idle, be[:N], or rt[:N]);
+//return 0 if valid, else -1
+int parse_ioprio (char *s, int *prio)
+{
+	int class, level = 4;
+	char *colon = strchr(s, ':');
+	size_t n = colon ? (size_t)(colon - s) : strlen(s);
+
+	if (n == 4 && strncmp(s, "idle", 4) == 0 && !colon)
+		class = IOPRIO_CLASS_IDLE, level = 0;
+	else if (n == 2 && strncmp(s, "be", 2) == 0)
+		class = IOPRIO_CLASS_BE;
+	else if (n == 2 && strncmp(s, "rt", 2) == 0)
+		class = IOPRIO_CLASS_RT;
+	else
+		return -1;
+
+	if (colon)
+	{
+		if (colon[1] < '0' || colon[1] > '7' || colon[2])
+			return -1;
+		level = colon[1] - '0';
+	}
+	*prio = (class << IOPRIO_CLASS_SHIFT) | level;
+	return 0;
+}
+
+//is VALUE valid for the variable NAME? (-1 if NAME is not one)
+int policy_ok (char *name, char *value)
+{
+	cpu_set_t set;
+	int n;
+
+	if (strcmp(name, "BSH_CPUSET") == 0)
+		return parse_cpus(value, &set) == 0;
+	if (strcmp(name, "BSH_PIPEPACK") == 0)
+		return strcmp(value, "0") == 0 || strcmp(value, "1") == 0;
+	if (strcmp(name, "BSH_NICE") == 0 || strcmp(name, "BSH_BGNICE") == 0)
+		return parse_nice(value, &n) == 0;
+	if (strcmp(name, "BSH_SCHED") == 0)
+		return parse_sched(value, &n) == 0;
+	if (strcmp(name, "BSH_IOPRIO") == 0)
+		return parse_ioprio(value, &n) == 0;
+	return -1;
+}
+
+
+////////////// PACKING //////////////
+
+
+//the socket of CPU (0 if unknown)
+int cpu_package (int cpu)
+{
+	char path[80];
+	int package = 0;
+	FILE *fp;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+			cpu);
+	if ((fp = fopen(path, "r")))
+	{
+		if (fscanf(fp, "%d", &package) != 1)
+			package = 0;
+		fclose(fp);
+	}
+	return package;
+}
+
+//CPUs are ordered by socket, then by number
+int by_package (const void *a, const void *b)
+{
+	const int *x = a, *y = b;
+
+	return (x[1] != y[1]) ? x[1] - y[1] : x[0] - y[0];
+}
+
+//the CPU for stage N of a pipeline: the N-th of the ALLOWED
+//CPUs in order of socket (wrapping around); -1 if none
+int pack_cpu (cpu_set_t *allowed, int n)
+{
+	int (*cpu)[2], n_cpus = 0, chosen;
+
+	if (CPU_COUNT(allowed) == 0)
+		return -1;
+	cpu = malloc(CPU_COUNT(allowed) * sizeof(*cpu));
+	for (int c = 0; c < CPU_SETSIZE; c++)
+	{
+		if (CPU_ISSET(c, allowed))
+		{
+			cpu[n_cpus][0] = c;
+			cpu[n_cpus++][1] = cpu_package(c);
+		}
+	}
+	qsort(cpu, n_cpus, sizeof(*cpu), by_package);
+	chosen = cpu[n % n_cpus][0];
+	free(cpu);
+
+	return chosen;
+}
+
+
+////////////// APPLYING //////////////
+
+
+//note that this process is stage N of a pipeline
+void policy_stage (int n)
+{
+	stage = n;
+}
+
+//apply the variables to this process
+void policy_apply (void)
+{
+	cpu_set_t set;
+	char *v;
+	int n;
+
+	if (background) //BSH_BGNICE may be a local; BSH_NICE and BSH_SCHED win
+		policy_background();
+
+	if ((v = getenv("BSH_CPUSET")) && *v)
+	{
+		if (parse_cpus(v, &set) < 0)
+			fprintf(stderr, "BSH_CPUSET: bad CPU list %s\n", v);
+		else if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			perror("BSH_CPUSET");
+	}
+
+	if (stage >= 0 && (v = getenv("BSH_PIPEPACK")) && strcmp(v, "1") == 0
+			&& sched_getaffinity(0, sizeof(set), &set) == 0
+			&& (n = pack_cpu(&set, stage)) >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(n, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			perror("BSH_PIPEPACK");
+	}
+
+	if ((v = getenv("BSH_NICE")) && *v)
+	{
+		if (parse_nice(v, &n) < 0)
+			fprintf(stderr, "BSH_NICE: bad nice value %s\n", v);
+		else if (setpriority(PRIO_PROCESS, 0, n) < 0)
+			perror("BSH_NICE");
+	}
+
+	if ((v = getenv("BSH_SCHED")) && *v)
+	{
+		struct sched_param param = {0};
+		if (parse_sched(v, &n) < 0)
+			fprintf(stderr, "BSH_SCHED: bad policy %s\n", v);
+		else if (sched_setscheduler(0, n, &param) < 0)
+			perror("BSH_SCHED");
+	}
+
+	if ((v = getenv("BSH_IOPRIO")) && *v)
+	{
+		if (parse_ioprio(v, &n) < 0)
+			fprintf(stderr, "BSH_IOPRIO: bad I/O priority %s\n", v);
+		else if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, n) < 0)
+			perror("BSH_IOPRIO");
+	}
+}
+
+//apply BSH_BGNICE to this process, a background job
+void policy_background (void)
+{
+	struct sched_param param = {0};
+	char *v;
+	int n;
+
+	background = 1;
+	if (!(v = getenv("BSH_BGNICE")) || !*v)
+		return;
+	if (parse_nice(v, &n) < 0)
+		fprintf(stderr, "BSH_BGNICE: bad nice value %s\n", v);
+	else if (setpriority(PRIO_PROCESS, 0, n) < 0
+			|| sched_setscheduler(0, SCHED_BATCH, &param) < 0)
+		perror("BSH_BGNICE");
+}
+
+//sched [NAME=VALUE ...]: set (or with no VALUE, unset) the
+//variables for later commands; with no arguments, list them
+int exec_sched (int argc, char **argv)
+{
+	int status = SUCCESS, ok;
+	char *eq, *name;
+
+	if (argc == 1)
+	{
+		for (int i = 0; names[i]; i++)
+			if ((eq = getenv(names[i])))
+				printf("%s=%s\n", names[i], eq);
+		return status;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!(eq = strchr(argv[i], '=')))
+		{
+			fprintf(stderr, "sched: %s: expected NAME=VALUE\n", argv[i]);
+			status = ERROR;
+			continue;
+		}
+		name = strndup(argv[i], eq - argv[i]);
+		ok = policy_ok(name, eq + 1);
+		if (ok < 0)
+		{
+			fprintf(stderr, "sched: %s: not a scheduling variable\n", name);
+			status = ERROR;
+		}
+		else if (eq[1] == '\0')
+			unsetenv(name);
+		else if (!ok)
+		{
+			fprintf(stderr, "sched: %s: bad value %s\n", name, eq + 1);
+			status = ERROR;
+		}
+		else
+			setenv(name, eq + 1, 1);
+		free(name);
+	}
+
+	return status;
+}
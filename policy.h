@@ -0,0 +1,35 @@
+// policy.h                                  Phil Esterman (11/13/15)
+//
+// CPU affinity, scheduling policy, and I/O priority of the
+// processes Bsh creates, set by these variables (in the
+// environment, as locals of a command, or with the sched
+// builtin) and applied in the child before it runs the command:
+//
+//   BSH_CPUSET=LIST   run on the CPUs in LIST (e.g., 0-3,8)
+//   BSH_PIPEPACK=1    run stage k of a pipeline on the k-th
+//                     allowed CPU, taking CPUs in order of
+//                     socket, so that stages that pass data
+//                     sit on adjacent cores
+//   BSH_NICE=N        set the nice value to N (-20 to 19)
+//   BSH_SCHED=POLICY  other, batch, or idle
+//   BSH_IOPRIO=CLASS  idle, be[:LEVEL], or rt[:LEVEL] (LEVEL 0-7)
+//   BSH_BGNICE=N      run background jobs at nice N under batch
+//
+//They are prefixed so that a NICE or SCHED meant for some other
+//program in the environment does not change how Bsh runs it.
+
+//is VALUE valid for the variable NAME? (-1 if NAME is not one)
+int policy_ok (char *name, char *value);
+
+//note that this process is stage N of a pipeline
+void policy_stage (int n);
+
+//apply the variables to this process
+void policy_apply (void);
+
+//apply BSH_BGNICE to this process, a background job
+void policy_background (void);
+
+//sched [NAME=VALUE ...]: set (or with no VALUE, unset) the
+//variables for later commands; with no arguments, list them
+int exec_sched (int argc, char **argv);
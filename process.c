@@ -2,7 +2,6 @@
 //
 // Processes command-line args for Bsh's backend.
 #include "process.h"
-#include <assert.h>
 
 #define SUCCESS (0)
 #define ERROR (1)
@@ -14,38 +13,260 @@
 //is it a built-in command? 
 #define IS_BUILT(cmd) ((strcmp(cmd, "dirs") == 0) || \
 						  (strcmp(cmd, "cd") == 0) || \
-						  (strcmp(cmd, "wait") == 0))
-
-//holds the commands, ordered,
-//to execute for piping
-struct pipe_chain {
-	int n;    // # commands within
-	int size; //total capicity
-	CMD **cmd_list; //list of commands
+						  (strcmp(cmd, "wait") == 0) || \
+						  (strcmp(cmd, "source") == 0) || \
+						  (strcmp(cmd, ".") == 0) || \
+						  (strcmp(cmd, "cat") == 0) || \
+						  (strcmp(cmd, "tee") == 0) || \
+						  (strcmp(cmd, "sched") == 0) || \
+						  (strcmp(cmd, "ulimit") == 0) || \
+						  (strcmp(cmd, "timeout") == 0) || \
+						  (strcmp(cmd, "memo") == 0) || \
+						  (strcmp(cmd, "jobgraph") == 0) || \
+						  (strcmp(cmd, "watch") == 0) || \
+						  (strcmp(cmd, "coproc") == 0))
+
+//is it a builtin that leaves the shell as it was, so that
+//it may run in the shell for a command substitution?
+#define IS_PURE(cmd) ((strcmp(cmd, "dirs") == 0) || \
+					  (strcmp(cmd, "cat") == 0) || \
+					  (strcmp(cmd, "tee") == 0))
+
+#define ARG_HEADROOM (2048) //bytes of ARG_MAX left unused, as by xargs
+#define BATCH_FAILED (123)  //status if any batch fails, as for xargs
+
+#define SOURCE_BUF (1 << 16) //stdio buffer for a sourced file
+#define MAX_SOURCE (64)      //deepest nesting of sourced files
+
+static int n_source = 0; //# sourced files being read
+
+//a child the shell does not wait for at once:
+//a background command, a process substitution, or a coprocess
+struct job {
+	pid_t pid;
+	int kind;   //JOB_BG, JOB_SUBST, or JOB_COPROC (see coproc.h)
+	int done;   //reaped yet?
+	int status; //exit status once reaped
+};
+
+#define JOB_BG    (0)
+#define JOB_SUBST (1)
+
+//table of jobs not yet waited for
+static struct job *jobs = NULL;
+static int n_jobs = 0, size_jobs = 0;
+
+#define CHUNK (1 << 16) //bytes read at a time from a pipe
+
+//growing buffer for the output of a command substitution
+struct buffer {
+	char *s;
+	size_t n, size; //# bytes used and allocated
+};
+
+//a command with its substitutions expanded
+struct expansion {
+	CMD cmd;    //copy of command with its words expanded
+	int copied; //cmd has its own argv, locVal, fromFile, toFile?
+	int n_fd;   //# pipe ends held open for the command
+	int fd[MAX_SUBST];
+	int status; //of the last command substitution
+};
+
+//stdin and stdout of the shell saved while a command
+//runs in the shell itself with its redirections
+struct fd_frame {
+	int in, out; //saved copies (-1 if not redirected)
+};
+
+//instructions of a compiled command line
+enum {
+	SPAWN,        //run simple command cmd (or define function cmd)
+	PIPE_STAGE,   //start stage cmd of the pipeline (arg: is it the last?)
+	WAIT,         //wait for the pipeline; status is its status
+	REDIR,        //enter group or loop cmd: expand its words and apply
+	              //its redirections (on failure jump to arg)
+	UNREDIR,      //leave it, restoring stdin and stdout
+	NEXT,         //set for variable to the next word, else jump to arg
+	KEEP,         //status of the loop body becomes the loop's status
+	SUBSHELL,     //fork; the child applies the redirections of cmd and
+	              //goes on, the parent waits and jumps to arg
+	BG,           //fork; the child goes on, the parent jumps to arg
+	EXIT,         //end the child with status
+	JUMP,         //jump to arg
+	JUMP_IF_FAIL, //jump to arg if status is not SUCCESS
+	JUMP_IF_OK,   //jump to arg if status is SUCCESS
+	SET_STATUS    //set $? to status
+};
+
+struct insn {
+	int op;
+	int arg;
+	CMD *cmd;
+};
+
+//a command line lowered to a flat array of instructions
+//that point into its tree
+struct code {
+	struct insn *insn;
+	int n, size;
 };
 
-typedef struct pipe_chain pipe_chain;
+//a group or loop entered by REDIR
+struct frame {
+	struct expansion ex; //its words and redirections expanded
+	struct fd_frame fds; //stdin and stdout before its redirections
+	int next;            //index in argv of the next word (FOR)
+	int status;          //status of the last pass through the body
+};
+
+//the stages of the pipeline being started
+struct pipeline {
+	struct stage {
+		pid_t pid;  //0 if it ran in the shell or did not start
+		int status;
+	} *stage;
+	int n, size;
+	int fdin;   //read end of the last pipe (STDIN if none)
+};
+
+//a command of a ; chain run with PARSEQ set
+struct unit {
+	CMD *cmd;            //item of the chain
+	struct expansion ex; //its words, if a simple command
+	char **name;         //files it reads or writes
+	char *writes;        //does it write name[i]?
+	int n_name, size_name;
+	int serial;          //must run alone, in the shell?
+	int keep_in;         //keep the shell's stdin (else /dev/null)?
+	int state;           //U_WAITING, U_RUNNING, U_DONE, or U_SHOWN
+	pid_t pid;
+	int out, err;        //memfds holding its stdout and stderr
+	int status;
+};
+
+enum { U_WAITING, U_RUNNING, U_DONE, U_SHOWN };
+
+//a function body, shared by the function table and the
+//calls running it and freed when the last one lets go
+struct body {
+	CMD *cmd;          //tree for the <stage>
+	struct code code;  //compiled once, run by every call
+	int refs;          //# references
+};
+
+//entry in the function table
+struct func {
+	char *name;
+	struct body *body;
+	struct func *next; //next function in the same bucket
+};
+
+#define N_FUNC    (64)   //# buckets in the function table
+#define MAX_CALLS (1000) //deepest nesting of function calls
+#define MAX_PURE  (8)    //deepest calls pure_cmd() follows
+
+static struct func *funcs[N_FUNC];
+static int n_calls = 0; //# function calls running
+
+//positional parameters of the running function call
+static char **params = NULL;
+static int n_params = 0;
+
+//# processes created by the shell and its subshells
+//(shared so that forks in subshells are counted too)
+static int *n_forks = NULL;
 
 // EXECUTE class of command
 int simple_cmd (CMD *cmd);
-int stage_cmd (CMD *cmd);
 int built_cmd (CMD *cmd);
-int and_or_cmd (CMD *cmd);
+int run_builtin (CMD *cmd);
+void exec_stage (CMD *cmd);
 int seq_cmd (CMD *cmd);
+pid_t count_fork (void);
+int fork_count (void);
+
+// BATCHES of arguments too long for one exec
+void exec_program (CMD *cmd);
+long exec_size (char **argv, int n);
+int exec_batches (char **argv, int argc, long limit, int workers);
+int reap_batch (pid_t *running, int *n_running);
+
+// PARALLEL ; chains (PARSEQ)
+int par_seq (CMD *cmd, int *status);
+int stdin_live (void);
+void unit_scan (CMD *cmd, struct unit *u, int top);
+void unit_name (struct unit *u, char *name, int writes);
+void unit_file (struct unit *u, char *name, int writes);
+int opaque_cmd (CMD *cmd);
+int unit_conflict (struct unit *a, struct unit *b);
+void unit_start (struct unit *u);
+void unit_show (struct unit *u);
+int unit_reap (struct unit *units, int n);
+
+// COMPILE command trees and run the code
+int emit (struct code *code, int op, int arg, CMD *cmd);
+void compile_seq (struct code *code, CMD *cmd);
+void compile_and_or (struct code *code, CMD *cmd);
+void compile_pipe (struct code *code, CMD *cmd);
+void compile_stage (struct code *code, CMD *cmd);
+CMD **left_spine (CMD *cmd, int type1, int type2, int *n);
+int run_code (struct code *code);
+void free_code (struct code *code);
+void dump_code (struct code *code);
+void set_status (int status);
 
 // PIPING helper and execution
-int pipe_cmd (CMD *cmd);
-void build_pipe_chain(CMD *cmd, struct pipe_chain *
-							         my_pipe_chain);
+void start_stage (CMD *cmd, int last, struct pipeline *pl);
+int wait_stages (struct pipeline *pl);
+void run_stage (CMD *cmd);
+
+// FUNCTION table and calls
+unsigned hash_name (char *name);
+struct func *find_func (char *name);
+int define_func (CMD *cmd);
+int call_func (struct func *f, CMD *cmd);
+void set_params (char **argv, int n);
+
+// JOB bookkeeping
+void add_job (pid_t pid, int kind);
+void job_done (pid_t pid, int status);
+int wait_job (pid_t pid);
+
+// SUBSTITUTION of $(...), <(...), and >(...)
+int expand_cmd (CMD *cmd, struct expansion *ex);
+void expand_done (struct expansion *ex);
+int expand_word (char *word, int split, CMD *cmd,
+			struct expansion *ex, char ***words, int *n);
+int marked_argv (CMD *cmd);
+void buf_add (struct buffer *b, char *s, size_t n);
+void add_word (struct buffer *b, char ***words, int *n);
+void end_word (struct buffer *b, int wild, char ***words, int *n);
+char *expand_one (char *word, CMD *cmd, struct expansion *ex);
+int capture (CMD *cmd, struct expansion *ex, struct buffer *out);
+int pure_cmd (CMD *cmd, int depth);
+int start_subst (CMD *sub, struct expansion *ex);
+
+// SAVE and restore the shell's stdin and stdout
+int push_fds (CMD *cmd, struct fd_frame *frame);
+void pop_fds (struct fd_frame *frame);
+
+// LOCAL variables of a simple command
+void set_locals (CMD *cmd);
+void unset_locals (CMD *cmd);
 
 //SET UP file descriptors to redirect IO
 int set_red_out (CMD *cmd);
 int set_red_in (CMD *cmd);
+int here_doc (char *body);
 
 // EXECUTE a particular built-in command
 int exec_dirs(void);
 int exec_cd(CMD *cmd);
-int exec_wait(void);
+int exec_wait(CMD *cmd);
+int exec_timeout (CMD *cmd);
+int run_program (char **argv);
+int exec_source(CMD *cmd);
 
 
 
@@ -57,17 +278,43 @@ int simple_cmd(CMD *cmd)
 {
 	pid_t pid;
 	int status = SUCCESS;
+	struct expansion ex;
+	struct fd_frame frame;
+	struct func *f;
+	int expired;
 	
 	// printf("CMD: %s FROMtypeeee: %d", cmd->argv[0], cmd->fromType);
 
 
 	if (!cmd) return status; //ensures given been given cmd
 
-	if (IS_BUILT(cmd->argv[0]))
+	if (expand_cmd(cmd, &ex) != SUCCESS)
+		return ERROR;
+	cmd = &ex.cmd; //run the expanded copy
+
+	if (cmd->argc == 0) //substitutions left no command
+		status = ex.status; //as in sh, the last one's
+	else if ((f = find_func(cmd->argv[0]))) //no fork or exec
+	{
+		set_locals(cmd);
+		if (push_fds(cmd, &frame) == SUCCESS)
+		{
+			status = call_func(f, cmd);
+			pop_fds(&frame);
+		}
+		else
+			status = ERROR;
+		unset_locals(cmd);
+	}
+	else if (IS_BUILT(cmd->argv[0]))
+	{
+		set_locals(cmd);
 		status = built_cmd(cmd);
+		unset_locals(cmd);
+	}
 	else 
 	{
-		if( (pid = fork()) < 0)	//child process not created
+		if( (pid = count_fork()) < 0)	//child process not created
 		{
 				perror("SIMPLE: ");
 				return errno;
@@ -75,416 +322,1860 @@ int simple_cmd(CMD *cmd)
 		else
 		{
 			if(pid == 0) //child process
+				exec_stage(cmd);
+			else // parent process
+			{
+				expired = wait_fg(&pid, &status, 1);
+
+				//updates status in case of sigint, a limit, or
+				//the deadline
+				status = limit_status(pid, status);
+				if (expired)
+					status = TIMED_OUT;
+			}
+
+		}
+	}
+
+	expand_done(&ex);
+	return status;
+}
+
+
+//run builtin CMD in the shell with its redirections,
+//restoring stdin and stdout afterwards
+int built_cmd (CMD *cmd)
+{
+	int status = SUCCESS;
+	struct fd_frame frame;
+
+	if (!cmd) return status;
+
+	if (push_fds(cmd, &frame) != SUCCESS)
+		return ERROR;
+	status = run_builtin(cmd);
+	pop_fds(&frame);
+
+	return status;
+}
+
+//run builtin CMD with whatever stdin and stdout are now
+int run_builtin (CMD *cmd)
+{
+	int status = SUCCESS;
+
+	if (strcmp(cmd->argv[0], "dirs") == 0)
+		status = exec_dirs();
+	else if (strcmp(cmd->argv[0], "cd") == 0)
+		status = exec_cd(cmd);
+	else if (strcmp(cmd->argv[0], "wait") == 0)
+		status = exec_wait(cmd);
+	else if (strcmp(cmd->argv[0], "cat") == 0)
+		status = exec_cat(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "tee") == 0)
+		status = exec_tee(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "sched") == 0)
+		status = exec_sched(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "ulimit") == 0)
+		status = exec_ulimit(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "timeout") == 0)
+		status = exec_timeout(cmd);
+	else if (strcmp(cmd->argv[0], "memo") == 0)
+		status = exec_memo(cmd);
+	else if (strcmp(cmd->argv[0], "jobgraph") == 0)
+		status = exec_jobgraph(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "watch") == 0)
+		status = exec_watch(cmd->argc, cmd->argv);
+	else if (strcmp(cmd->argv[0], "coproc") == 0)
+		status = exec_coproc(cmd->argc, cmd->argv);
+	else //source or .
+		status = exec_source(cmd);
+
+	return status;
+}
+
+//run CMD (a simple command, subcommand, group, or loop) in a child
+//process: set its locals, scheduling policy, limits, and
+//redirections, then run a builtin or subcommand right here
+//or overlay the program. Never returns; output buffered by
+//stdio is flushed.
+void exec_stage (CMD *cmd)
+{
+	int status = SUCCESS;
+	struct func *f;
+
+	if (cmd->type == SIMPLE || cmd->type == SUBCMD)
+	{
+		set_locals(cmd);
+
+		if (cmd->fromType != NONE && set_red_in(cmd) != SUCCESS)
+		{
+			perror("RED_IN: ");
+			_exit(ERROR);
+		}
+
+		if (cmd->toType != NONE && set_red_out(cmd) != SUCCESS)
+		{
+			perror("RED_OUT: ");
+			_exit(ERROR);
+		}
+	}
+	policy_apply();
+	limit_apply();
+
+	if (cmd->type == SUBCMD)
+		status = seq_cmd(cmd->left);
+	else if (cmd->type != SIMPLE) //compiled with its redirections
+		status = seq_cmd(cmd);
+	else if (cmd->argc == 0) //substitutions left no command
+		;
+	else if ((f = find_func(cmd->argv[0])))
+		status = call_func(f, cmd);
+	else if (IS_BUILT(cmd->argv[0]))
+		status = run_builtin(cmd);
+	else
+		exec_program(cmd);
+
+	fflush(stdout);
+	_exit(status);
+}
+
+//overlay the program argv[0] of simple command CMD. With
+//ARGBATCH=N set (globally or as a local), an argument list
+//too long for exec is split into batches, N at a time. With
+//EXEC_STUB=PROG set, PROG is run with the same argv instead
+//(as by Bsh --replay --stub). Never returns.
+void exec_program (CMD *cmd)
+{
+	char *batch = getenv("ARGBATCH"), *stub = getenv("EXEC_STUB");
+	long limit = sysconf(_SC_ARG_MAX) - ARG_HEADROOM;
+	long size = exec_size(cmd->argv, cmd->argc);
+
+	if (stub && *stub)
+	{
+		execv(stub, cmd->argv);
+		perror(stub);
+		_exit(errno);
+	}
+	if (!batch || size <= limit)
+	{
+		execvp(cmd->argv[0], cmd->argv); //execute it
+		if (!batch || errno != E2BIG)
+		{
+			perror("SIMPLE: "); //print possible error
+			_exit(errno);
+		}
+		limit = size / 2; //the kernel counts more than we do
+	}
+
+	_exit(exec_batches(cmd->argv, cmd->argc, limit, atoi(batch)));
+}
+
+//bytes exec needs for the N strings ARGV plus the
+//environment, counting their pointers and the NULLs
+long exec_size (char **argv, int n)
+{
+	long size = 2 * sizeof(char *);
+
+	for (int i = 0; i < n; i++)
+		size += strlen(argv[i]) + 1 + sizeof(char *);
+	for (char **e = environ; *e; e++)
+		size += strlen(*e) + 1 + sizeof(char *);
+	return size;
+}
+
+//run argv[0] with its leading options (words that begin
+//with -, through --) and as many of the other ARGC words
+//as fit in LIMIT bytes, batch after batch, with up to
+//WORKERS batches running at once. Return SUCCESS, or
+//BATCH_FAILED if any batch did not.
+int exec_batches (char **argv, int argc, long limit, int workers)
+{
+	char **batch = malloc((argc + 1) * sizeof(char *));
+	pid_t *running, pid;
+	int n_fixed = 1, n, i, n_running = 0, failed = 0;
+	long fixed, size, word;
+
+	if (workers < 1)
+		workers = 1;
+	running = malloc(workers * sizeof(pid_t));
+
+	while (n_fixed < argc && argv[n_fixed][0] == '-')
+		if (strcmp(argv[n_fixed++], "--") == 0)
+			break;
+	fixed = exec_size(argv, n_fixed);
+	memcpy(batch, argv, n_fixed * sizeof(char *));
+
+	for (i = n_fixed; i < argc || i == n_fixed; )
+	{
+		//fill the batch; a word too long by itself goes
+		//alone, and exec reports it
+		for (n = n_fixed, size = fixed; i < argc; n++, i++)
+		{
+			word = strlen(argv[i]) + 1 + sizeof(char *);
+			if (n > n_fixed && size + word > limit)
+				break;
+			size += word;
+			batch[n] = argv[i];
+		}
+		batch[n] = NULL;
+
+		if (n_running == workers) //wait for a worker to free up
+			failed |= reap_batch(running, &n_running);
+
+		if ((pid = count_fork()) < 0)
+		{
+			perror("SIMPLE: ");
+			failed = 1;
+			break;
+		}
+		else if (pid == 0)
+		{
+			execvp(batch[0], batch);
+			perror("SIMPLE: ");
+			_exit(errno);
+		}
+		running[n_running++] = pid;
+		if (i == n_fixed) //no words past the options
+			break;
+	}
+
+	while (n_running > 0)
+		failed |= reap_batch(running, &n_running);
+
+	free(running);
+	free(batch);
+	return failed ? BATCH_FAILED : SUCCESS;
+}
+
+//wait for one of the *N_RUNNING batches RUNNING to end and
+//drop it; return whether it failed
+int reap_batch (pid_t *running, int *n_running)
+{
+	pid_t pid;
+	int status, j;
+
+	while ((pid = wait(&status)) > 0)
+	{
+		for (j = 0; j < *n_running && running[j] != pid; j++)
+			;
+		if (j < *n_running) //else not a batch
+		{
+			running[j] = running[--*n_running];
+			return status != 0;
+		}
+	}
+
+	*n_running = 0; //no children left
+	return 1;
+}
+
+//fork() and count the child
+pid_t count_fork (void)
+{
+	pid_t pid;
+
+	if (!n_forks)
+	{
+		n_forks = mmap(NULL, sizeof(*n_forks), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (n_forks == MAP_FAILED)
+		{
+			perror("mmap");
+			exit(ERROR);
+		}
+	}
+
+	limit_share(); //so a capped child can say so
+	fflush(stdout); //else the child would write it again
+	if ((pid = fork()) > 0)
+		__atomic_add_fetch(n_forks, 1, __ATOMIC_RELAXED);
+
+	return pid;
+}
+
+//# processes created so far
+int fork_count (void)
+{
+	return n_forks ? *n_forks : 0;
+}
+
+/////// PIPING ////////////
+
+//Modeled from  from Stan Eisenstat's
+//pipe.c implementation
+
+//start stage CMD of pipeline PL, reading the last pipe and
+//writing a new one unless it is the LAST stage. With
+//LASTPIPE set, a last stage that needs no process of its
+//own (a builtin, function, group, or loop) runs right here.
+void start_stage (CMD *cmd, int last, struct pipeline *pl)
+{
+	int fd[2] = {-1, -1}, //read, write fd's.
+	saved; //shell's stdin while the last stage runs in it
+	pid_t pid = 0;
+	struct stage *stage;
+	struct expansion ex; //its substitutions expanded
+
+	if (pl->n == pl->size)
+	{
+		pl->size = 2 * pl->size + 4;
+		pl->stage = realloc(pl->stage, pl->size * sizeof(*pl->stage));
+	}
+	stage = &pl->stage[pl->n++];
+	stage->pid = 0;
+	stage->status = W_EXITCODE(ERROR, 0); //unless it starts
+
+	if (last && getenv("LASTPIPE") && cmd->type != SUBCMD
+			&& (cmd->type != SIMPLE || (cmd->argc > 0
+				&& (IS_BUILT(cmd->argv[0])
+					|| find_func(cmd->argv[0])))))
+	{
+		fflush(stdout);
+		saved = fcntl(STDIN, F_DUPFD_CLOEXEC, 10);
+		dup2(pl->fdin, STDIN);
+		close(pl->fdin);
+		stage->status = W_EXITCODE(seq_cmd(cmd), 0);
+		dup2(saved, STDIN);
+		close(saved);
+		pl->fdin = STDIN;
+		return;
+	}
+
+	if (!last && pipe(fd) < 0)
+	{
+		perror("PIPE: ");
+		fd[0] = fd[1] = -1;
+	}
+
+	//a group or loop expands its own words in the child
+	ex.cmd = *cmd;
+	ex.copied = ex.n_fd = 0;
+	if ((cmd->type == SIMPLE || cmd->type == SUBCMD)
+			&& expand_cmd(cmd, &ex) != SUCCESS)
+		; //did not start
+	else if (!last && fd[1] < 0)
+		expand_done(&ex);
+	else if ((pid = count_fork()) < 0)
+	{
+		perror("PIPE: ");
+		expand_done(&ex);
+	}
+	else if (pid == 0)	//child
+	{
+		if (fd[0] >= 0)
+			close(fd[0]);	//so parents gets data from child
+		if (pl->fdin != STDIN)  //set stdin to the last pipe's read
+		{
+			dup2(pl->fdin, STDIN);
+			close(pl->fdin);
+		}
+		if (fd[1] >= 0) //set stdout to new pipe's write
+		{
+			dup2(fd[1], STDOUT);
+			close(fd[1]);
+		}
+		policy_stage(pl->n - 1);
+		exec_stage(&ex.cmd);
+	}
+	else // parent ps
+	{
+		expand_done(&ex);
+		stage->pid = pid;
+	}
+
+	if (pl->fdin != STDIN)
+		close(pl->fdin);	//only the child reads it
+	pl->fdin = (fd[0] >= 0 ? fd[0] : STDIN); //the next stage reads it
+	if (fd[1] >= 0)
+		close(fd[1]); //don't write to pipe
+}
+
+//in a child: expand the words of pipeline stage CMD and run
+//it, for a caller (libbsh) that cannot expand them itself
+void run_stage (CMD *cmd)
+{
+	struct expansion ex;
+
+	ex.cmd = *cmd;
+	ex.copied = ex.n_fd = 0;
+	if ((cmd->type == SIMPLE || cmd->type == SUBCMD)
+			&& expand_cmd(cmd, &ex) != SUCCESS)
+		_exit(ERROR);
+	exec_stage(&ex.cmd);
+}
+
+//wait for the stages of pipeline PL and return its status:
+//that of the last stage, or ERROR if an earlier one failed
+//with ERROR and none later was killed by a signal, or
+//TIMED_OUT if the deadline passed
+int wait_stages (struct pipeline *pl)
+{
+	int overall_status = SUCCESS, status, i, j, n = 0, expired = 0;
+	pid_t pid, *pids;
+	int *statuses;
+
+	for (i = 0; i < pl->n; i++)
+		if (pl->stage[i].pid > 0)
+			n++;
+
+	if (deadline_pending()) //watch just the stages
+	{
+		pids = malloc(n * sizeof(pid_t));
+		statuses = malloc(n * sizeof(int));
+		for (i = j = 0; i < pl->n; i++)
+			if (pl->stage[i].pid > 0)
+				pids[j++] = pl->stage[i].pid;
+		expired = wait_fg(pids, statuses, n);
+		for (i = j = 0; i < pl->n; i++)
+			if (pl->stage[i].pid > 0)
+				pl->stage[i].status = statuses[j++];
+		free(pids);
+		free(statuses);
+		n = 0;
+	}
+
+	for(i = 0; i < n; )
+	{
+		pid = wait(&status);
+		for (j = 0; j < pl->n && pl->stage[j].pid != pid; j++)
+			;
+		if (j < pl->n)
+		{
+			pl->stage[j].status = status;
+			i++;
+		}
+		else if (pid > 0) //someone else's child
+			job_done(pid, status);
+		else if (errno == ECHILD)
+			break;
+	}
+
+	for (i = 0; i < pl->n; i++)
+	{
+		status = pl->stage[i].status;
+		if (WIFEXITED(status))
+		{
+			if (overall_status != ERROR) //haven't met err yet.
+				overall_status = WEXITSTATUS(status);
+		}
+		else
+			overall_status = 128+WTERMSIG(status);
+		if (pl->stage[i].pid > 0)
+			limit_status(pl->stage[i].pid, status);
+	}
+
+	pl->n = 0;
+	return expired ? TIMED_OUT : overall_status;
+}
+
+
+////////////// PARALLEL SEQUENCES //////////////
+
+//With PARSEQ=N (N > 1), the items of a ; chain run up to N at
+//a time when they touch no file in common that either writes.
+//A simple command touches its redirection targets (< reads, >
+//writes) and, unless it declares its files with the locals
+//PARSEQ_IN and PARSEQ_OUT, every argument that is neither an
+//option nor a number (which it may read or write). Pipelines
+//and && || lists of such commands are scanned the same way.
+//Character devices (/dev/null, say) are not counted, as
+//writes there do not conflict. Anything else runs by itself
+//in the shell once everything before it is done: a builtin
+//that changes the shell, a function, a substitution, a
+//pattern, a group, a loop, a subcommand, or locals alone; and
+//unless it declares its files, a program that runs others or
+//scripts (see opaque[]) or an argument with whitespace or a
+//shell metacharacter, whose files cannot be read from its
+//argv. If stdin is a regular file or /dev/null (e.g., the
+//script), items read /dev/null instead; otherwise (a pipe or
+//terminal) items that do not redirect it keep it and take
+//turns. They see ? as it was before the chain; their stdout
+//and stderr are held in memfds and shown in the order of the
+//chain (each item's stdout, then its stderr), so the output
+//is that of running them one by one.
+
+//names of builtins that change the state of the shell
+#define CHANGES_SHELL(cmd) ((strcmp(cmd, "cd") == 0) || \
+						  (strcmp(cmd, "wait") == 0) || \
+						  (strcmp(cmd, "source") == 0) || \
+						  (strcmp(cmd, ".") == 0) || \
+						  (strcmp(cmd, "sched") == 0) || \
+						  (strcmp(cmd, "ulimit") == 0) || \
+						  (strcmp(cmd, "coproc") == 0))
+
+//programs that run other commands or scripts, so that the files
+//they touch cannot be read from their arguments
+static char *opaque[] = {"sh", "bash", "dash", "ksh", "zsh", "csh",
+	"tcsh", "fish", "busybox", "Bsh", "env", "xargs", "make", "gmake",
+	"nice", "nohup", "time", "timeout", "setsid", "stdbuf", "taskset",
+	"ionice", "chroot", "sudo", "su", "strace", "parallel", "find",
+	"awk", "gawk", "mawk", "sed", "perl", "python", "python2",
+	"python3", "ruby", "node", "tclsh", "lua", "php", "dd", NULL};
+
+//characters that, in an argument, hint at a command line or
+//another file inside it
+#define SHELL_CHARS " \t\n|&;<>()$`\\\"'*?[]{}~#="
+
+//run the ; chain CMD in parallel if PARSEQ allows, setting
+//*STATUS; return 1 if it ran, 0 if it is to be run as usual
+int par_seq (CMD *cmd, int *status)
+{
+	char *env = getenv("PARSEQ");
+	int workers = env ? atoi(env) : 0, n, n_units, i, j, k, running = 0,
+		shown = 0, next = 0, live;
+	struct unit *units, *u;
+	CMD **spine;
+
+	if (workers < 2 || !cmd || cmd->type != SEP_END)
+		return 0;
+
+	spine = left_spine(cmd, SEP_END, SEP_BG, &n);
+	for (i = 0; i < n && spine[i]->type == SEP_END; i++)
+		;
+	if (i < n) //background jobs keep their serial meaning
+	{
+		free(spine);
+		return 0;
+	}
+
+	units = calloc(n + 1, sizeof(*units));
+	live = stdin_live();
+	for (i = n, n_units = 0; i >= 0; i--)
+	{
+		u = &units[n_units];
+		u->keep_in = live;
+		if ((u->cmd = (i == n ? spine[n-1]->left : spine[i]->right)))
+		{
+			unit_scan(u->cmd, u, 1);
+			n_units++;
+		}
+	}
+	free(spine);
+
+	while (shown < n_units)
+	{
+		//start what it can: in order, skipping past items that
+		//must wait for one before them, up to a serial item
+		for (k = next; running < workers && k < n_units
+				&& !units[k].serial; k++)
+		{
+			if (units[k].state != U_WAITING)
+				continue;
+			for (j = shown; j < k; j++)
+				if (units[j].state <= U_RUNNING
+						&& unit_conflict(&units[j], &units[k]))
+					break;
+			if (j == k)
 			{
+				unit_start(&units[k]);
+				running += (units[k].state == U_RUNNING);
+			}
+		}
+		while (next < n_units && units[next].state != U_WAITING)
+			next++;
+
+		//show what is done, in order
+		for (; shown < n_units && units[shown].state == U_DONE; shown++)
+		{
+			unit_show(&units[shown]);
+			set_status(*status = units[shown].status);
+		}
+
+		if (shown < n_units && shown == next && units[shown].serial
+				&& running == 0)
+		{
+			u = &units[shown++];
+			u->status = seq_cmd(u->cmd);
+			u->state = U_SHOWN;
+			set_status(*status = u->status);
+			next++;
+		}
+		else if (running > 0 && unit_reap(units, n_units))
+			running--;
+	}
+
+	for (i = 0; i < n_units; i++)
+	{
+		for (j = 0; j < units[i].n_name; j++)
+			free(units[i].name[j]);
+		free(units[i].name);
+		free(units[i].writes);
+	}
+	free(units);
+	return 1;
+}
+
+//is stdin something other than a regular file or /dev/null?
+int stdin_live (void)
+{
+	struct stat st, null;
 
-				// printf("CMD: %s FROMtype: %d", cmd->argv[0], cmd->fromType);
+	if (fstat(STDIN, &st) < 0 || S_ISREG(st.st_mode))
+		return 0;
+	return !(S_ISCHR(st.st_mode) && stat("/dev/null", &null) == 0
+			&& st.st_rdev == null.st_rdev);
+}
+
+//note that U reads NAME (or if WRITES, may write it)
+void unit_name (struct unit *u, char *name, int writes)
+{
+	while (name[0] == '.' && name[1] == '/' && name[2])
+		name += 2;
+	if (u->n_name == u->size_name)
+	{
+		u->size_name = 2 * u->size_name + 8;
+		u->name = realloc(u->name, u->size_name * sizeof(char *));
+		u->writes = realloc(u->writes, u->size_name);
+	}
+	u->name[u->n_name] = strdup(name);
+	u->writes[u->n_name++] = writes;
+}
+
+//note that U reads NAME (or if WRITES, may write it), unless
+//it is a character device
+void unit_file (struct unit *u, char *name, int writes)
+{
+	struct stat st;
 
-				if(cmd->fromType != NONE)
+	if (stat(name, &st) < 0 || !S_ISCHR(st.st_mode))
+		unit_name(u, name, writes);
+}
+
+//is CMD a program in opaque[], or does an argument hold a
+//SHELL_CHARS character?
+int opaque_cmd (CMD *cmd)
+{
+	char *base = strrchr(cmd->argv[0], '/');
+
+	base = base ? base + 1 : cmd->argv[0];
+	for (int i = 0; opaque[i]; i++)
+		if (strcmp(base, opaque[i]) == 0)
+			return 1;
+	for (int i = 1; i < cmd->argc; i++)
+		if (strpbrk(cmd->argv[i], SHELL_CHARS))
+			return 1;
+	return 0;
+}
+
+//add the files that CMD, part of U (all of it if TOP), reads
+//and writes, or mark U serial
+void unit_scan (CMD *cmd, struct unit *u, int top)
+{
+	struct expansion ex;
+	char *list[2] = {NULL, NULL}, *copy, *w; //PARSEQ_IN and _OUT
+
+	if (u->serial || !cmd)
+		return;
+	if (cmd->type == PIPE || cmd->type == SEP_AND || cmd->type == SEP_OR)
+	{
+		unit_scan(cmd->left, u, 0);
+		unit_scan(cmd->right, u, 0);
+		return;
+	}
+	if (cmd->type != SIMPLE || cmd->argc == 0 || cmd->nSubst > 0
+			|| find_func(cmd->argv[0]) || CHANGES_SHELL(cmd->argv[0]))
+	{
+		u->serial = 1;
+		return;
+	}
+	for (int i = 0; i < cmd->argc; i++)
+	{
+		if (is_wild(cmd->argv[i]))
+		{
+			u->serial = 1;
+			return;
+		}
+	}
+
+	if (expand_cmd(cmd, &ex) != SUCCESS)
+	{
+		u->serial = 1;
+		return;
+	}
+	for (int i = 0; i < ex.cmd.nLocal; i++)
+	{
+		if (strcmp(ex.cmd.locVar[i], "PARSEQ_IN") == 0)
+			list[0] = ex.cmd.locVal[i];
+		else if (strcmp(ex.cmd.locVar[i], "PARSEQ_OUT") == 0)
+			list[1] = ex.cmd.locVal[i];
+	}
+	if (list[0] || list[1])
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (!list[i])
+				continue;
+			copy = strdup(list[i]);
+			for (w = strtok(copy, " \t"); w; w = strtok(NULL, " \t"))
+				unit_file(u, w, i);
+			free(copy);
+		}
+	}
+	else if (opaque_cmd(&ex.cmd))
+	{
+		expand_done(&ex);
+		u->serial = 1;
+		return;
+	}
+	else
+		for (int i = 1; i < ex.cmd.argc; i++)
+			if (ex.cmd.argv[i][0] != '-'
+					&& ex.cmd.argv[i][strspn(ex.cmd.argv[i], "0123456789.")])
+				unit_file(u, ex.cmd.argv[i], 1); //not a number
+	if (ex.cmd.fromType == RED_IN)
+		unit_file(u, ex.cmd.fromFile, 0);
+	else if (ex.cmd.fromType == RED_IN_DUP) //coprocesses keep order
+		unit_name(u, "/dev/coproc", 1);
+	else if (ex.cmd.fromType == NONE && u->keep_in)
+		unit_name(u, "/dev/stdin", 1); //consumes it
+	if (ex.cmd.toType == RED_OUT_DUP)
+		unit_name(u, "/dev/coproc", 1);
+	else if (ex.cmd.toType != NONE)
+		unit_file(u, ex.cmd.toFile, 1);
+
+	if (top) //run just as scanned
+		u->ex = ex;
+	else
+		expand_done(&ex);
+}
+
+//do A and B touch a file in common that one of them writes?
+int unit_conflict (struct unit *a, struct unit *b)
+{
+	for (int i = 0; i < a->n_name; i++)
+		for (int j = 0; j < b->n_name; j++)
+			if ((a->writes[i] || b->writes[j])
+					&& strcmp(a->name[i], b->name[j]) == 0)
+				return 1;
+	return 0;
+}
+
+//fork U with its output on memfds (and unless it keeps the
+//shell's stdin, /dev/null as stdin)
+void unit_start (struct unit *u)
+{
+	int null;
+
+	u->state = U_RUNNING;
+	u->out = memfd_create("Bsh-parseq", MFD_CLOEXEC);
+	u->err = memfd_create("Bsh-parseq", MFD_CLOEXEC);
+	fflush(stdout);
+	if (u->out < 0 || u->err < 0 || (u->pid = count_fork()) < 0)
+	{
+		perror("PARSEQ: ");
+		if (u->out >= 0)
+			close(u->out);
+		if (u->err >= 0)
+			close(u->err);
+		u->out = u->err = -1;
+		expand_done(&u->ex);
+		u->pid = 0;
+		u->status = ERROR;
+		u->state = U_DONE;
+		return;
+	}
+	if (u->pid == 0)
+	{
+		if (!u->keep_in && (null = open("/dev/null", O_RDONLY)) >= 0)
+		{
+			dup2(null, STDIN);
+			close(null);
+		}
+		dup2(u->out, STDOUT);
+		dup2(u->err, STDERR);
+		if (u->cmd->type == SIMPLE)
+			exec_stage(&u->ex.cmd);
+		fflush(stdout);
+		_exit(seq_cmd(u->cmd));
+	}
+	if (u->cmd->type == SIMPLE)
+		expand_done(&u->ex);
+}
+
+//copy the output of U to stdout and stderr
+void unit_show (struct unit *u)
+{
+	u->state = U_SHOWN;
+	if (u->pid == 0) //did not start (unit_start() closed its memfds)
+		return;
+	fflush(stdout);
+	if (lseek(u->out, 0, SEEK_SET) == 0)
+		copy_fd(u->out, STDOUT);
+	if (lseek(u->err, 0, SEEK_SET) == 0)
+		copy_fd(u->err, STDERR);
+	close(u->out);
+	close(u->err);
+}
+
+//wait for a child; if it is one of the N UNITS, mark it done
+//and return 1
+int unit_reap (struct unit *units, int n)
+{
+	int status, i;
+	pid_t pid;
+
+	if ((pid = wait(&status)) < 0)
+		return 0;
+	for (i = 0; i < n && !(units[i].state == U_RUNNING
+				&& units[i].pid == pid); i++)
+		;
+	if (i == n) //someone else's child
+	{
+		job_done(pid, status);
+		return 0;
+	}
+	units[i].status = limit_status(pid, status);
+	units[i].state = U_DONE;
+	return 1;
+}
+
+
+////////////// BYTECODE //////////////
+
+//A command line is compiled into a flat array of instructions
+//and run by a loop with an explicit program counter. The left
+//spines of ;, &, &&, ||, and | chains are walked iteratively,
+//so however long a chain is, neither compiling nor running it
+//nests C calls. Groups and loops are compiled inline; only
+//subcommand children, function calls, and substitutions start
+//a new run_code().
+
+//append an instruction to CODE and return its index
+int emit (struct code *code, int op, int arg, CMD *cmd)
+{
+	if (code->n == code->size)
+	{
+		code->size = 2 * code->size + 16;
+		code->insn = realloc(code->insn, code->size * sizeof(*code->insn));
+	}
+	code->insn[code->n].op = op;
+	code->insn[code->n].arg = arg;
+	code->insn[code->n].cmd = cmd;
+	return code->n++;
+}
+
+//return the nodes of type TYPE1 or TYPE2 on the left spine
+//of CMD, top down, in a malloc()-ed array of *N entries
+CMD **left_spine (CMD *cmd, int type1, int type2, int *n)
+{
+	CMD **spine = NULL;
+	int size = 0;
+
+	for (*n = 0; cmd->type == type1 || cmd->type == type2;
+			cmd = cmd->left)
+	{
+		if (*n == size)
+		{
+			size = 2 * size + 16;
+			spine = realloc(spine, size * sizeof(CMD*));
+		}
+		spine[(*n)++] = cmd;
+	}
+	return spine;
+}
+
+//compile <sequence> or <command> CMD. Each <and-or> ends with
+//the separator of the node above it, so only the <and-or>
+//before a & runs in the background.
+void compile_seq (struct code *code, CMD *cmd)
+{
+	CMD **spine, *item, *leaf;
+	int n, i, sep, bg = 0;
+
+	if (!cmd) return;
+
+	spine = left_spine(cmd, SEP_END, SEP_BG, &n);
+	leaf = (n > 0 ? spine[n-1]->left : cmd);
+
+	for (i = n; i >= 0; i--)
+	{
+		item = (i == n ? leaf : spine[i]->right);
+		sep = (i > 0 ? spine[i-1]->type : SEP_END);
+		if (!item) //trailing ; or &
+			continue;
+
+		if (sep == SEP_BG)
+			bg = emit(code, BG, 0, NULL);
+		compile_and_or(code, item);
+		if (sep == SEP_BG)
+		{
+			emit(code, EXIT, 0, NULL);
+			code->insn[bg].arg = code->n;
+		}
+		emit(code, SET_STATUS, 0, NULL);
+	}
+
+	free(spine);
+}
+
+//compile <and-or> CMD: each && or || jumps past the
+//<pipeline> after it when the status so far says to
+void compile_and_or (struct code *code, CMD *cmd)
+{
+	CMD **spine;
+	int n, i, jump;
+
+	if (cmd->type == SEP_END || cmd->type == SEP_BG)
+	{
+		compile_seq(code, cmd); //a <list> line in a group
+		return;
+	}
+
+	spine = left_spine(cmd, SEP_AND, SEP_OR, &n);
+	compile_pipe(code, n > 0 ? spine[n-1]->left : cmd);
+	for (i = n-1; i >= 0; i--)
+	{
+		jump = emit(code, spine[i]->type == SEP_AND ? JUMP_IF_FAIL
+					: JUMP_IF_OK, 0, NULL);
+		compile_pipe(code, spine[i]->right);
+		code->insn[jump].arg = code->n;
+	}
+
+	free(spine);
+}
+
+//compile <pipeline> CMD: start each stage, then wait
+void compile_pipe (struct code *code, CMD *cmd)
+{
+	CMD **spine;
+	int n, i;
+
+	if (cmd->type != PIPE)
+	{
+		compile_stage(code, cmd);
+		return;
+	}
+
+	spine = left_spine(cmd, PIPE, PIPE, &n);
+	emit(code, PIPE_STAGE, 0, spine[n-1]->left);
+	for (i = n-1; i >= 0; i--)
+		emit(code, PIPE_STAGE, i == 0, spine[i]->right);
+	emit(code, WAIT, 0, NULL);
+
+	free(spine);
+}
+
+//compile <stage> CMD to run in the shell
+void compile_stage (struct code *code, CMD *cmd)
+{
+	int enter, top, next, jump;
+
+	if (cmd->type == SIMPLE || cmd->type == FUNC)
+		emit(code, SPAWN, 0, cmd);
+
+	else if (cmd->type == SUBCMD)
+	{
+		enter = emit(code, SUBSHELL, 0, cmd);
+		compile_seq(code, cmd->left);
+		emit(code, EXIT, 0, NULL);
+		code->insn[enter].arg = code->n;
+	}
+
+	else if (cmd->type == GROUP)
+	{
+		enter = emit(code, REDIR, 0, cmd);
+		compile_seq(code, cmd->left);
+		emit(code, UNREDIR, 0, cmd);
+		code->insn[enter].arg = code->n;
+	}
+
+	else if (cmd->type == FOR)
+	{
+		enter = emit(code, REDIR, 0, cmd);
+		next = emit(code, NEXT, 0, NULL);
+		compile_seq(code, cmd->left);
+		emit(code, KEEP, 0, NULL);
+		emit(code, JUMP, next, NULL);
+		code->insn[next].arg = code->n;
+		emit(code, UNREDIR, 0, cmd);
+		code->insn[enter].arg = code->n;
+	}
+
+	else if (cmd->type == WHILE || cmd->type == UNTIL)
+	{
+		enter = emit(code, REDIR, 0, cmd);
+		top = code->n;
+		compile_seq(code, cmd->left);
+		jump = emit(code, cmd->type == WHILE ? JUMP_IF_FAIL : JUMP_IF_OK,
+				0, NULL);
+		compile_seq(code, cmd->right);
+		emit(code, KEEP, 0, NULL);
+		emit(code, JUMP, top, NULL);
+		code->insn[jump].arg = code->n;
+		emit(code, UNREDIR, 0, cmd);
+		code->insn[enter].arg = code->n;
+	}
+
+	else //a <command>
+		compile_seq(code, cmd);
+}
+
+//run CODE and return the status of the last command
+int run_code (struct code *code)
+{
+	struct insn *in;
+	struct frame *frames = NULL, *f;
+	struct pipeline pl = {NULL, 0, 0, STDIN};
+	struct expansion ex;
+	int status = SUCCESS, pc = 0, n_frames = 0, size_frames = 0, expired;
+	pid_t pid;
+
+	while (pc < code->n)
+	{
+		in = &code->insn[pc++];
+		switch (in->op)
+		{
+		case SPAWN:
+			status = (in->cmd->type == FUNC ? define_func(in->cmd)
+							 : simple_cmd(in->cmd));
+			break;
+
+		case PIPE_STAGE:
+			start_stage(in->cmd, in->arg, &pl);
+			break;
+
+		case WAIT:
+			status = wait_stages(&pl);
+			break;
+
+		case REDIR:
+			if (n_frames == size_frames)
+			{
+				size_frames = 2 * size_frames + 4;
+				frames = realloc(frames, size_frames * sizeof(*frames));
+			}
+			f = &frames[n_frames];
+			if (expand_cmd(in->cmd, &f->ex) != SUCCESS)
+			{
+				status = ERROR;
+				pc = in->arg;
+			}
+			else if (push_fds(&f->ex.cmd, &f->fds) != SUCCESS)
+			{
+				expand_done(&f->ex);
+				status = ERROR;
+				pc = in->arg;
+			}
+			else
+			{
+				f->next = 0;
+				f->status = SUCCESS;
+				n_frames++;
+			}
+			break;
+
+		case UNREDIR:
+			f = &frames[--n_frames];
+			pop_fds(&f->fds);
+			if (in->cmd->type != GROUP)
+				status = f->status;
+			expand_done(&f->ex);
+			break;
+
+		case NEXT:
+			f = &frames[n_frames-1];
+			if (f->next < f->ex.cmd.argc)
+				setenv(f->ex.cmd.name, f->ex.cmd.argv[f->next++], 1);
+			else
+				pc = in->arg;
+			break;
+
+		case KEEP:
+			frames[n_frames-1].status = status;
+			break;
+
+		case SUBSHELL:
+			if (expand_cmd(in->cmd, &ex) != SUCCESS)
+			{
+				status = ERROR;
+				pc = in->arg;
+			}
+			else if ((pid = count_fork()) < 0)
+			{
+				perror("STAGE: ");
+				expand_done(&ex);
+				status = ERROR;
+				pc = in->arg;
+			}
+			else if (pid == 0) //child goes on with the body
+			{
+				if (ex.cmd.fromType != NONE && set_red_in(&ex.cmd) != SUCCESS)
 				{
-					//setup input redirection
-					int red_err = set_red_in(cmd);
-					if(red_err != SUCCESS)
-					{
-						perror("RED_IN: ");
-						exit(red_err);
-					}
+					perror("RED_IN: ");
+					_exit(ERROR);
 				}
-
-				if(cmd->toType != NONE) 
+				if (ex.cmd.toType != NONE && set_red_out(&ex.cmd) != SUCCESS)
 				{
-					//setup output redirection
-					int red_err = set_red_out(cmd);
-					if (red_err != SUCCESS)
-					{
-						perror("RED_OUT: ");
-						exit(red_err);
-					} 
+					perror("RED_OUT: ");
+					_exit(ERROR);
 				}
-
-				execvp(cmd->argv[0], cmd->argv); //execute it 
-				
-				perror("SIMPLE: "); //print possible error
-				_exit(errno); //exit to parent process
 			}
 			else // parent process
 			{
-				waitpid(pid, &status, 0);
+				expand_done(&ex);
+				expired = wait_fg(&pid, &status, 1);
+
+				//updates status in case of sigint, a limit, or
+				//the deadline
+				status = limit_status(pid, status);
+				if (expired)
+					status = TIMED_OUT;
+				pc = in->arg;
+			}
+			break;
+
+		case BG:
+			if ((pid = count_fork()) < 0)	//child process not created
+			{
+				perror("FORK: ");
+				status = ERROR;
+				pc = in->arg;
+			}
+			else if (pid == 0) //run the <and-or> in background
+			{
+				fprintf(stderr, "Backgrounded: %d\n", getpid());
+				policy_background();
+			}
+			else //go on in foreground, no wait.
+			{
+				add_job(pid, JOB_BG);
+				status = SUCCESS;
+				pc = in->arg;
+			}
+			break;
+
+		case EXIT:
+			fflush(stdout);
+			_exit(status);
+
+		case JUMP:
+			pc = in->arg;
+			break;
+
+		case JUMP_IF_FAIL:
+			if (status != SUCCESS)
+				pc = in->arg;
+			break;
+
+		case JUMP_IF_OK:
+			if (status == SUCCESS)
+				pc = in->arg;
+			break;
+
+		case SET_STATUS:
+			set_status(status);
+			break;
+		}
+	}
+
+	free(frames);
+	free(pl.stage);
+	return status;
+}
+
+//free the instructions of CODE (not the tree they point into)
+void free_code (struct code *code)
+{
+	free(code->insn);
+	code->insn = NULL;
+	code->n = code->size = 0;
+}
+
+//print the instructions of CODE, one per line
+void dump_code (struct code *code)
+{
+	static char *names[] = {"SPAWN", "PIPE_STAGE", "WAIT", "REDIR",
+		"UNREDIR", "NEXT", "KEEP", "SUBSHELL", "BG", "EXIT", "JUMP",
+		"JUMP_IF_FAIL", "JUMP_IF_OK", "SET_STATUS"};
+	struct insn *in;
+
+	for (int i = 0; i < code->n; i++)
+	{
+		in = &code->insn[i];
+		printf("%4d  %-12s %d", i, names[in->op], in->arg);
+		if (in->cmd && in->cmd->type == SIMPLE && in->cmd->argc > 0)
+			printf("  %s", in->cmd->argv[0]);
+		printf("\n");
+	}
+}
+
+//make STATUS the value of $?
+void set_status (int status)
+{
+	static int shown = -1; //value $? has now
+	char str_status[16];
+
+	if (status == shown)
+		return;
+	sprintf(str_status, "%d", status);
+	setenv("?", str_status, 1);
+	shown = status;
+}
+
+//compile CMD, run it in the shell, and return its status
+int seq_cmd (CMD *cmd)
+{
+	struct code code = {NULL, 0, 0};
+	int status;
+
+	if (!cmd) return SUCCESS;
+	if (par_seq(cmd, &status)) //PARSEQ ran it in parallel
+		return status;
+
+	compile_seq(&code, cmd);
+	status = run_code(&code);
+	free_code(&code);
+	return status;
+}
+
+
+////////////// FUNCTIONS //////////////
+
+
+//FNV-1a hash of NAME
+unsigned hash_name (char *name)
+{
+	unsigned h = 2166136261u;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	return h;
+}
+
+//the function named NAME, or NULL if there is none
+struct func *find_func (char *name)
+{
+	struct func *f;
+
+	for (f = funcs[hash_name(name) % N_FUNC]; f; f = f->next)
+		if (strcmp(f->name, name) == 0)
+			return f;
+	return NULL;
+}
+
+//define (or redefine) the function in FUNC node CMD,
+//keeping a copy of its body since CMD is freed after
+//the command line runs
+int define_func (CMD *cmd)
+{
+	struct func *f;
+	struct body *body = malloc(sizeof(*body));
+
+	body->cmd = copyCMD(cmd->left);
+	body->code.insn = NULL;
+	body->code.n = body->code.size = 0;
+	compile_stage(&body->code, body->cmd);
+	body->refs = 1;
+
+	if ((f = find_func(cmd->name)))
+	{
+		if (--f->body->refs == 0) //not running
+		{
+			free_code(&f->body->code);
+			freeCMD(f->body->cmd);
+			free(f->body);
+		}
+	}
+	else
+	{
+		unsigned i = hash_name(cmd->name) % N_FUNC;
+
+		f = malloc(sizeof(*f));
+		f->name = strdup(cmd->name);
+		f->next = funcs[i];
+		funcs[i] = f;
+	}
+	f->body = body;
+
+	return SUCCESS;
+}
+
+//call function F in the shell with the arguments of CMD
+//as positional parameters; CMD's locals and redirections
+//are already in place
+int call_func (struct func *f, CMD *cmd)
+{
+	struct body *body = f->body;
+	char **saved = params;
+	int n_saved = n_params, status;
+
+	if (n_calls == MAX_CALLS)
+	{
+		fprintf(stderr, "%s: functions nested too deeply\n", cmd->argv[0]);
+		return ERROR;
+	}
+
+	body->refs++; //in case the call redefines F
+	n_calls++;
+	set_params(cmd->argv + 1, cmd->argc - 1);
+
+	status = run_code(&body->code);
+
+	set_params(saved, n_saved);
+	n_calls--;
+	if (--body->refs == 0)
+	{
+		free_code(&body->code);
+		freeCMD(body->cmd);
+		free(body);
+	}
+
+	return status;
+}
+
+//make the N strings ARGV the positional parameters, set
+//in the environment as 1, 2, ..., N and #
+void set_params (char **argv, int n)
+{
+	char name[16];
+
+	for (int i = 0; i < n || i < n_params; i++)
+	{
+		sprintf(name, "%d", i+1);
+		if (i < n)
+			setenv(name, argv[i], 1);
+		else
+			unsetenv(name);
+	}
+	sprintf(name, "%d", n);
+	setenv("#", name, 1);
+
+	params = argv;
+	n_params = n;
+}
+
+
+////////////// JOBS //////////////
+
+
+//remember a child that is not waited for at once
+//and make its pid the value of $!
+void add_job (pid_t pid, int kind)
+{
+	char str_pid[16];
+	int i, j;
+
+	if (n_jobs == size_jobs) //drop finished jobs first
+	{
+		for (i = j = 0; i < n_jobs; i++)
+			if (!jobs[i].done)
+				jobs[j++] = jobs[i];
+		n_jobs = j;
+	}
+	if (n_jobs == size_jobs) // grow job table!
+	{
+		size_jobs = (size_jobs ? 2 * size_jobs : 16);
+		jobs = realloc(jobs, size_jobs * sizeof(*jobs));
+	}
+
+	jobs[n_jobs].pid = pid;
+	jobs[n_jobs].kind = kind;
+	jobs[n_jobs].done = 0;
+	jobs[n_jobs].status = SUCCESS;
+	n_jobs++;
+
+	snprintf(str_pid, sizeof(str_pid), "%d", pid);
+	setenv("!", str_pid, 1);
+}
 
-				//updates status in case of sigint
-				status = (WIFEXITED(status) ? WEXITSTATUS(status) 
-								: 128+WTERMSIG(status));
-			}
+//record the status of a reaped child; report it
+//unless it was a process substitution
+void job_done (pid_t pid, int status)
+{
+	int i, code = limit_status(pid, status);
 
-		}
+	for (i = n_jobs - 1; i >= 0 && jobs[i].pid != pid; i--)
+		;
+
+	if (i >= 0)
+	{
+		jobs[i].done = 1;
+		jobs[i].status = code;
+		if (jobs[i].kind == JOB_COPROC) //close the shell's ends
+			coproc_done(pid);
+		if (jobs[i].kind == JOB_SUBST)
+			return;
 	}
 
-	return status;
+	fprintf(stderr, "Completed: %d (%d)\n", pid, status);
 }
 
-int stage_cmd (CMD *cmd)
+//wait for job PID (unless already reaped), forget it
+//and return its status
+int wait_job (pid_t pid)
 {
-	pid_t pid; 
-	int status = SUCCESS;
-	
-	if (!cmd) return status;
-		
-	if (cmd->type == SIMPLE)
-		status = simple_cmd(cmd);
+	int i, status;
 
-	else if (cmd->type == SUBCMD)
+	for (i = n_jobs - 1; i >= 0 && jobs[i].pid != pid; i--)
+		;
+	if (i < 0)
 	{
+		fprintf(stderr, "wait: %d: no such job\n", pid);
+		return ERROR;
+	}
 
-		if( (pid = fork()) < 0)	//child process not created
-		{
-				perror("STAGE: ");
-				return errno;
-		}	
-		else
+	if (!jobs[i].done)
+	{
+		if (waitpid(pid, &status, 0) < 0)
 		{
-			if(pid == 0) //child process
-			{	
+			perror("wait: ");
+			return ERROR;
+		}
+		job_done(pid, status);
+	}
 
-				if(cmd->fromType != NONE)
-				{
-					//setup input redirection
-					int red_err = set_red_in(cmd);
-					if(red_err != SUCCESS)
-					{
-						perror("RED_IN: ");
-						exit(red_err);
-					}
-				}
+	status = jobs[i].status;
+	jobs[i] = jobs[--n_jobs];
+	return status;
+}
 
-				if(cmd->toType != NONE) 
-				{
-					//setup output redirection
-					int red_err = set_red_out(cmd);
-					if (red_err != SUCCESS)
-					{
-						perror("RED_OUT: ");
-						exit(red_err);
-					} 
-				}
 
-				_exit(seq_cmd(cmd->left)); //exit to parent process
-			}
-			else // parent process
-			{
-				waitpid(pid, &status, 0);
+////////////// SUBSTITUTION //////////////
 
-				//updates status in case of sigint
-				status = (WIFEXITED(status) ? WEXITSTATUS(status) 
-								: 128+WTERMSIG(status));
-			}
 
-		}
+//copy CMD into EX with the substitutions in its argv, locVal,
+//fromFile, and toFile replaced; the substituted commands are
+//run (command substitution) or started (process substitution)
+int expand_cmd (CMD *cmd, struct expansion *ex)
+{
+	int ok = 1;
 
-	}
+	ex->cmd = *cmd;
+	ex->copied = 0;
+	ex->n_fd = 0;
+	ex->status = SUCCESS;
 
+	if (cmd->nSubst == 0 && !marked_argv(cmd))
+		return SUCCESS; //nothing to expand
 
-	return status;
-}
+	ex->copied = 1;
+	ex->cmd.argc = 0;
+	ex->cmd.argv = calloc(1, sizeof(char*));
+	ex->cmd.locVal = calloc(cmd->nLocal + 1, sizeof(char*));
+	ex->cmd.fromFile = ex->cmd.toFile = NULL;
 
+	for (int i = 0; ok && i < cmd->argc; i++)
+		ok = (expand_word(cmd->argv[i], 1, cmd, ex, &ex->cmd.argv,
+					&ex->cmd.argc) == SUCCESS);
 
-int built_cmd (CMD *cmd)
-{
-	int status = SUCCESS;
+	for (int i = 0; ok && i < cmd->nLocal; i++)
+		ok = (ex->cmd.locVal[i] = expand_one(cmd->locVal[i], cmd, ex))
+					!= NULL;
 
-	if (!cmd) return status;
+	if (ok && cmd->fromFile)
+		ok = (ex->cmd.fromFile = expand_one(cmd->fromFile, cmd, ex))
+					!= NULL;
 
-	if(cmd->fromType != NONE)
-	{
-		//setup input redirection
-		int red_err = set_red_in(cmd);
-		if(red_err != SUCCESS)
-		{
-			perror("RED_IN: ");
-			exit(red_err);
-		}
-	}
+	if (ok && cmd->toFile)
+		ok = (ex->cmd.toFile = expand_one(cmd->toFile, cmd, ex))
+					!= NULL;
 
-	if(cmd->toType != NONE) 
+	if (!ok)
 	{
-		//setup output redirection
-		int red_err = set_red_out(cmd);
-		if (red_err != SUCCESS)
-		{
-			perror("RED_OUT: ");
-			exit(red_err);
-		} 
+		expand_done(ex);
+		return ERROR;
 	}
 
-	if (strcmp(cmd->argv[0], "dirs") == 0)
-		status = exec_dirs();
-	else if (strcmp(cmd->argv[0], "cd") == 0)
-		status = exec_cd(cmd);
-	else if (strcmp(cmd->argv[0], "wait") == 0)
-		status = exec_wait();
+	return SUCCESS;
+}
 
-	return status;
+//close the parent's pipe ends once the command has started
+//and free the expanded copy
+void expand_done (struct expansion *ex)
+{
+	for (int i = 0; i < ex->n_fd; i++)
+		close(ex->fd[i]);
+	ex->n_fd = 0;
+
+	if (!ex->copied) return;
+
+	for (char **p = ex->cmd.argv; *p; p++)
+		free(*p);
+	for (int i = 0; i < ex->cmd.nLocal; i++)
+		free(ex->cmd.locVal[i]);
+	free(ex->cmd.argv);
+	free(ex->cmd.locVal);
+	free(ex->cmd.fromFile);
+	free(ex->cmd.toFile);
+	ex->copied = 0;
 }
 
-/////// PIPING ////////////
+//does an argument of CMD hold a pattern or a QUOTE_MARK?
+int marked_argv (CMD *cmd)
+{
+	for (int i = 0; i < cmd->argc; i++)
+		if (strchr(cmd->argv[i], QUOTE_MARK) || is_wild(cmd->argv[i]))
+			return 1;
+	return 0;
+}
 
-//build an ordered list of the piped commands. 
-void build_pipe_chain(CMD *cmd, struct pipe_chain *
-								my_pipe_chain)
+//add N bytes at S to buffer B
+void buf_add (struct buffer *b, char *s, size_t n)
 {
-	if(cmd->type == PIPE) //continue to left-most pipe	
-	{	
-		build_pipe_chain(cmd->left, my_pipe_chain);
-		build_pipe_chain(cmd->right, my_pipe_chain);
-	}
-	else if (cmd->type != PIPE) //reached end
+	if (b->n + n + 1 > b->size) // grow buffer!
 	{
-		// grow command list!
-		if(my_pipe_chain->n == my_pipe_chain->size)
-			{
-				my_pipe_chain->cmd_list = realloc(
-					      my_pipe_chain->cmd_list, 
-					     2 * my_pipe_chain->size);
-				my_pipe_chain->size *= 2; 
-			}
-
-		my_pipe_chain->cmd_list[my_pipe_chain->n] = cmd;
-		my_pipe_chain->n++;
+		b->size = 2 * b->size + n + 1;
+		b->s = realloc(b->s, b->size);
 	}
+	memcpy(b->s + b->n, s, n);
+	b->n += n;
+	b->s[b->n] = 0;
 }
 
+//append the word in buffer B to the NULL-terminated array
+//*WORDS of *N words and empty B
+void add_word (struct buffer *b, char ***words, int *n)
+{
+	char *word = (b->s ? b->s : strdup(""));
 
+	b->s = NULL;
+	b->n = b->size = 0;
 
-//Modeled from  from Stan Eisenstat's 
-//pipe.c implementation
-int pipe_cmd (CMD *cmd)
-{	
-	int overall_status = SUCCESS;
+	*words = realloc(*words, (*n + 2) * sizeof(char*));
+	(*words)[(*n)++] = word;
+	(*words)[*n] = NULL;
+}
 
-	if (cmd)
-	{
-	if (cmd->type != PIPE)
-		overall_status = stage_cmd(cmd);
-	else
+//append the word in buffer B to the NULL-terminated array
+//*WORDS of *N words, replaced by the pathnames that match it
+//if it is a pattern and WILD; empty B
+void end_word (struct buffer *b, int wild, char ***words, int *n)
+{
+	if (wild && b->s && is_wild(b->s) && wild_expand(b->s, words, n) > 0)
 	{
+		free(b->s);
+		b->s = NULL;
+		b->n = b->size = 0;
+		return;
+	}
+	if (b->s)
+		unquote(b->s);
+	add_word(b, words, n);
+}
 
-	struct entry {
-		int pid, status; 
-	} *table; //table for (pid,status) of all ps
-
-	int fd[2], //read, write fd's. 
-	pid, status = SUCCESS, //ps ID and status for children
-	fdin,
-	i, j; //read in of last pipe (else-> STDIN)
-
-	CMD *curr_cmd; //current command processing
-
-	//initialize pipe_chain
-	pipe_chain *my_pipe_chain = calloc(1, sizeof(*my_pipe_chain));
-	my_pipe_chain->cmd_list = calloc(50, sizeof(CMD*));
-	my_pipe_chain->n = 0;
-	my_pipe_chain->size = 50;
-
-	build_pipe_chain(cmd, my_pipe_chain);
-	assert(my_pipe_chain->n >= 2);
+//expand WORD and append the result to the array *WORDS of *N
+//words; if SPLIT, split the output of command substitutions
+//into words and replace patterns by the pathnames they match.
+//Substituted output is quoted: it is never a pattern.
+int expand_word (char *word, int split, CMD *cmd,
+			struct expansion *ex, char ***words, int *n)
+{
+	struct buffer b = {NULL, 0, 0}, out;
+	int started = 0; //has b begun a word?
+	char quote = QUOTE_MARK;
+	char name[32];
+	CMD *sub;
 
-	table = calloc(my_pipe_chain->n, sizeof(*table));
+	for (; *word; word++)
+	{
+		if (*word != SUBST_MARK || !word[1])
+		{
+			buf_add(&b, word, 1);
+			started = 1;
+			continue;
+		}
 
+		sub = cmd->subst[(unsigned char)*++word - 1];
+		if (sub->type != SUBST_CMD) //process substitution
+		{
+			int fd = start_subst(sub, ex);
+			if (fd < 0)
+			{
+				free(b.s);
+				return ERROR;
+			}
+			snprintf(name, sizeof(name), "/dev/fd/%d", fd);
+			buf_add(&b, name, strlen(name));
+			started = 1;
+			continue;
+		}
 
-	fdin = 0;			 //original STDIN
-	for(i = 0; i < my_pipe_chain->n - 1; i++) //the chain of ps 
-	{											  //all but last
-		
-		if(pipe(fd) || (pid = fork()) < 0)
+		if (capture(sub->left, ex, &out) != SUCCESS)
 		{
-			perror("PIPE: ");
-			exit(ERROR);
+			free(b.s);
+			return ERROR;
 		}
+		while (out.n > 0 && out.s[out.n-1] == '\n') //trim newlines
+			out.n--;
 
-		else if(pid == 0)	//child		
+		for (size_t i = 0; i < out.n; i++)
 		{
-			close(fd[0]);	//so parents gets data from child
-			if (fdin != 0)  //set stdin to the new pipe's read
+			if (split && strchr(" \t\n", out.s[i]))
 			{
-				dup2(fdin, 0);
-				close(fdin);
+				if (started)
+					end_word(&b, split, words, n);
+				started = 0;
 			}
-			if (fd[1] != 1) //set stdout to new pipe's write
+			else
 			{
-				dup2(fd[1], 1);
-				close(fd[1]);
+				if (out.s[i] && strchr(QUOTED, out.s[i]))
+					buf_add(&b, &quote, 1);
+				buf_add(&b, out.s + i, 1);
+				started = 1;
 			}
-			curr_cmd = my_pipe_chain->cmd_list[i];
-			status = execvp(curr_cmd->argv[0], curr_cmd->argv);
-			if (status < 0) status = ERROR;
-			else status = SUCCESS;
-
-			perror("PIPE CMD");
-			_exit(status);
-		}
-		else // parent ps 
-		{	
-			table[i].pid = pid; 
-			if (i > 1)
-				close(fdin);	//???
-			fdin = fd[0]; //remember the read from the pipe
-			close(fd[1]); //don't write to pipe
 		}
+		free(out.s);
 	}
 
-	//the last ps! 
-	curr_cmd = my_pipe_chain->cmd_list[my_pipe_chain->n-1];
-	if ((pid = fork()) < 0)
-	{
-		perror("PIPE: ");
-		_exit(ERROR);
-	}
-	else if (pid == 0)
+	if (started || !split) //an empty substitution is no word
+		end_word(&b, split, words, n);
+	free(b.s);
+
+	return SUCCESS;
+}
+
+//return WORD expanded into one malloc-ed string (NULL on error)
+char *expand_one (char *word, CMD *cmd, struct expansion *ex)
+{
+	char **words = NULL, *one = NULL;
+	int n = 0;
+
+	if (expand_word(word, 0, cmd, ex, &words, &n) == SUCCESS)
+		one = words[0];
+	free(words);
+
+	return one;
+}
+
+//run command CMD and return its output in OUT and its status
+//in EX->status. A builtin or function call that changes nothing
+//in the shell (see pure_cmd()) runs in it with stdout in a memfd
+//and ? kept; anything else (cd, ulimit, wait, and the like
+//included) in a child writing to a pipe. The status is only the
+//status of a command that the substitutions leave empty, as in
+//sh; a command that runs ignores it
+int capture (CMD *cmd, struct expansion *ex, struct buffer *out)
+{
+	int fd[2], status;
+	ssize_t n;
+	pid_t pid;
+
+	out->s = NULL;
+	out->n = out->size = 0;
+
+	if (cmd->type == SIMPLE && cmd->argc > 0
+			&& (IS_PURE(cmd->argv[0]) || find_func(cmd->argv[0]))
+			&& pure_cmd(cmd, 0))
 	{
-		if(fdin != 0)
+		int saved, mem = memfd_create("Bsh-subst", MFD_CLOEXEC);
+		char *status = getenv("?");
+
+		if (mem < 0)
 		{
-			dup2(fdin, 0); //make stdin  read[last pipe]
-			close(fdin);
+			perror("SUBST: ");
+			return ERROR;
 		}
-		status = execvp(curr_cmd->argv[0], curr_cmd->argv);
-		if (status < 0) status = ERROR;
-		else status = SUCCESS;
 
-		perror("PIPE CMD");
-		_exit(status);
+		status = status ? strdup(status) : NULL;
+		fflush(stdout);
+		saved = fcntl(STDOUT, F_DUPFD_CLOEXEC, 10);
+		dup2(mem, STDOUT);
+		ex->status = simple_cmd(cmd);
+		fflush(stdout);
+		dup2(saved, STDOUT);
+		close(saved);
+		if (status) //a function body sets it
+		{
+			setenv("?", status, 1);
+			free(status);
+		}
+
+		fd[0] = mem;
+		lseek(mem, 0, SEEK_SET);
+		pid = 0;
 	}
 	else
 	{
-		table[my_pipe_chain->n-1].pid = pid;
-		if (i > 1)
-			close(fdin);
-	}
+		if (pipe2(fd, O_CLOEXEC) < 0)
+		{
+			perror("SUBST: ");
+			return ERROR;
+		}
+		if ((pid = count_fork()) < 0)
+		{
+			perror("SUBST: ");
+			close(fd[0]);
+			close(fd[1]);
+			return ERROR;
+		}
 
-	for(i = 0; i < my_pipe_chain->n; )
-	{
-		pid = wait(&status);
-		for (j = 0; j < my_pipe_chain->n &&
-				table[j].pid != pid; j++)
-			;
-		if (j < my_pipe_chain->n)
+		if (pid == 0) //child process
 		{
-			table[j].status = status;
-			i++;
+			for (int i = 0; i < ex->n_fd; i++) //others' pipes
+				close(ex->fd[i]);
+			close(fd[0]);
+			dup2(fd[1], STDOUT);
+			close(fd[1]);
+			status = seq_cmd(cmd);
+			fflush(stdout);
+			_exit(status);
 		}
+		close(fd[1]);
 	}
 
-	for (i = 0; i < my_pipe_chain->n; i++)
+	do //read in large chunks
 	{
-		if (WIFEXITED(table[i].status))
-		{	
-			if (overall_status != ERROR) //haven't met err yet.
-				overall_status = WEXITSTATUS(table[i].status);
+		if (out->size - out->n < CHUNK)
+		{
+			out->size = 2 * out->size + CHUNK;
+			out->s = realloc(out->s, out->size);
 		}
-		else if (128+WTERMSIG(table[i].status))
-			overall_status = 128+WTERMSIG(table[i].status);
+		n = read(fd[0], out->s + out->n, out->size - out->n - 1);
+		if (n > 0)
+			out->n += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	close(fd[0]);
+	if (pid > 0 && waitpid(pid, &status, 0) == pid)
+		ex->status = limit_status(pid, status);
+
+	return SUCCESS;
+}
+
+//can CMD run in the shell without changing its state? Programs,
+//subcommands, and the IS_PURE builtins can, as can calls to
+//functions (followed up to MAX_PURE deep) whose bodies hold only
+//these; a builtin like cd or ulimit, a for loop (which sets its
+//variable), a background job, a definition, or a command whose
+//name comes from a substitution or pattern cannot
+int pure_cmd (CMD *cmd, int depth)
+{
+	struct func *f;
+
+	if (!cmd)
+		return 1;
+	switch (cmd->type)
+	{
+	case SIMPLE:
+		if (cmd->argc == 0)
+			return 1;
+		if (strchr(cmd->argv[0], SUBST_MARK) || is_wild(cmd->argv[0]))
+			return 0;
+		if ((f = find_func(cmd->argv[0])))
+			return depth < MAX_PURE && pure_cmd(f->body->cmd, depth + 1);
+		return !IS_BUILT(cmd->argv[0]) || IS_PURE(cmd->argv[0]);
+
+	case SUBCMD: //runs in a child
+		return 1;
+
+	case FOR:
+	case SEP_BG:
+	case FUNC:
+		return 0;
+
+	default: //groups, loops, pipelines, and lists
+		return pure_cmd(cmd->left, depth)
+			&& pure_cmd(cmd->right, depth);
 	}
+}
 
-	free(table);
-	free(my_pipe_chain->cmd_list);
-	free(my_pipe_chain);
+//start the command of process substitution SUB with its
+//stdout (PROC_IN) or stdin (PROC_OUT) connected to a pipe,
+//and return the shell's end of the pipe (-1 on error)
+int start_subst (CMD *sub, struct expansion *ex)
+{
+	int fd[2], status;
+	int mine = (sub->type == PROC_IN) ? 0 : 1; //shell keeps
+	pid_t pid;
 
+	if (pipe(fd) || (pid = count_fork()) < 0)
+	{
+		perror("SUBST: ");
+		return -1;
 	}
 
+	if (pid == 0) //child process
+	{
+		for (int i = 0; i < ex->n_fd; i++) //others' pipes
+			close(ex->fd[i]);
+		dup2(fd[1-mine], 1-mine);
+		close(fd[0]);
+		close(fd[1]);
+		status = seq_cmd(sub->left);
+		fflush(stdout);
+		_exit(status);
 	}
 
+	close(fd[1-mine]);
+	ex->fd[ex->n_fd++] = fd[mine];
+	add_job(pid, JOB_SUBST);
 
-	return overall_status;
+	return fd[mine];
 }
 
 
+////////////// LOCAL VARIABLES //////////////
 
-int and_or_cmd (CMD *cmd)
-{	
-	int status = SUCCESS; 
 
-	if (!cmd) return status;
-	
-	if (cmd->type != SEP_AND && cmd->type != SEP_OR)
-		status = pipe_cmd(cmd);
-	else if (cmd->type == SEP_OR)
-	{
-		status = and_or_cmd(cmd->left);
-		if (status == ERROR) //short circuit otherwise
-			status = pipe_cmd(cmd->right);
-	}
-	else if (cmd->type == SEP_AND)
-	{	
-		status = and_or_cmd(cmd->left);
-		if (status == SUCCESS)
-			status = pipe_cmd(cmd->right);
-	}
-	
-	return status;
+//set the local variables of CMD in the environment
+void set_locals (CMD *cmd)
+{
+	for(int i = 0; i < cmd->nLocal; i++) //each variable
+		setenv(cmd->locVar[i], cmd->locVal[i], 1);
 }
 
-int seq_cmd(CMD *cmd)
-{	
-	int status = SUCCESS; 	
-	if (!cmd) return status;
+//and remove them again
+void unset_locals (CMD *cmd)
+{
+	for(int i = 0; i < cmd->nLocal; i++) //each variable
+		unsetenv(cmd->locVar[i]);
+}
 
-	// //set redirection here! 
-	// if(cmd->fromType != NONE)
-	// {
-	// 	int red_err = set_red_in(cmd);
-	// 	if(red_err != SUCCESS)
-	// 	{
-	// 		perror("RED_IN: ");
-	// 		exit(red_err);
-	// 	}
-	// }
-
-	// if(cmd->toType != NONE) 
-	// {
-	// 	//setup output redirection
-	// 	int red_err = set_red_out(cmd);
-	// 	if (red_err != SUCCESS)
-	// 	{
-	// 		perror("RED_OUT: ");
-	// 		exit(red_err);
-	// 	} 
-	// }
-
-	if (cmd->type != SEP_END && cmd->type != SEP_BG)
-		status = and_or_cmd(cmd);
-	else if (cmd->type == SEP_END)
-	{
 
-		status = seq_cmd(cmd->left);
-		if (cmd->right)
-			status = seq_cmd(cmd->right);
-	}
-	else if (cmd->type == SEP_BG)
-	{
-		pid_t pid; 
+////////////// REDIRECTION //////////////
 
-		if( (pid = fork()) < 0)	//child process not created
+
+//save stdin and stdout in FRAME and apply CMD's
+//redirections. Return SUCCESS or ERROR, restoring
+//the saved descriptors on failure.
+int push_fds (CMD *cmd, struct fd_frame *frame)
+{
+	frame->in = frame->out = -1;
+	fflush(stdout); //what is buffered goes to the old stdout
+
+	if (cmd->fromType != NONE)
+	{
+		frame->in = fcntl(STDIN, F_DUPFD_CLOEXEC, 10);
+		if (set_red_in(cmd) != SUCCESS)
 		{
-			perror("FORK: ");
-			return errno;
-		}
-		else if (pid == 0) //run first cmd in background
-		{	
-			fprintf(stderr, "Backgrounded: %d\n", getpid());
-			status = seq_cmd(cmd->left);
-			_exit(status);
+			perror("RED_IN: ");
+			pop_fds(frame);
+			return ERROR;
 		}
-		else //run second in foreground, no wait.
-		{	
-			if(cmd->right)
-				status = and_or_cmd(cmd->right);
+	}
+
+	if (cmd->toType != NONE)
+	{
+		frame->out = fcntl(STDOUT, F_DUPFD_CLOEXEC, 10);
+		if (set_red_out(cmd) != SUCCESS)
+		{
+			perror("RED_OUT: ");
+			pop_fds(frame);
+			return ERROR;
 		}
 	}
-	
 
-	return status;
+	return SUCCESS;
 }
 
+//restore the stdin and stdout saved in FRAME
+void pop_fds (struct fd_frame *frame)
+{
+	fflush(stdout);
 
-////////////// REDIRECTION //////////////
-
+	if (frame->in >= 0)
+	{
+		dup2(frame->in, STDIN);
+		close(frame->in);
+	}
+	if (frame->out >= 0)
+	{
+		dup2(frame->out, STDOUT);
+		close(frame->out);
+	}
+	frame->in = frame->out = -1;
+}
 
 int set_red_out (CMD *cmd)
 {
@@ -499,7 +2190,10 @@ int set_red_out (CMD *cmd)
 
 	///SET FILE as output source///
 
-	file = open(cmd->toFile, mode, 0666);
+	if (cmd->toType == RED_OUT_DUP) //a coprocess or fd
+		file = coproc_fd(cmd->toFile, 1);
+	else
+		file = open(cmd->toFile, mode, 0666);
 
 	if (file < 0) return ERROR;
 
@@ -513,7 +2207,12 @@ int set_red_in (CMD *cmd)
 {
 	int file; 
 
-	file = open(cmd->fromFile, O_RDONLY);
+	if (cmd->fromType == RED_IN_HERE || cmd->fromType == RED_IN_STR)
+		file = here_doc(cmd->fromFile);
+	else if (cmd->fromType == RED_IN_DUP) //a coprocess or fd
+		file = coproc_fd(cmd->fromFile, 0);
+	else
+		file = open(cmd->fromFile, O_RDONLY);
 	if (file < 0) return ERROR;
 
 	dup2(file, STDIN);
@@ -523,6 +2222,43 @@ int set_red_in (CMD *cmd)
 }
 
 
+// Return a read-only fd at offset 0 holding BODY, or -1 on error.
+// The body is written once into a sealed memfd, so there is no file
+// on disk and no writer process to deadlock against a full pipe.
+// Falls back to an unlinked temp file when memfd_create is missing.
+int here_doc (char *body)
+{
+	int fd, n;
+	size_t len = strlen(body);
+
+	fd = memfd_create("Bsh-here", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+	{
+		char path[PATH_MAX];
+		char *tmp = getenv("TMPDIR");
+
+		snprintf(path, PATH_MAX, "%s/Bsh-hereXXXXXX", tmp ? tmp : "/tmp");
+		if ((fd = mkstemp(path)) < 0)
+			return -1;
+		unlink(path);
+	}
+
+	for (size_t done = 0; done < len; done += n) //write whole body
+		if ((n = write(fd, body + done, len - done)) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+	//ignored on the temp file fallback
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				F_SEAL_WRITE | F_SEAL_SEAL);
+	lseek(fd, 0, SEEK_SET);
+
+	return fd;
+}
+
+
 ////////////// EXEC BUILT IN COMMANDS //////////////
 
 
@@ -560,19 +2296,160 @@ int exec_cd(CMD *cmd)
 	return status;
 }
 
-int exec_wait(void)
+//timeout [-k GRACE] DURATION CMD [ARG ...]: run CMD in a child
+//(its own process group, unless already under a timeout or
+//reading a terminal); if it is still running after DURATION,
+//send SIGTERM and, GRACE later (default TIMEOUT_GRACE
+//seconds), SIGKILL to the group. Return its status, or
+//TIMED_OUT if the deadline passed.
+int exec_timeout (CMD *cmd)
+{
+	static int in_timeout = 0; //inherited by the child
+	double duration, grace = TIMEOUT_GRACE;
+	struct deadline saved;
+	int first = 1, status, expired;
+	pid_t pid;
+	CMD sub;
+
+	if (cmd->argc > 2 && strcmp(cmd->argv[1], "-k") == 0)
+	{
+		if ((grace = parse_duration(cmd->argv[2])) < 0)
+		{
+			fprintf(stderr, "timeout: bad grace period %s\n", cmd->argv[2]);
+			return ERROR;
+		}
+		first = 3;
+	}
+	else if (cmd->argc > 1 && cmd->argv[1][0] == '-' && cmd->argv[1][1])
+		return run_program(cmd->argv); //options the builtin lacks
+
+	if (first + 1 >= cmd->argc)
+	{
+		fprintf(stderr, "usage: timeout [-k GRACE] DURATION CMD [ARG ...]\n");
+		return ERROR;
+	}
+	if ((duration = parse_duration(cmd->argv[first])) < 0)
+	{
+		fprintf(stderr, "timeout: bad duration %s\n", cmd->argv[first]);
+		return ERROR;
+	}
+
+	sub = *cmd; //locals and redirections are already in effect
+	sub.nLocal = 0;
+	sub.fromType = sub.toType = NONE;
+	sub.argv = cmd->argv + first + 1;
+	sub.argc = cmd->argc - first - 1;
+
+	fflush(stdout);
+	deadline_push(duration, grace, &saved);
+	if ((pid = count_fork()) < 0)
+	{
+		perror("timeout: ");
+		deadline_pop(&saved);
+		return ERROR;
+	}
+	if (pid == 0)
+	{
+		if (!in_timeout && !isatty(STDIN)) //a terminal stops other groups
+			setpgid(0, 0);
+		in_timeout = 1;
+		exec_stage(&sub);
+	}
+	if (!in_timeout && !isatty(STDIN))
+		setpgid(pid, pid); //whichever runs first
+
+	expired = wait_fg(&pid, &status, 1);
+	deadline_pop(&saved);
+	status = limit_status(pid, status);
+	return expired ? TIMED_OUT : status;
+}
+
+// wait      wait for all children
+// wait PID  wait for job PID and return its status
+int exec_wait(CMD *cmd)
 {
 	int status;
 	int pid; 
 
+	if (cmd->argc > 1)
+		return wait_job(atoi(cmd->argv[1]));
+
 	while( (pid = waitpid(-1, &status, 0)) != -1)
 		if (pid != 0)
-			fprintf(stderr, "Completed: %d (%d)\n",	pid, status);
+			job_done(pid, status);
 
 	return SUCCESS;
 }
 
 
+//run the commands in file argv[1] in this shell, with
+//argv[2], ... as positional parameters if given. Return
+//the status of the last command run, or ERROR if the
+//file cannot be read or a line in it does not parse.
+int exec_source(CMD *cmd)
+{
+	FILE *fp, *old_input;
+	char *line, **saved = params;
+	int status = SUCCESS, n_saved = n_params, n_line = 0;
+	token *list;
+	CMD *tree;
+
+	if (cmd->argc < 2)
+	{
+		fprintf(stderr, "%s: filename argument required\n", cmd->argv[0]);
+		return ERROR;
+	}
+	if (n_source == MAX_SOURCE)
+	{
+		fprintf(stderr, "%s: %s: nested too deeply\n", cmd->argv[0],
+				cmd->argv[1]);
+		return ERROR;
+	}
+	if ((fp = fopen(cmd->argv[1], "r")) == NULL)
+	{
+		perror(cmd->argv[1]);
+		return ERROR;
+	}
+	fcntl(fileno(fp), F_SETFD, FD_CLOEXEC); //not for children
+	setvbuf(fp, NULL, _IOFBF, SOURCE_BUF);
+
+	n_source++;
+	old_input = parseInput(fp); //here documents, extra lines
+	if (cmd->argc > 2)
+		set_params(cmd->argv + 2, cmd->argc - 2);
+
+	while ((line = getLine(fp)) != NULL)
+	{
+		n_line++;
+		list = tokenize(line);
+		free(line);
+		if (list == NULL)
+			continue;
+
+		tree = parse(list);
+		freeList(list);
+		if (tree == NULL) //stop at a syntax error
+		{
+			fprintf(stderr, "%s: line %d: syntax error\n",
+					cmd->argv[1], n_line);
+			status = ERROR;
+			break;
+		}
+
+		status = process(tree);
+		freeCMD(tree);
+	}
+
+	if (cmd->argc > 2)
+		set_params(saved, n_saved);
+	parseInput(old_input);
+	n_source--;
+	fclose(fp);
+
+	return status;
+}
+
+
 ////////////// PROCESS //////////////
 
 
@@ -580,33 +2457,28 @@ int exec_wait(void)
 int process (CMD *cmdList)
 {
 	int status;
-	char str_status[2];
 	pid_t pid; 
+	struct code code = {NULL, 0, 0};
 
 	//reap zombies
 	while ((pid = waitpid((pid_t)(-1), &status, WNOHANG)) > 0)
-		fprintf(stderr, "Completed: %d (%d)\n", pid, status); 
-
-	//set local variables
-	for(int i = 0; i < cmdList->nLocal; i++) //each variable
-		setenv(cmdList->locVar[i], cmdList->locVal[i], 1);
+		job_done(pid, status);
 
-	status = seq_cmd(cmdList);
-	// status = !status; //flip so that 0->failure 1->success 
+	if (!par_seq(cmdList, &status)) //unless PARSEQ ran it
+	{
+		compile_seq(&code, cmdList);
+		if (getenv("DUMP_CODE")) //show the compiled command line
+			dump_code(&code);
+		status = run_code(&code);
+		free_code(&code);
+	}
+	wild_flush(); //listings last one command line
 
 	//set ? as status. 
-	*str_status = (char)(48 + status);
-	str_status[1] = 0; //null term
-
-	setenv("?", str_status, 1);
-	
-
-	//unset local variables
-	for(int i = 0; i < cmdList->nLocal; i++) //each variable
-		status = unsetenv(cmdList->locVar[i]);
+	set_status(status);
 
 
-	return 0;
+	return status;
 }
 
 //NOTES & REFERENCES: 
@@ -617,7 +2489,7 @@ int process (CMD *cmdList)
 //Guidance on reaping zombies from 
 //http://www.microhowto.info/howto/reap_zombie_processes_using_a_sigchld_handler.html
 //
-//pipe_cmd is guided by piping in c example by Doug Von at 
+//start_stage is guided by piping in c example by Doug Von at 
 //https://github.com/dougvk
 //
 
@@ -11,11 +11,24 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 // #include <linux/limits.h>
 #include <limits.h>
 // #include "/c/cs323/Hwk5/parse.h"
 #include "parse.h"
+#include "getLine.h"
+#include "wild.h"
+#include "copy.h"
+#include "policy.h"
+#include "limit.h"
+#include "deadline.h"
+#include "memo.h"
+#include "jobgraph.h"
+#include "watch.h"
+#include "coproc.h"
 
 // Execute command list CMDLIST and return status of last command executed
 int process (CMD *cmdList);
@@ -0,0 +1,631 @@
+// runtests.c                                Phil Esterman (11/13/15)
+//
+// Parallel replacement for the Perl test.Bsh that also times
+// the cases:
+//
+//   runtests [-j JOBS] [-d DIR] [-p PROGRAM] [-b BASELINE] [-u]
+//            [-s PCT] [NN ...]
+//
+// Runs each case DIR/tNN (default tests, the cases kept with the
+// source) that has an answer DIR/tNN.t (or just those numbered
+// NN), up to JOBS at once (default: one per CPU).
+// As under test.Bsh, each runs in a new temporary directory with
+// a copy of PROGRAM (default ./Bsh), its CPU time limited to 2
+// seconds (4 hard), its wall time to 10, its files to 100000 KiB,
+// and its processes to 1000; an executable tNN is run itself,
+// else PROGRAM is run with tNN as stdin. A case passes if its
+// stdout is tNN.t and its stderr is empty.
+//
+// The wall, user, and sys time of each case and the processes its
+// shells created (through FORKS_FILE; see mainBsh.c) are shown
+// and compared with those in BASELINE (default DIR/baseline). A
+// case that takes more than PCT percent (default 50) and
+// TIME_FLOOR ms more user + sys time than its baseline, or that
+// creates more processes, fails just as a wrong answer does. With
+// -u the baseline is rewritten from the cases that passed. The
+// exit status is 0 if every case passed, else 1.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+#define STDOUT (1)
+#define STDERR (2)
+
+//limits, as set by test.Bsh
+#define CPU_SOFT (2)        //seconds
+#define CPU_HARD (4)
+#define WALL_LIMIT (10)     //seconds
+#define FILE_LIMIT (100000) //KiB
+#define PROC_LIMIT (1000)
+
+#define TEST_DIR "tests"
+#define SLACK_PCT (50)      //default extra time allowed over baseline
+#define TIME_FLOOR (10)     //ms of extra time always allowed
+#define POLL_MS (5)         //between polls of cases without a pidfd
+
+enum {
+	T_WAITING,
+	T_RUNNING,
+	T_DONE
+};
+
+struct test {
+	char *name;         //tNN
+	char *file;         //its absolute path
+	int exec;           //run it, not PROGRAM?
+	int state;
+	pid_t pid;
+	int pidfd;
+	char dir[32];       //its temporary directory
+	int out, err;       //memfds with its output
+	double start;
+	int timed_out;
+	double wall, user, sys; //ms
+	int forks;
+	int failed;
+	int has_base;       //baseline from BASELINE
+	double base_wall, base_user, base_sys;
+	int base_forks;
+};
+
+struct options {
+	char *dir, *program, *baseline;
+	int jobs, update, slack;
+};
+
+double now_ms (void);
+int by_name (const void *a, const void *b);
+char *slurp (int fd, char *path, size_t *len);
+int find_tests (struct options *o, char **only, int n_only,
+		struct test **tests);
+void read_baseline (struct options *o, struct test *tests, int n);
+int write_baseline (struct options *o, struct test *tests, int n);
+int make_dir (struct test *t, struct options *o);
+int clear_path (const char *path, const struct stat *st, int flag,
+		struct FTW *ftw);
+int remove_path (const char *path, const struct stat *st, int flag,
+		struct FTW *ftw);
+void remove_dir (struct test *t);
+void start_test (struct test *t, struct options *o);
+void reap_test (struct test *t, struct options *o);
+void check_test (struct test *t, struct options *o);
+void show_diff (char *want, size_t n_want, char *got, size_t n_got);
+
+
+////////////// FILES //////////////
+
+
+//the monotonic time in milliseconds
+double now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+//the contents of FD (or if -1, the file PATH), setting *LEN;
+//malloc()-ed and null-terminated, or NULL if unreadable
+char *slurp (int fd, char *path, size_t *len)
+{
+	size_t size = 4096;
+	char *buf = malloc(size);
+	ssize_t n;
+	int own = (fd < 0);
+
+	if (own && (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		free(buf);
+		return NULL;
+	}
+	if (!own)
+		lseek(fd, 0, SEEK_SET);
+
+	*len = 0;
+	while ((n = read(fd, buf + *len, size - *len - 1)) > 0)
+	{
+		*len += n;
+		if (*len + 1 == size)
+			buf = realloc(buf, size *= 2);
+	}
+	buf[*len] = '\0';
+	if (own)
+		close(fd);
+	return buf;
+}
+
+//compare test names
+int by_name (const void *a, const void *b)
+{
+	return strcmp(((struct test *)a)->name, ((struct test *)b)->name);
+}
+
+//set *TESTS to the cases tNN in O->dir with answers tNN.t (only
+//those in ONLY[N_ONLY] if any); return how many, or -1
+int find_tests (struct options *o, char **only, int n_only,
+		struct test **tests)
+{
+	char path[PATH_MAX], *name;
+	struct dirent *e;
+	struct stat st;
+	int n = 0, size = 0, wanted;
+	DIR *dir;
+
+	if ((dir = opendir(o->dir)) == NULL)
+	{
+		perror(o->dir);
+		return -1;
+	}
+	*tests = NULL;
+	while ((e = readdir(dir)) != NULL)
+	{
+		name = e->d_name;
+		if (name[0] != 't' || !name[1]
+				|| strspn(name + 1, "0123456789") != strlen(name + 1))
+			continue;
+		wanted = (n_only == 0);
+		for (int i = 0; i < n_only && !wanted; i++)
+			wanted = !strcmp(only[i], name) || !strcmp(only[i], name + 1);
+		snprintf(path, sizeof(path), "%s/%s.t", o->dir, name);
+		if (!wanted || access(path, R_OK) < 0)
+			continue;
+
+		if (n == size)
+			*tests = realloc(*tests, (size = 2 * size + 16) * sizeof(**tests));
+		memset(&(*tests)[n], 0, sizeof(**tests));
+		(*tests)[n].name = strdup(name);
+		snprintf(path, sizeof(path), "%s/%s", o->dir, name);
+		(*tests)[n].file = strdup(path);
+		(*tests)[n].exec = (stat(path, &st) == 0 && (st.st_mode & S_IXUSR));
+		(*tests)[n].pidfd = (*tests)[n].out = (*tests)[n].err = -1;
+		n++;
+	}
+	closedir(dir);
+	qsort(*tests, n, sizeof(**tests), by_name);
+	return n;
+}
+
+
+////////////// BASELINE //////////////
+
+//The baseline has a line "tNN WALL USER SYS FORKS" (times in ms)
+//for each case.
+
+
+//read the baseline for the N TESTS, if any
+void read_baseline (struct options *o, struct test *tests, int n)
+{
+	char name[64];
+	double wall, user, sys;
+	int forks;
+	FILE *fp;
+
+	if ((fp = fopen(o->baseline, "r")) == NULL)
+		return;
+	while (fscanf(fp, "%63s", name) == 1)
+	{
+		if (name[0] != '#' && fscanf(fp, "%lf %lf %lf %d",
+					&wall, &user, &sys, &forks) == 4)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				if (strcmp(tests[i].name, name) == 0)
+				{
+					tests[i].has_base = 1;
+					tests[i].base_wall = wall;
+					tests[i].base_user = user;
+					tests[i].base_sys = sys;
+					tests[i].base_forks = forks;
+				}
+			}
+		}
+		fscanf(fp, "%*[^\n]"); //rest of the line
+	}
+	fclose(fp);
+}
+
+//rewrite the baseline with the N TESTS that passed, keeping the
+//lines for other cases
+int write_baseline (struct options *o, struct test *tests, int n)
+{
+	char tmp[PATH_MAX], line[256], name[64];
+	FILE *in, *out;
+	int kept;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", o->baseline);
+	if ((out = fopen(tmp, "w")) == NULL)
+	{
+		perror(tmp);
+		return ERROR;
+	}
+	fprintf(out, "# runtests baseline: case wall user sys (ms) forks\n");
+	if ((in = fopen(o->baseline, "r")) != NULL)
+	{
+		while (fgets(line, sizeof(line), in))
+		{
+			kept = (line[0] != '#' && sscanf(line, "%63s", name) == 1);
+			for (int i = 0; kept && i < n; i++)
+				if (strcmp(tests[i].name, name) == 0 && !tests[i].failed)
+					kept = 0;
+			if (kept)
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	for (int i = 0; i < n; i++)
+		if (!tests[i].failed)
+			fprintf(out, "%s %.1f %.1f %.1f %d\n", tests[i].name,
+					tests[i].wall, tests[i].user, tests[i].sys, tests[i].forks);
+
+	if (fclose(out) != 0 || rename(tmp, o->baseline) < 0)
+	{
+		perror(o->baseline);
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+
+////////////// RUNNING //////////////
+
+
+//make the temporary directory of T with a copy of the program
+//in its subdirectory w
+int make_dir (struct test *t, struct options *o)
+{
+	char path[64];
+	int in, out;
+	ssize_t n;
+
+	strcpy(t->dir, "/tmp/TEST.Bsh.XXXXXX");
+	if (mkdtemp(t->dir) == NULL)
+		return ERROR;
+	snprintf(path, sizeof(path), "%s/w", t->dir);
+	if (mkdir(path, 0755) < 0)
+		return ERROR;
+
+	snprintf(path, sizeof(path), "%s/w/Bsh", t->dir);
+	if ((in = open(o->program, O_RDONLY | O_CLOEXEC)) < 0)
+		return ERROR;
+	if ((out = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0755)) < 0)
+	{
+		close(in);
+		return ERROR;
+	}
+	while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+		;
+	close(in);
+	close(out);
+	return n < 0 ? ERROR : SUCCESS;
+}
+
+//let the owner remove whatever a case left at PATH
+int clear_path (const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	if (flag == FTW_D || flag == FTW_DNR)
+		chmod(path, 0700);
+	return 0;
+}
+
+//remove PATH (children first)
+int remove_path (const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	remove(path);
+	return 0;
+}
+
+//remove the temporary directory of T
+void remove_dir (struct test *t)
+{
+	if (!t->dir[0])
+		return;
+	nftw(t->dir, clear_path, 16, FTW_PHYS);
+	nftw(t->dir, remove_path, 16, FTW_PHYS | FTW_DEPTH);
+	t->dir[0] = '\0';
+}
+
+//start case T
+void start_test (struct test *t, struct options *o)
+{
+	char forks[64];
+	struct rlimit cpu = {CPU_SOFT, CPU_HARD},
+		fsize = {FILE_LIMIT * 1024L, FILE_LIMIT * 1024L},
+		nproc = {PROC_LIMIT, PROC_LIMIT};
+	int in;
+
+	t->state = T_RUNNING;
+	t->out = memfd_create("runtests", MFD_CLOEXEC);
+	t->err = memfd_create("runtests", MFD_CLOEXEC);
+	if (t->out < 0 || t->err < 0 || make_dir(t, o) != SUCCESS)
+	{
+		perror(t->name);
+		t->failed = 1;
+		t->state = T_DONE;
+		return;
+	}
+	snprintf(forks, sizeof(forks), "%s/forks", t->dir);
+
+	fflush(stdout);
+	t->start = now_ms();
+	if ((t->pid = fork()) < 0)
+	{
+		perror(t->name);
+		t->failed = 1;
+		t->state = T_DONE;
+		return;
+	}
+	if (t->pid == 0)
+	{
+		setpgid(0, 0); //so that all of it can be killed
+		in = open(t->exec ? "/dev/null" : t->file, O_RDONLY);
+		dup2(in, STDIN);
+		dup2(t->out, STDOUT);
+		dup2(t->err, STDERR);
+		setrlimit(RLIMIT_CPU, &cpu);
+		setrlimit(RLIMIT_FSIZE, &fsize);
+		setrlimit(RLIMIT_NPROC, &nproc);
+		setenv("FORKS_FILE", forks, 1);
+		if (chdir(t->dir) < 0 || chdir("w") < 0)
+			_exit(ERROR);
+		if (t->exec)
+			execl(t->file, t->file, (char *)NULL);
+		else
+			execl("./Bsh", "./Bsh", (char *)NULL);
+		perror("exec");
+		_exit(ERROR);
+	}
+	setpgid(t->pid, t->pid);
+	t->pidfd = syscall(SYS_pidfd_open, t->pid, 0);
+}
+
+//reap case T, which is done; kill what it left running
+void reap_test (struct test *t, struct options *o)
+{
+	struct rusage ru;
+	char path[64], *text, *p, *end;
+	size_t len;
+	int status;
+
+	while (wait4(t->pid, &status, 0, &ru) < 0 && errno == EINTR)
+		;
+	t->wall = now_ms() - t->start;
+	kill(-t->pid, SIGKILL); //any background children
+	t->user = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+	t->sys = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+	if (t->pidfd >= 0)
+		close(t->pidfd);
+
+	snprintf(path, sizeof(path), "%s/forks", t->dir);
+	t->forks = 0;
+	if ((text = slurp(-1, path, &len)) != NULL)
+	{
+		for (p = text; (t->forks += strtol(p, &end, 10), end != p); p = end)
+			;
+		free(text);
+	}
+	remove_dir(t);
+	t->state = T_DONE;
+	check_test(t, o);
+}
+
+//show where output GOT (N_GOT bytes) first differs from WANT
+void show_diff (char *want, size_t n_want, char *got, size_t n_got)
+{
+	size_t i = 0, line = 1, bol = 0;
+
+	for (; i < n_want && i < n_got && want[i] == got[i]; i++)
+	{
+		if (want[i] == '\n')
+		{
+			line++;
+			bol = i + 1;
+		}
+	}
+	printf("      line %zu:\n", line);
+	printf("      want: %.*s\n", (int)strcspn(want + bol, "\n"), want + bol);
+	printf("      got:  %.*s\n", (int)strcspn(got + bol, "\n"), got + bol);
+}
+
+//compare the output and costs of case T with what is expected,
+//and report it
+void check_test (struct test *t, struct options *o)
+{
+	char *want, *got, *err, answer[PATH_MAX];
+	size_t n_want, n_got, n_err;
+	double cpu = t->user + t->sys, limit;
+	int wrong, noisy, slow, forked;
+
+	limit = (t->base_user + t->base_sys) * (100 + o->slack) / 100
+		+ TIME_FLOOR;
+	snprintf(answer, sizeof(answer), "%s.t", t->file);
+	want = slurp(-1, answer, &n_want);
+	got = slurp(t->out, NULL, &n_got);
+	err = slurp(t->err, NULL, &n_err);
+	close(t->out);
+	close(t->err);
+
+	wrong = (!want || n_want != n_got || memcmp(want, got, n_got));
+	noisy = (n_err > 0);
+	slow = (t->has_base && cpu > limit);
+	forked = (t->has_base && t->forks > t->base_forks);
+	t->failed = (t->timed_out || wrong || noisy || slow || forked);
+
+	printf("%-6s %s  wall %8.1f ms  user %7.1f ms  sys %7.1f ms  forks %4d\n",
+			t->name, t->failed ? "FAIL" : "pass", t->wall, t->user, t->sys,
+			t->forks);
+	if (t->timed_out)
+		printf("    Time limit exceeded\n");
+	if (wrong && want)
+	{
+		printf("    Error: STDOUT differs from expected\n");
+		show_diff(want, n_want, got, n_got);
+	}
+	if (noisy)
+		printf("    Error: STDERR should be empty\n      %.*s\n",
+				(int)strcspn(err, "\n"), err);
+	if (slow)
+		printf("    Slower: %.1f ms user + sys, baseline %.1f ms\n",
+				cpu, t->base_user + t->base_sys);
+	if (forked)
+		printf("    More processes: %d, baseline %d\n", t->forks,
+				t->base_forks);
+	fflush(stdout);
+
+	free(want);
+	free(got);
+	free(err);
+}
+
+int main (int argc, char *argv[])
+{
+	struct options o = {TEST_DIR, "./Bsh", NULL, 0, 0, SLACK_PCT};
+	char dir[PATH_MAX], program[PATH_MAX], *baseline = NULL;
+	struct test *tests;
+	struct pollfd *fds;
+	siginfo_t info;
+	int n, opt, running = 0, next = 0, polled, ms, n_failed = 0;
+	double start, serial = 0, t_now;
+
+	while ((opt = getopt(argc, argv, "j:d:p:b:us:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j': o.jobs = atoi(optarg); break;
+			case 'd': o.dir = optarg; break;
+			case 'p': o.program = optarg; break;
+			case 'b': baseline = optarg; break;
+			case 'u': o.update = 1; break;
+			case 's': o.slack = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: runtests [-j JOBS] [-d DIR]"
+						" [-p PROGRAM] [-b BASELINE] [-u] [-s PCT]"
+						" [NN ...]\n");
+				return ERROR;
+		}
+	}
+	if (o.jobs < 1 && (o.jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		o.jobs = 1;
+	if (!realpath(o.dir, dir) || !realpath(o.program, program))
+	{
+		perror(realpath(o.dir, dir) ? o.program : o.dir);
+		return ERROR;
+	}
+	o.dir = dir;
+	o.program = program;
+	if (baseline)
+		o.baseline = baseline;
+	else if (asprintf(&o.baseline, "%s/baseline", o.dir) < 0)
+		return ERROR;
+
+	if ((n = find_tests(&o, argv + optind, argc - optind, &tests)) <= 0)
+	{
+		fprintf(stderr, "runtests: no cases in %s\n", o.dir);
+		return ERROR;
+	}
+	read_baseline(&o, tests, n);
+	fds = malloc(n * sizeof(*fds));
+
+	start = now_ms();
+	for (int done = 0; done < n; )
+	{
+		while (running < o.jobs && next < n) //fill the free slots
+		{
+			start_test(&tests[next], &o);
+			if (tests[next++].state == T_RUNNING)
+				running++;
+			else
+				done++;
+		}
+
+		ms = -1; //sleep until a case exits or hits its limit
+		polled = 0;
+		t_now = now_ms();
+		for (int i = 0; i < n; i++)
+		{
+			fds[i].fd = -1;
+			fds[i].events = POLLIN;
+			if (tests[i].state != T_RUNNING)
+				continue;
+			fds[i].fd = tests[i].pidfd;
+			polled |= (tests[i].pidfd < 0);
+			int left = (int)(tests[i].start + WALL_LIMIT * 1000 - t_now) + 1;
+			if (ms < 0 || left < ms)
+				ms = left < 0 ? 0 : left;
+		}
+		if (polled && (ms < 0 || ms > POLL_MS))
+			ms = POLL_MS;
+		if (running > 0 && poll(fds, n, ms) < 0 && errno != EINTR)
+		{
+			perror("poll");
+			break;
+		}
+
+		t_now = now_ms();
+		for (int i = 0; i < n; i++)
+		{
+			struct test *t = &tests[i];
+			if (t->state != T_RUNNING)
+				continue;
+			if (t_now - t->start > WALL_LIMIT * 1000 && !t->timed_out)
+			{
+				t->timed_out = 1;
+				kill(-t->pid, SIGKILL);
+				kill(t->pid, SIGKILL);
+			}
+			info.si_pid = 0;
+			if ((fds[i].revents & POLLIN) || (t->pidfd < 0
+					&& waitid(P_PID, t->pid, &info,
+						WEXITED | WNOHANG | WNOWAIT) == 0
+					&& info.si_pid == t->pid))
+			{
+				reap_test(t, &o);
+				running--;
+				done++;
+			}
+		}
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		serial += tests[i].wall;
+		n_failed += tests[i].failed;
+	}
+	printf("\n%d cases: %d passed, %d failed in %.2f s"
+			" (%.2f s one at a time)\n", n, n - n_failed, n_failed,
+			(now_ms() - start) / 1000, serial / 1000);
+	if (o.update && write_baseline(&o, tests, n) == SUCCESS)
+		printf("baseline %s updated\n", o.baseline);
+
+	for (int i = 0; i < n; i++)
+	{
+		free(tests[i].name);
+		free(tests[i].file);
+	}
+	free(tests);
+	free(fds);
+	if (!baseline)
+		free(o.baseline);
+
+	return n_failed ? ERROR : SUCCESS;
+}
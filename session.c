@@ -0,0 +1,324 @@
+// session.c                                 Phil Esterman (11/13/15)
+//
+// Session logs: record the lines read at the prompt and replay them.  See
+// session.h for the format.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "getLine.h"
+#include "parse.h"
+#include "session.h"
+
+#define STUB "/bin/true"        // Program run for every program by --stub
+
+struct record {
+    uint32_t kind, len;
+    int64_t when;
+    int32_t status;
+    uint32_t took;
+};
+
+static int logFd = -1;          // LOG being recorded to, or -1
+static char *lastDir;           // Directory in its last 'D' record
+static char *lastLine;          // Line read but not yet recorded (and the
+                                //   lines parse() read after it)
+static int64_t readAt;          //   and when (microseconds, monotonic)
+static FILE *recording;         // Stream given to parseInput() (see below)
+static char *pending;           // Line it read from stdin
+static size_t nPending;         //   and its length
+static size_t atPending;        //   and how much of it was returned
+
+
+// Return the time on CLOCK in microseconds
+static int64_t micros (clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime (clock, &ts);
+    return ts.tv_sec * (int64_t) 1000000 + ts.tv_nsec / 1000;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Recording
+
+// Append a record of KIND with STATUS and TOOK and the text TEXT to the log;
+// header and text go in one write() so that shells sharing the log do not
+// interleave them
+static void writeRecord (int kind, const char *text, int status, int64_t took)
+{
+    size_t len = text ? strlen (text) : 0;
+    struct record r;
+    char *buf = malloc (sizeof(r) + len);
+
+    r.kind   = kind;
+    r.len    = len;
+    r.when   = micros (CLOCK_REALTIME);
+    r.status = status;
+    r.took   = (took > UINT32_MAX) ? UINT32_MAX : took;
+    memcpy (buf, &r, sizeof(r));
+    if (len > 0)
+	memcpy (buf + sizeof(r), text, len);
+    if (write (logFd, buf, sizeof(r) + len) < 0) {
+	perror ("--record");                    // Stop recording
+	close (logFd);
+	logFd = -1;
+    }
+    free (buf);
+}
+
+
+// Read function of the stream that parse() reads here documents and the rest
+// of groups and loops from while recording: read them from stdin a line at a
+// time, append each to lastLine, and return up to SIZE chars of it in BUF
+static ssize_t readRecorded (void *cookie, char *buf, size_t size)
+{
+    char *line;
+    size_t len;
+
+    if (atPending == nPending) {
+	if ((line = getLine (stdin)) == NULL)
+	    return 0;
+	if (lastLine) {                         // Part of the line's record
+	    len = strlen (lastLine);
+	    lastLine = realloc (lastLine, len + strlen (line) + 1);
+	    strcpy (lastLine + len, line);
+	}
+	free (pending);
+	pending   = line;
+	nPending  = strlen (line);
+	atPending = 0;
+    }
+    len = (nPending - atPending < size) ? nPending - atPending : size;
+    memcpy (buf, pending + atPending, len);
+    atPending += len;
+    return len;
+}
+
+
+// Start appending the lines read at the prompt to LOG; return 0 if
+// successful, else -1
+int recordOpen (const char *log)
+{
+    cookie_io_functions_t io = { readRecorded, NULL, NULL, NULL };
+
+    logFd = open (log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (logFd < 0)
+	return -1;
+    writeRecord ('S', NULL, 0, 0);
+    if ((recording = fopencookie (NULL, "r", io)) != NULL)
+	parseInput (recording);
+    return 0;
+}
+
+
+// Note that LINE was just read at the prompt (if recording), first recording
+// the working directory if it changed
+void recordRead (const char *line)
+{
+    char *dir;
+
+    if (logFd < 0)
+	return;
+    readAt = micros (CLOCK_MONOTONIC);
+    if ((dir = getcwd (NULL, 0)) && (!lastDir || strcmp (dir, lastDir))) {
+	writeRecord ('D', dir, 0, 0);
+	free (lastDir);
+	lastDir = dir;
+    } else {
+	free (dir);
+    }
+    free (lastLine);
+    lastLine = strdup (line);
+    if (recording)                              // Read on after an end of
+	clearerr (recording);                   //   file in a here document
+}
+
+
+// Record the line last read with status STATUS (if recording)
+void recordDone (int status)
+{
+    if (logFd < 0 || !lastLine)
+	return;
+    writeRecord ('L', lastLine, status, micros (CLOCK_MONOTONIC) - readAt);
+    free (lastLine);
+    lastLine = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Replaying
+
+// Return the CPU time in microseconds used by WHO (RUSAGE_SELF or
+// RUSAGE_CHILDREN)
+static int64_t cpu (int who)
+{
+    struct rusage ru;
+
+    getrusage (who, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * (int64_t) 1000000
+	 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+// Sleep until CLOCK_MONOTONIC reaches AT microseconds
+static void sleepUntil (int64_t at)
+{
+    struct timespec ts = { at / 1000000, at % 1000000 * 1000 };
+
+    if (at > micros (CLOCK_MONOTONIC))
+	clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+
+// Run the line TEXT (LEN chars) of record R, number N, and print what it cost
+// to REPORT; add the costs to TOTAL[]
+static void replayLine (char *text, size_t len, struct record *r, int n,
+			FILE *report, int64_t total[])
+{
+    int process (CMD *);
+    int fork_count (void);
+    int64_t t0, t1, t2, self, child, status = -1;
+    size_t first = strcspn (text, "\n");       // The line read at the prompt
+    char *line;                                 //   (with its newline), and
+    token *list;                                //   the lines the parser read
+    CMD *cmd = NULL;                            //   after it (if any)
+    FILE *rest = NULL, *old;
+    int nFork = fork_count();
+
+    first = (first < len) ? first + 1 : len;
+    line  = strndup (text, first);
+    if (first < len)
+	rest = fmemopen (text + first, len - first, "r");
+    old = parseInput (rest);
+
+    t0    = micros (CLOCK_MONOTONIC);
+    self  = cpu (RUSAGE_SELF);
+    child = cpu (RUSAGE_CHILDREN);
+
+    if ((list = tokenize (line)) != NULL) {     // Parse ...
+	cmd = parse (list);
+	freeList (list);
+    }
+    t1 = micros (CLOCK_MONOTONIC);
+    parseInput (old);
+    if (rest)
+	fclose (rest);
+    if (cmd) {                                  //   and run
+	status = process (cmd);
+	freeCMD (cmd);
+    }
+    t2 = micros (CLOCK_MONOTONIC);
+
+    self  = cpu (RUSAGE_SELF) - self;
+    child = cpu (RUSAGE_CHILDREN) - child;
+    nFork = fork_count() - nFork;
+    fprintf (report, "%d\t%lld\t%lld\t%lld\t%lld\t%d\t%lld\t%d\t%u\t%.*s\n",
+	     n, (long long) (t1 - t0), (long long) self, (long long) child,
+	     (long long) (t2 - t0), nFork, (long long) status, r->status,
+	     r->took, (int) strcspn (line, "\n"), line);
+    fflush (report);
+    free (line);
+
+    total[0] += t1 - t0;
+    total[1] += self;
+    total[2] += child;
+    total[3] += t2 - t0;
+    total[4] += nFork;
+    total[5] += r->took;
+}
+
+
+// Replay the log named by ARGV[ARGC-1] with options ARGV[0], ...,
+// ARGV[ARGC-2]; return the exit status of Bsh
+int replaySession (int argc, char *argv[])
+{
+    int paced = 0, stub = 0, fd, null, n = 0;
+    int64_t total[6] = {0}, sessionAt = 0, replayAt = 0;
+    struct record r;
+    struct stat st;
+    char *map, *p, *end, *dir;
+    FILE *report;
+
+    for ( ; argc > 1; argc--, argv++) {
+	if (!strcmp (argv[0], "--paced"))
+	    paced = 1;
+	else if (!strcmp (argv[0], "--stub"))
+	    stub = 1;
+	else
+	    break;
+    }
+    if (argc != 1) {
+	fprintf (stderr, "usage: Bsh --replay [--paced] [--stub] LOG\n");
+	return EXIT_FAILURE;
+    }
+
+    if ((fd = open (argv[0], O_RDONLY)) < 0 || fstat (fd, &st) < 0) {
+	perror (argv[0]);
+	return EXIT_FAILURE;
+    }
+    map = (st.st_size > 0)
+	? mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close (fd);
+    if (map == MAP_FAILED) {
+	perror (argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    if (stub)                                   // Unless a stub is given
+	setenv ("EXEC_STUB", STUB, 0);
+    report = fdopen (dup (STDOUT_FILENO), "w"); // The report keeps stdout;
+    if ((null = open ("/dev/null", O_RDWR)) >= 0) {     //   the commands
+	dup2 (null, STDIN_FILENO);                      //   get /dev/null
+	dup2 (null, STDOUT_FILENO);
+	close (null);
+    }
+    fprintf (report, "#line\tparse\tshell\tchild\twall\tforks\tstatus"
+		     "\twas\ttook\tcommand\n");
+
+    for (p = map, end = map ? map + st.st_size : map;  p < end;  p += r.len) {
+	if ((size_t) (end - p) < sizeof(r)) {
+	    fprintf (stderr, "%s: truncated record\n", argv[0]);
+	    break;
+	}
+	memcpy (&r, p, sizeof(r));
+	p += sizeof(r);
+	if (r.len > (size_t) (end - p)) {
+	    fprintf (stderr, "%s: truncated record\n", argv[0]);
+	    break;
+	}
+
+	if (r.kind == 'S') {                    // A new session
+	    sessionAt = r.when;
+	    replayAt  = micros (CLOCK_MONOTONIC);
+	} else if (r.kind == 'D') {             // Its directory if there
+	    dir = strndup (p, r.len);
+	    if (chdir (dir) < 0)
+		fprintf (stderr, "%s: %s: not replaying in it\n", argv[0], dir);
+	    free (dir);
+	} else if (r.kind == 'L') {
+	    if (paced && sessionAt)
+		sleepUntil (replayAt + (r.when - sessionAt));
+	    replayLine (p, r.len, &r, ++n, report, total);
+	}
+    }
+
+    fprintf (report, "#total\t%lld\t%lld\t%lld\t%lld\t%lld\t\t\t%lld\t%d lines\n",
+	     (long long) total[0], (long long) total[1], (long long) total[2],
+	     (long long) total[3], (long long) total[4], (long long) total[5],
+	     n);
+    fclose (report);
+    if (map)
+	munmap (map, st.st_size);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+// session.h                                 Phil Esterman (11/13/15)
+//
+// Session logs, for benchmarking Bsh on real traffic.
+//
+//   Bsh --record LOG [FILE ...]   as usual, but append a record of each line
+//                                   read at the prompt to LOG
+//   Bsh --replay [--paced] [--stub] LOG
+//                                 run the lines in LOG again and report
+//                                   what each one cost
+//
+// LOG is append-only; several shells may record to it at once, since each
+// record is written with a single write().  A record is a header
+//
+//   uint32_t kind     'S' at the start of a session, 'D' when the working
+//                       directory changes, 'L' for a line
+//   uint32_t len      bytes of text after the header
+//   int64_t when      microseconds since the epoch when it was read
+//   int32_t status    status of the line (-1 if blank or not parsed)
+//   uint32_t took     microseconds from reading it to its status
+//
+// followed by the text (the directory or the line, with its newline).  The
+// text of a line also holds the lines the parser read after it (the bodies of
+// here documents and the rest of unfinished groups and loops), and replay
+// gives those to the parser in turn.
+//
+// Replay runs each line in the directory it was recorded in (if that exists;
+// else the current one) with stdin and stdout /dev/null.  With --paced it
+// waits until each line is as far into the replay as it was into its session;
+// else it runs them back to back.  With --stub every program is replaced by
+// /bin/true (see EXEC_STUB in process.c), so the log can be replayed on a box
+// that has none of them; builtins, functions, and the shell's own work still
+// run.  For each line it prints to stdout, tab-separated: its number, the
+// microseconds spent parsing, the CPU time of the shell itself (parsing,
+// forking, and waiting) and of the children it reaped, the elapsed time, the
+// processes created, its status now and when recorded, and the recorded time;
+// then totals.
+
+// Start appending the lines read at the prompt to LOG; return 0 if
+// successful, else -1.  Makes parse() read its extra lines through a stream
+// that logs them (see parseInput() in parse.h).
+int recordOpen (const char *log);
+
+// Note that LINE was just read at the prompt (if recording)
+void recordRead (const char *line);
+
+// Record the line last read with status STATUS (if recording)
+void recordDone (int status);
+
+// Replay the log named by ARGV[ARGC-1] with options ARGV[0], ...,
+// ARGV[ARGC-2]; return the exit status of Bsh
+int replaySession (int argc, char *argv[]);
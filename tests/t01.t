@@ -0,0 +1,9 @@
+(1)$ hello world
+(2)$ a-b
+c-d
+(3)$ yes
+(4)$ no
+(5)$ after
+(6)$ 1
+(7)$ 0
+(8)$ 
\ No newline at end of file
@@ -0,0 +1,6 @@
+(1)$ (2)$ (3)$ one
+two
+(4)$ 2
+(5)$ 4
+(6)$ gone
+(7)$ 
\ No newline at end of file
@@ -0,0 +1,7 @@
+(1)$ a
+b
+(2)$ HI
+(3)$ 3
+(4)$ y
+(5)$ q
+(6)$ 
\ No newline at end of file
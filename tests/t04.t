@@ -0,0 +1,8 @@
+(1)$ 2
+(2)$ /
+(3)$ 1
+(4)$ 3
+(5)$ in
+(6)$ /tmp
+/
+(7)$ 
\ No newline at end of file
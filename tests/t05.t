@@ -0,0 +1,5 @@
+(1)$ line one
+line two
+(2)$ HELLO
+(3)$ 3
+(4)$ 
\ No newline at end of file
@@ -0,0 +1,7 @@
+(1)$ abc
+(2)$ x y end
+(3)$ xp qy
+(4)$ from-proc
+(5)$ nested
+(6)$ 1
+(7)$ 
\ No newline at end of file
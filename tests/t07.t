@@ -0,0 +1,9 @@
+(1)$ 2
+(2)$ a
+b
+c
+(3)$ (4)$ one
+2
+(5)$ 0
+(6)$ done
+(7)$ 
\ No newline at end of file
@@ -0,0 +1,5 @@
+(1)$ (2)$ 1.c a.c b.c
+(3)$ c.h 1.c
+(4)$ *.c c.h
+(5)$ nothing*here
+(6)$ 
\ No newline at end of file
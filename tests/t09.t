@@ -0,0 +1,29 @@
+(1)$ FIRST
+(2)$ MID
+(3)$ 1
+mid
+(4)$ last
+(5)$ 2
+(6)$ added
+m
+(7)$ Z
+(8)$ g2
+(9)$ 2
+(10)$ (11)$ arg
+func
+(12)$ a
+(13)$ a
+(14)$ 0
+x
+(15)$ y
+y
+(16)$ Bsh
+copy
+o1
+o2
+o3
+o4
+o5
+(17)$ 1
+(18)$ 1
+(19)$ 
\ No newline at end of file
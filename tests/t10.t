@@ -0,0 +1,11 @@
+(1)$ (2)$ /
+(3)$ /tmp
+(4)$ in
+grp
+(5)$ in
+grp
+(6)$ (7)$ x
+func
+(8)$ /
+/tmp
+(9)$ 
\ No newline at end of file
@@ -0,0 +1,8 @@
+(1)$ 1
+(2)$ 2
+(3)$ 0
+(4)$ 0
+(5)$ 123
+(6)$ 123
+(7)$ failed
+(8)$ SIMPLE: : Argument list too long
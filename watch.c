@@ -0,0 +1,351 @@
+// watch.c                                   Phil Esterman (11/13/15)
+//
+// The watch builtin. See watch.h. The paths are watched with
+// inotify; poll() sleeps until an event comes, the debounce window
+// closes, or (by its pidfd) the current run exits. Files replaced
+// by rename, as editors save them, are watched again by name.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "watch.h"
+#include "parse.h"
+#include "limit.h"
+#include "deadline.h"
+
+#define SUCCESS (0)
+#define ERROR (1)
+
+#define STDIN (0)
+
+#define DEBOUNCE_MS (100) //quiet time that ends a burst of events
+#define POLL_MS (10)      //between polls of a run without a pidfd
+#define EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE \
+		| IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF \
+		| IN_MOVE_SELF)
+
+struct watcher {
+	int fd;        //inotify instance
+	char **path;   //watched path of each watch descriptor
+	int size_path;
+	int n_watches;
+	CMD *cmd;      //the command line
+	pid_t pid;     //its current run, or 0
+	int pidfd;     //of the run, or -1
+	int started;   //runs started
+	int status;    //of the last run
+};
+
+int process (CMD *cmdList);
+pid_t count_fork (void);
+double clock_now (void);
+
+int watch_add (struct watcher *w, char *path);
+int watch_events (struct watcher *w);
+void watch_start (struct watcher *w, double first, int n_events);
+void watch_reap (struct watcher *w);
+void watch_cancel (struct watcher *w);
+void watch_free (struct watcher *w);
+
+
+//watch PATH, and if a directory, the ones below it not named .*
+int watch_add (struct watcher *w, char *path)
+{
+	struct stat st;
+	struct dirent *e;
+	DIR *dir;
+	char *sub;
+	int wd;
+
+	if ((wd = inotify_add_watch(w->fd, path, EVENTS)) < 0)
+	{
+		perror(path);
+		return ERROR;
+	}
+	if (wd >= w->size_path)
+	{
+		int size = 2 * wd + 16;
+		w->path = realloc(w->path, size * sizeof(char *));
+		memset(w->path + w->size_path, 0,
+				(size - w->size_path) * sizeof(char *));
+		w->size_path = size;
+	}
+	if (w->path[wd] == NULL)
+		w->n_watches++;
+	free(w->path[wd]);
+	w->path[wd] = strdup(path);
+
+	if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)
+			|| (dir = opendir(path)) == NULL)
+		return SUCCESS;
+	while ((e = readdir(dir)) != NULL)
+	{
+		if (e->d_name[0] == '.'
+				|| (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN))
+			continue;
+		if (asprintf(&sub, "%s/%s", path, e->d_name) < 0)
+			break;
+		if (e->d_type == DT_DIR || (stat(sub, &st) == 0 && S_ISDIR(st.st_mode)))
+			watch_add(w, sub);
+		free(sub);
+	}
+	closedir(dir);
+	return SUCCESS;
+}
+
+//read the events waiting; return how many were changes
+int watch_events (struct watcher *w)
+{
+	union {
+		struct inotify_event ev;
+		char bytes[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	} buf;
+	struct inotify_event *ev;
+	ssize_t len;
+	char *path, *sub;
+	int n = 0;
+
+	while ((len = read(w->fd, &buf, sizeof(buf))) > 0)
+	{
+		for (char *p = buf.bytes; p < buf.bytes + len;
+				p += sizeof(*ev) + ev->len)
+		{
+			ev = (struct inotify_event *)p;
+			path = (ev->wd >= 0 && ev->wd < w->size_path)
+				? w->path[ev->wd] : NULL;
+
+			if (ev->mask & IN_Q_OVERFLOW) //lost some: a change
+				n++;
+			else if (path == NULL)
+				;
+			else if (ev->mask & IN_IGNORED) //gone, or replaced
+			{
+				w->path[ev->wd] = NULL;
+				w->n_watches--;
+				if (access(path, F_OK) == 0)
+					watch_add(w, path);
+				free(path);
+				n++;
+			}
+			else if (ev->len > 0 && ev->name[0] == '.')
+				; //hidden, e.g., an editor's swap file
+			else
+			{
+				if ((ev->mask & (IN_CREATE | IN_MOVED_TO))
+						&& (ev->mask & IN_ISDIR)
+						&& asprintf(&sub, "%s/%s", path, ev->name) >= 0)
+				{
+					watch_add(w, sub);
+					free(sub);
+				}
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+//start a run, N_EVENTS events after the FIRST came (0 if none)
+void watch_start (struct watcher *w, double first, int n_events)
+{
+	int null;
+
+	if ((w->pid = count_fork()) < 0)
+	{
+		perror("watch");
+		w->pid = 0;
+		w->status = ERROR;
+		return;
+	}
+	if (w->pid == 0)
+	{
+		setpgid(0, 0); //so a cancel reaches all of it
+		if ((null = open("/dev/null", O_RDONLY)) >= 0)
+		{
+			dup2(null, STDIN);
+			close(null);
+		}
+		close(w->fd);
+		w->status = process(w->cmd);
+		fflush(stdout);
+		_exit(w->status);
+	}
+
+	setpgid(w->pid, w->pid);
+	w->pidfd = syscall(SYS_pidfd_open, w->pid, 0);
+	w->started++;
+	if (first > 0)
+		fprintf(stderr, "watch: %d event%s, run %d started %.1f ms after the first\n",
+				n_events, n_events == 1 ? "" : "s", w->started,
+				(clock_now() - first) * 1000);
+}
+
+//reap the current run if it is done
+void watch_reap (struct watcher *w)
+{
+	int status;
+
+	if (waitpid(w->pid, &status, WNOHANG) == 0)
+		return;
+	w->status = limit_status(w->pid, status);
+	if (w->status)
+		fprintf(stderr, "watch: run %d failed (%d)\n", w->started, w->status);
+	if (w->pidfd >= 0)
+		close(w->pidfd);
+	w->pidfd = -1;
+	w->pid = 0;
+}
+
+//stop the current run: SIGTERM, then SIGKILL after TIMEOUT_GRACE
+void watch_cancel (struct watcher *w)
+{
+	struct deadline saved;
+	int status;
+
+	kill(-w->pid, SIGTERM);
+	kill(w->pid, SIGTERM);
+	deadline_push(TIMEOUT_GRACE, 0, &saved);
+	wait_fg(&w->pid, &status, 1);
+	deadline_pop(&saved);
+	w->status = limit_status(w->pid, status);
+	fprintf(stderr, "watch: run %d cancelled\n", w->started);
+	if (w->pidfd >= 0)
+		close(w->pidfd);
+	w->pidfd = -1;
+	w->pid = 0;
+}
+
+//free W
+void watch_free (struct watcher *w)
+{
+	for (int i = 0; i < w->size_path; i++)
+		free(w->path[i]);
+	free(w->path);
+	if (w->fd >= 0)
+		close(w->fd);
+	freeCMD(w->cmd);
+}
+
+//watch [-d MS] [-n RUNS] PATH ... -- COMMAND ...
+int exec_watch (int argc, char **argv)
+{
+	struct watcher w = {-1, NULL, 0, 0, NULL, 0, -1, 0, SUCCESS};
+	int debounce = DEBOUNCE_MS, max_runs = 0, i, n_paths, n_events = 0;
+	double first = 0, last = 0, now;
+	struct pollfd fds[2];
+	char *line, *end;
+	size_t size = 2;
+	token *list;
+	int ms;
+
+	for (i = 1; i + 1 < argc && (strcmp(argv[i], "-d") == 0
+				|| strcmp(argv[i], "-n") == 0); i += 2)
+	{
+		ms = strtol(argv[i+1], &end, 10);
+		if (*end || ms < 0)
+		{
+			fprintf(stderr, "watch: %s: invalid number\n", argv[i+1]);
+			return ERROR;
+		}
+		if (argv[i][1] == 'd')
+			debounce = ms;
+		else
+			max_runs = ms;
+	}
+	for (n_paths = 0; i + n_paths < argc && strcmp(argv[i + n_paths], "--");
+			n_paths++)
+		;
+	if (n_paths == 0 || i + n_paths + 1 >= argc)
+	{
+		fprintf(stderr, "usage: watch [-d MS] [-n RUNS] PATH ... -- COMMAND ...\n");
+		return ERROR;
+	}
+
+	for (int j = i + n_paths + 1; j < argc; j++) //parse it once
+		size += strlen(argv[j]) + 1;
+	line = calloc(size, 1);
+	for (int j = i + n_paths + 1; j < argc; j++)
+	{
+		strcat(line, argv[j]);
+		strcat(line, j + 1 < argc ? " " : "\n");
+	}
+	list = tokenize(line);
+	free(line);
+	if (list == NULL || (w.cmd = parse(list)) == NULL)
+	{
+		freeList(list);
+		fprintf(stderr, "watch: syntax error\n");
+		return ERROR;
+	}
+	freeList(list);
+
+	if ((w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+	{
+		perror("watch");
+		watch_free(&w);
+		return ERROR;
+	}
+	for (int j = i; j < i + n_paths; j++)
+	{
+		if (watch_add(&w, argv[j]) != SUCCESS)
+		{
+			watch_free(&w);
+			return ERROR;
+		}
+	}
+
+	watch_start(&w, 0, 0);
+	while (w.pid || (w.n_watches > 0 && (!max_runs || w.started < max_runs)))
+	{
+		ms = -1;
+		if (n_events > 0)
+		{
+			ms = (int)((last - clock_now()) * 1000) + debounce + 1;
+			ms = ms < 0 ? 0 : ms;
+		}
+		if (w.pid && w.pidfd < 0 && (ms < 0 || ms > POLL_MS))
+			ms = POLL_MS;
+
+		fds[0].fd = w.fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = w.pid ? w.pidfd : -1;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, ms) < 0 && errno != EINTR)
+		{
+			perror("watch");
+			break;
+		}
+
+		now = clock_now();
+		if ((fds[0].revents & POLLIN) && (i = watch_events(&w)) > 0)
+		{
+			if (n_events == 0)
+				first = now;
+			n_events += i;
+			last = now;
+		}
+		if (w.pid)
+			watch_reap(&w);
+		if (n_events > 0 && (now - last) * 1000 >= debounce
+				&& (!max_runs || w.started < max_runs))
+		{
+			if (w.pid)
+				watch_cancel(&w);
+			watch_start(&w, first, n_events);
+			n_events = 0;
+		}
+	}
+
+	watch_free(&w);
+	return w.status;
+}
@@ -0,0 +1,22 @@
+// watch.h                                   Phil Esterman (11/13/15)
+//
+// The watch builtin: run a command line again whenever the files
+// it depends on change.
+//
+//   watch [-d MS] [-n RUNS] PATH ... -- COMMAND ...
+//
+// The words after -- are joined and parsed once as a command line
+// (so quote |, ;, and && to pass them), which is run at once and
+// then each time a PATH changes. A directory stands for the files
+// in it and in its subdirectories (but not those named .*). The
+// events of a burst, until none come for MS milliseconds
+// (default 100), make one run. A run still going when the next
+// one is due is sent SIGTERM (SIGKILL after TIMEOUT_GRACE
+// seconds) and reaped first. Each run is a child with stdin
+// /dev/null, and each is reported on stderr with how long after
+// the first event it started. Watch returns the status of the
+// last run after RUNS runs (default: forever) or once every PATH
+// is gone.
+
+//watch [-d MS] [-n RUNS] PATH ... -- COMMAND ...
+int exec_watch (int argc, char **argv);
@@ -0,0 +1,511 @@
+// wild.c                                    Phil Esterman (11/13/15)
+//
+// Pathname expansion for Bsh's backend. Each /-separated part
+// of a pattern is compiled into a list of steps that a name is
+// matched against in one pass (backing up only to the last *).
+// Directories are read with getdents64() into a large buffer,
+// and their listings are kept until wild_flush() (once per
+// command line), so a loop that globs the same directory again
+// and again reads it once. A listing is read again if the
+// directory has changed since, or if it changed within a
+// second of being read (when a later change might not move
+// its time stamp).
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "wild.h"
+
+#define DIR_BUF (1 << 20) //bytes of directory entries read at a time
+#define N_DIRS  (8)       //# directory listings kept
+
+//what a step of a compiled pattern matches
+enum {
+	W_CHAR, //the character c
+	W_ANY,  //any character (?)
+	W_STAR, //any string (*)
+	W_SET   //any character in set ([...])
+};
+
+struct step {
+	int op;
+	unsigned char c;
+	unsigned char set[32]; //bit map of the characters in a [...]
+};
+
+//the character classes [:NAME:] allowed in a [...]
+static struct {
+	char *name;
+	int (*is) (int c);
+} classes[] = {
+	{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+	{"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+	{"lower", islower}, {"print", isprint}, {"punct", ispunct},
+	{"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}
+};
+
+//the names in a directory
+struct listing {
+	char *path;           //the directory ("." for the current one)
+	struct stat st;       //its status when read
+	int racy;             //changed too recently to trust st?
+	char *names;          //the names, each followed by a null
+	size_t *off;          //offset in names of each name
+	unsigned char *type;  //and its d_type
+	int n;
+	size_t size_names, size_off;
+	unsigned long used;   //time of last use
+};
+
+//entry returned by getdents64()
+struct linux_dirent64 {
+	uint64_t ino;
+	int64_t off;
+	unsigned short reclen;
+	unsigned char type;
+	char name[];
+};
+
+static struct listing dirs[N_DIRS];
+static unsigned long n_uses = 0;
+static char *dir_buf = NULL;
+
+char *class_end (char *p);
+int class_len (char *p);
+void class_add (unsigned char *set, char *p, int len);
+int compile (char *part, struct step **steps);
+int match (struct step *steps, int n, const char *name);
+struct listing *list_dir (char *path);
+int read_dir (char *path, struct listing *l);
+void free_listing (struct listing *l);
+char *cat_path (char *dir, char *name, char *sep, size_t n_sep);
+int by_name (const void *a, const void *b);
+
+
+////////////// PATTERNS //////////////
+
+
+//return the length of the [:NAME:] beginning at P, or 0
+int class_len (char *p)
+{
+	int n;
+
+	if (p[0] != '[' || p[1] != ':')
+		return 0;
+	for (n = 2; p[n] >= 'a' && p[n] <= 'z'; n++)
+		;
+	return (n > 2 && p[n] == ':' && p[n+1] == ']') ? n + 2 : 0;
+}
+
+//add the characters of the [:NAME:] at P, of length LEN, to
+//the bit map SET (none if NAME is not a class, as in bash)
+void class_add (unsigned char *set, char *p, int len)
+{
+	for (size_t i = 0; i < sizeof(classes) / sizeof(*classes); i++)
+	{
+		if (strncmp(classes[i].name, p + 2, len - 4) != 0
+				|| classes[i].name[len - 4])
+			continue;
+		for (int c = 1; c < 256; c++)
+			if (classes[i].is(c))
+				set[c >> 3] |= 1 << (c & 7);
+		return;
+	}
+}
+
+//return the character after the ] that closes the [...]
+//beginning at P, or NULL if there is none in this part
+char *class_end (char *p)
+{
+	int len;
+
+	p++;
+	if (*p == '!' || *p == '^')
+		p++;
+	if (*p == ']') //a ] first is in the set
+		p++;
+	for (; *p && *p != '/'; p++)
+	{
+		if (*p == QUOTE_MARK && p[1])
+			p++;
+		else if ((len = class_len(p)))
+			p += len - 1;
+		else if (*p == ']')
+			return p + 1;
+	}
+	return NULL;
+}
+
+//is WORD a pattern?
+int is_wild (char *word)
+{
+	for (; *word; word++)
+	{
+		if (*word == QUOTE_MARK && word[1])
+			word++;
+		else if (*word == '*' || *word == '?'
+				|| (*word == '[' && class_end(word)))
+			return 1;
+	}
+	return 0;
+}
+
+//compile PART of a pattern (no /) into *STEPS (malloc-ed);
+//return the number of steps, or -1 if it has no wildcard
+int compile (char *part, struct step **steps)
+{
+	struct step *s = calloc(strlen(part) + 1, sizeof(*s));
+	char *p = part, *end;
+	int n = 0, wild = 0, negate, lo, hi, len;
+
+	while (*p)
+	{
+		if (*p == QUOTE_MARK && p[1])
+		{
+			s[n].op = W_CHAR;
+			s[n++].c = p[1];
+			p += 2;
+		}
+		else if (*p == '*')
+		{
+			if (n == 0 || s[n-1].op != W_STAR) //** is *
+				s[n++].op = W_STAR;
+			p++;
+			wild = 1;
+		}
+		else if (*p == '?')
+		{
+			s[n++].op = W_ANY;
+			p++;
+			wild = 1;
+		}
+		else if (*p == '[' && (end = class_end(p)))
+		{
+			s[n].op = W_SET;
+			p++;
+			if ((negate = (*p == '!' || *p == '^')))
+				p++;
+			for (int first = 1; first || *p != ']'; first = 0)
+			{
+				if ((len = class_len(p)))
+				{
+					class_add(s[n].set, p, len);
+					p += len;
+					continue;
+				}
+				if (*p == QUOTE_MARK)
+					p++;
+				lo = hi = (unsigned char)*p++;
+				if (p[0] == '-' && p[1] != ']' && p + 1 < end - 1)
+				{
+					p++;
+					if (*p == QUOTE_MARK)
+						p++;
+					hi = (unsigned char)*p++;
+				}
+				for (int c = lo; c <= hi; c++)
+					s[n].set[c >> 3] |= 1 << (c & 7);
+			}
+			if (negate)
+				for (int i = 0; i < 32; i++)
+					s[n].set[i] = ~s[n].set[i];
+			s[n].set[0] &= ~1; //never the null
+			n++;
+			p = end;
+			wild = 1;
+		}
+		else
+		{
+			s[n].op = W_CHAR;
+			s[n++].c = *p++;
+		}
+	}
+
+	*steps = s;
+	return wild ? n : -1;
+}
+
+//does NAME match the N STEPS? On a mismatch the last * takes
+//one more character and the match goes on after it.
+int match (struct step *steps, int n, const char *name)
+{
+	int i = 0, star = -1;
+	const char *mark = NULL;
+	unsigned char c;
+
+	while ((c = *name))
+	{
+		if (i < n && steps[i].op == W_STAR)
+		{
+			star = ++i;
+			mark = name;
+			continue;
+		}
+		if (i < n && (steps[i].op == W_ANY
+				|| (steps[i].op == W_CHAR && steps[i].c == c)
+				|| (steps[i].op == W_SET
+					&& steps[i].set[c >> 3] & (1 << (c & 7)))))
+		{
+			i++;
+			name++;
+			continue;
+		}
+		if (star < 0)
+			return 0;
+		i = star;
+		name = ++mark;
+	}
+
+	while (i < n && steps[i].op == W_STAR)
+		i++;
+	return i == n;
+}
+
+
+////////////// DIRECTORIES //////////////
+
+
+//the listing of directory PATH, read now unless a listing
+//of it is kept and it has not changed; NULL if unreadable
+struct listing *list_dir (char *path)
+{
+	struct listing *l, *old = dirs;
+	struct stat st;
+
+	for (l = dirs; l < dirs + N_DIRS; l++)
+	{
+		if (l->path && strcmp(l->path, path) == 0)
+		{
+			if (!l->racy && stat(path, &st) == 0 && st.st_dev == l->st.st_dev
+					&& st.st_ino == l->st.st_ino
+					&& st.st_mtim.tv_sec == l->st.st_mtim.tv_sec
+					&& st.st_mtim.tv_nsec == l->st.st_mtim.tv_nsec
+					&& st.st_ctim.tv_sec == l->st.st_ctim.tv_sec
+					&& st.st_ctim.tv_nsec == l->st.st_ctim.tv_nsec)
+			{
+				l->used = ++n_uses;
+				return l;
+			}
+			old = l; //changed: read it again
+			break;
+		}
+		if (l->used < old->used) //least recently used (or free)
+			old = l;
+	}
+
+	free_listing(old);
+	if (read_dir(path, old) != 0)
+	{
+		free_listing(old);
+		return NULL;
+	}
+	old->used = ++n_uses;
+	return old;
+}
+
+//read the names in directory PATH into *L; return 0 if
+//successful, else -1
+int read_dir (char *path, struct listing *l)
+{
+	int fd;
+	long got;
+	size_t len, used = 0;
+	struct timespec now;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+	if (fstat(fd, &l->st) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	l->path = strdup(path);
+	clock_gettime(CLOCK_REALTIME, &now);
+	l->racy = (now.tv_sec <= l->st.st_mtim.tv_sec + 1
+			|| now.tv_sec <= l->st.st_ctim.tv_sec + 1);
+
+	if (!dir_buf)
+		dir_buf = malloc(DIR_BUF);
+
+	while ((got = syscall(SYS_getdents64, fd, dir_buf, DIR_BUF)) > 0)
+	{
+		for (long at = 0; at < got; )
+		{
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(dir_buf + at);
+			at += d->reclen;
+
+			if (d->name[0] == '.' && (d->name[1] == '\0'
+					|| (d->name[1] == '.' && d->name[2] == '\0')))
+				continue; //never . or ..
+
+			len = strlen(d->name) + 1;
+			if (used + len > l->size_names)
+			{
+				l->size_names = 2 * l->size_names + len + DIR_BUF;
+				l->names = realloc(l->names, l->size_names);
+			}
+			if ((size_t) l->n == l->size_off)
+			{
+				l->size_off = 2 * l->size_off + 64;
+				l->off = realloc(l->off, l->size_off * sizeof(size_t));
+				l->type = realloc(l->type, l->size_off);
+			}
+			memcpy(l->names + used, d->name, len);
+			l->off[l->n] = used;
+			l->type[l->n++] = d->type;
+			used += len;
+		}
+	}
+	close(fd);
+
+	return got < 0 ? -1 : 0;
+}
+
+//free the storage of listing *L and mark it unused
+void free_listing (struct listing *l)
+{
+	free(l->path);
+	free(l->names);
+	free(l->off);
+	free(l->type);
+	memset(l, 0, sizeof(*l));
+}
+
+//forget the directory listings
+void wild_flush (void)
+{
+	for (int i = 0; i < N_DIRS; i++)
+		if (dirs[i].path)
+			free_listing(&dirs[i]);
+}
+
+
+////////////// EXPANSION //////////////
+
+
+//return DIR, NAME, and the N_SEP characters at SEP joined in
+//a malloc-ed string
+char *cat_path (char *dir, char *name, char *sep, size_t n_sep)
+{
+	size_t n_dir = strlen(dir), n_name = strlen(name);
+	char *path = malloc(n_dir + n_name + n_sep + 1);
+
+	memcpy(path, dir, n_dir);
+	memcpy(path + n_dir, name, n_name);
+	memcpy(path + n_dir + n_name, sep, n_sep);
+	path[n_dir + n_name + n_sep] = '\0';
+	return path;
+}
+
+int by_name (const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+//append the pathnames that match pattern WORD, sorted, to the
+//NULL-terminated array *WORDS of *N words; return the number
+//appended (0 if none match)
+int wild_expand (char *word, char ***words, int *n)
+{
+	char **paths, **next, *part, *p = word, *end, *sep, *path;
+	int n_paths = 1, n_next, size_next, n_steps, wild = 0, check = 0, kept;
+	struct step *steps;
+	struct listing *l;
+	struct stat st;
+
+	for (end = p; *end == '/'; end++) //absolute?
+		;
+	paths = malloc(sizeof(char *));
+	paths[0] = strndup(p, end - p);
+
+	for (p = end; *p && n_paths > 0; p = sep)
+	{
+		for (end = p; *end && *end != '/'; end++)
+			if (*end == QUOTE_MARK && end[1])
+				end++;
+		for (sep = end; *sep == '/'; sep++)
+			;
+		part = strndup(p, end - p);
+
+		if ((n_steps = compile(part, &steps)) < 0) //no wildcard
+		{
+			unquote(part);
+			for (int i = 0; i < n_paths; i++)
+			{
+				path = cat_path(paths[i], part, end, sep - end);
+				free(paths[i]);
+				paths[i] = path;
+			}
+			check = 1; //may not exist
+		}
+		else
+		{
+			next = NULL;
+			n_next = size_next = 0;
+			for (int i = 0; i < n_paths; i++)
+			{
+				if ((l = list_dir(*paths[i] ? paths[i] : ".")) == NULL)
+					continue;
+				for (int j = 0; j < l->n; j++)
+				{
+					char *name = l->names + l->off[j];
+					if (name[0] == '.' && !(steps[0].op == W_CHAR
+							&& steps[0].c == '.'))
+						continue; //hidden unless . is given
+					if (sep > end && l->type[j] != DT_DIR
+							&& l->type[j] != DT_LNK
+							&& l->type[j] != DT_UNKNOWN)
+						continue; //not a directory
+					if (!match(steps, n_steps, name))
+						continue;
+					if (n_next == size_next)
+					{
+						size_next = 2 * size_next + 16;
+						next = realloc(next, size_next * sizeof(char *));
+					}
+					next[n_next++] = cat_path(paths[i], name, end, sep - end);
+				}
+			}
+			for (int i = 0; i < n_paths; i++)
+				free(paths[i]);
+			free(paths);
+			paths = next;
+			n_paths = n_next;
+			wild = 1;
+			check = (sep > end && !*sep); //a trailing / needs a directory
+		}
+		free(steps);
+		free(part);
+	}
+
+	//after a literal part or a trailing /, keep only the
+	//pathnames that exist
+	kept = 0;
+	for (int i = 0; i < n_paths; i++)
+	{
+		if (wild && (!check || lstat(paths[i], &st) == 0))
+			paths[kept++] = paths[i];
+		else
+			free(paths[i]);
+	}
+
+	if (kept > 0)
+	{
+		qsort(paths, kept, sizeof(char *), by_name);
+		*words = realloc(*words, (*n + kept + 1) * sizeof(char *));
+		memcpy(*words + *n, paths, kept * sizeof(char *));
+		*n += kept;
+		(*words)[*n] = NULL;
+	}
+	free(paths);
+
+	return kept;
+}
@@ -0,0 +1,21 @@
+// wild.h                                    Phil Esterman (11/13/15)
+//
+// Pathname expansion of the patterns *, ?, and [...] in words.
+// A [...] may hold characters, ranges a-z, and the classes
+// [:alpha:], [:digit:], and so on (those of <ctype.h>, in the C
+// locale); a ! or ^ first negates it. A character preceded by
+// QUOTE_MARK (see parse.h) matches only itself.
+
+#include "parse.h"
+
+//is WORD a pattern, i.e., does it hold an unquoted *, ?, or [
+//that begins a complete [...]?
+int is_wild (char *word);
+
+//append the pathnames that match pattern WORD, sorted, to the
+//NULL-terminated array *WORDS of *N words; return the number
+//appended (0 if none match)
+int wild_expand (char *word, char ***words, int *n);
+
+//forget the directory listings read since the last call
+void wild_flush (void);